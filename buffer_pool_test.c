@@ -0,0 +1,254 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ec_buffer_pool.h"
+
+#define PROG_NAME "buffer_pool_test"
+
+#define HELD_MAX (8)
+#define HANDOFF_COUNT (256)
+#define TAG_STRIDE (4096)
+
+const char * usage =
+"This program gets and puts buffer pool buffers from many threads at once,\n"
+"checking that no buffer is handed out twice and that buffers returned by\n"
+"another thread than the one that got them are reused safely.\n\n"
+"usage: " PROG_NAME " [threads iterations]\n"
+"Example: " PROG_NAME " 8 20000\n\n";
+
+// a mix of size classes, including sizes that are not a power of two
+const size_t sizes[] = {1, 4096, 5000, 65536, 200000, 1 << 20};
+
+#define NUM_SIZES (sizeof(sizes) / sizeof(sizes[0]))
+
+struct thread_data {
+    struct ec_buffer_pool * pool;
+    int id;
+    int iterations;
+    uint8_t ** handoff;     // buffers got by this thread
+    struct thread_data * from;  // thread whose buffers this one puts
+    uint64_t failed;
+};
+
+struct held {
+    uint8_t * buf;
+    size_t size;
+    uint8_t tag;
+};
+
+/*
+ * Tag the first byte of every page and the last byte of a buffer
+ */
+static void
+buf_tag(uint8_t * buf, size_t size, uint8_t tag) {
+    for (size_t i = 0; i < size; i += TAG_STRIDE)
+        buf[i] = tag;
+    buf[size - 1] = tag;
+}
+
+/*
+ * A buffer still holds its tags, i.e. nobody else was handed it
+ */
+static int
+buf_check(uint8_t * buf, size_t size, uint8_t tag) {
+    for (size_t i = 0; i < size; i += TAG_STRIDE)
+        if (buf[i] != tag)
+            return 0;
+
+    return buf[size - 1] == tag;
+}
+
+static int
+buf_get(struct thread_data * td, struct held * h, size_t size, uint8_t tag) {
+    h->buf = ec_buffer_pool_get(td->pool, size);
+    if (!h->buf) {
+        printf("Error: thread %d could not get %zu bytes\n", td->id, size);
+        td->failed++;
+        return -1;
+    }
+
+    if ((uintptr_t) h->buf % 64) {
+        printf("Error: buffer %p is not 64-byte aligned\n", (void *) h->buf);
+        td->failed++;
+    }
+
+    h->size = size;
+    h->tag = tag;
+    buf_tag(h->buf, size, tag);
+
+    return 0;
+}
+
+static void
+buf_put(struct thread_data * td, struct held * h) {
+    if (!buf_check(h->buf, h->size, h->tag)) {
+        printf("Error: buffer %p was handed out twice\n", (void *) h->buf);
+        td->failed++;
+    }
+
+    ec_buffer_pool_put(td->pool, h->buf, h->size);
+    h->buf = NULL;
+}
+
+void * worker(void * arg) {
+    struct thread_data * td = arg;
+    struct held held[HELD_MAX];
+    unsigned seed = td->id;
+
+    memset(held, 0, sizeof(held));
+
+    // random gets and puts, several buffers in flight at a time
+    for (int it = 0; it < td->iterations; it++) {
+        struct held * h = &held[rand_r(&seed) % HELD_MAX];
+
+        if (h->buf) {
+            buf_put(td, h);
+        } else {
+            size_t size = sizes[rand_r(&seed) % NUM_SIZES];
+
+            if (buf_get(td, h, size, (uint8_t) (td->id * HELD_MAX + (h - held))))
+                break;
+        }
+    }
+
+    for (int i = 0; i < HELD_MAX; i++)
+        if (held[i].buf)
+            buf_put(td, &held[i]);
+
+    return 0;
+}
+
+/*
+ * Buffers got by one thread and put by another end up in the putting
+ * thread's cache and the shared lists
+ */
+void * handoff_get(void * arg) {
+    struct thread_data * td = arg;
+
+    for (int i = 0; i < HANDOFF_COUNT; i++) {
+        td->handoff[i] = ec_buffer_pool_get(td->pool, 4096);
+        if (!td->handoff[i]) {
+            printf("Error: could not get a buffer to hand off\n");
+            td->failed++;
+            break;
+        }
+        buf_tag(td->handoff[i], 4096, td->id);
+    }
+
+    return 0;
+}
+
+void * handoff_put(void * arg) {
+    struct thread_data * td = arg;
+
+    uint8_t ** bufs = td->from->handoff;
+
+    for (int i = 0; i < HANDOFF_COUNT && bufs[i]; i++) {
+        if (!buf_check(bufs[i], 4096, td->from->id)) {
+            printf("Error: handed off buffer %p was changed\n", (void *) bufs[i]);
+            td->failed++;
+        }
+        ec_buffer_pool_put(td->pool, bufs[i], 4096);
+    }
+
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    int num_threads = 8;
+    int iterations = 20000;
+    int rc = 0;
+    uint64_t failed = 0;
+    pthread_t * threads = 0;
+    struct thread_data * td = 0;
+    uint8_t ** handoff = 0;
+    struct ec_buffer_pool * pool = 0;
+
+    if (argc != 1 && argc != 3) {
+        printf("Requires 0 or 2 parameters.\n\n");
+        printf("%s\n\n", usage);
+        exit(1);
+    }
+
+    if (argc == 3) {
+        num_threads = atoi(argv[1]);
+        iterations = atoi(argv[2]);
+    }
+
+    if (num_threads < 2 || num_threads > 32) {
+        printf("Use 2 to 32 threads.\n\n");
+        exit(1);
+    }
+
+    pool = ec_buffer_pool_init(0);
+    if (!pool) {
+        printf("Error initializing buffer pool.\n");
+        exit(1);
+    }
+
+    threads = calloc(num_threads, sizeof(*threads));
+    td = calloc(num_threads, sizeof(*td));
+    handoff = calloc((size_t) num_threads * HANDOFF_COUNT, sizeof(*handoff));
+    if (!threads || !td || !handoff) {
+        printf("Error allocating memory.\n");
+        rc = -1;
+        goto err;
+    }
+
+    for (int i = 0; i < num_threads; i++) {
+        td[i].pool = pool;
+        td[i].id = i;
+        td[i].iterations = iterations;
+        td[i].handoff = &handoff[(size_t) i * HANDOFF_COUNT];
+        td[i].from = &td[(i + num_threads - 1) % num_threads];
+    }
+
+    printf("Random get/put on %d threads...\n", num_threads);
+    for (int i = 0; i < num_threads; i++) {
+        rc = pthread_create(&threads[i], NULL, worker, &td[i]);
+        if (rc) {
+            printf("Error creating thread. (error=%d)\n", rc);
+            goto err;
+        }
+    }
+    for (int i = 0; i < num_threads; i++)
+        pthread_join(threads[i], NULL);
+
+    // every thread gets buffers, then the next thread puts them
+    printf("Handing buffers between threads...\n");
+    for (int i = 0; i < num_threads; i++) {
+        rc = pthread_create(&threads[i], NULL, handoff_get, &td[i]);
+        if (rc) {
+            printf("Error creating thread. (error=%d)\n", rc);
+            goto err;
+        }
+    }
+    for (int i = 0; i < num_threads; i++)
+        pthread_join(threads[i], NULL);
+
+    for (int i = 0; i < num_threads; i++) {
+        rc = pthread_create(&threads[i], NULL, handoff_put, &td[i]);
+        if (rc) {
+            printf("Error creating thread. (error=%d)\n", rc);
+            goto err;
+        }
+    }
+    for (int i = 0; i < num_threads; i++)
+        pthread_join(threads[i], NULL);
+
+    for (int i = 0; i < num_threads; i++)
+        failed += td[i].failed;
+
+    printf("Results: %s, %lu errors.\n", failed ? "failed" : "passed", failed);
+    rc = failed ? 1 : 0;
+
+err:
+    free(handoff);
+    free(td);
+    free(threads);
+    ec_buffer_pool_cleanup(pool);
+
+    return rc;
+}
@@ -0,0 +1,70 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "crc32c.h"
+
+#if defined(__x86_64__)
+#define CRC32C_HAVE_SSE42 1
+#include <nmmintrin.h>
+#endif
+
+#define CRC32C_POLY (0x82f63b78) // reflected Castagnoli polynomial
+
+static uint32_t crc32c_tbl[256];
+
+static uint32_t (*crc32c_fn)(uint32_t, const uint8_t *, size_t);
+
+static pthread_once_t crc32c_once = PTHREAD_ONCE_INIT;
+
+static uint32_t
+crc32c_table(uint32_t crc, const uint8_t * buf, size_t len) {
+    for (size_t i = 0; i < len; i++)
+        crc = crc32c_tbl[(crc ^ buf[i]) & 0xff] ^ (crc >> 8);
+
+    return crc;
+}
+
+#ifdef CRC32C_HAVE_SSE42
+__attribute__((target("sse4.2")))
+static uint32_t
+crc32c_sse42(uint32_t crc, const uint8_t * buf, size_t len) {
+    uint64_t crc64 = crc;
+    size_t i = 0;
+
+    for (; i + 8 <= len; i += 8) {
+        uint64_t word = 0;
+        memcpy(&word, &buf[i], sizeof(word));
+        crc64 = _mm_crc32_u64(crc64, word);
+    }
+
+    crc = (uint32_t) crc64;
+    for (; i < len; i++)
+        crc = _mm_crc32_u8(crc, buf[i]);
+
+    return crc;
+}
+#endif
+
+static void
+crc32c_init() {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; bit++)
+            crc = (crc & 1) ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+        crc32c_tbl[i] = crc;
+    }
+
+    crc32c_fn = crc32c_table;
+#ifdef CRC32C_HAVE_SSE42
+    if (__builtin_cpu_supports("sse4.2"))
+        crc32c_fn = crc32c_sse42;
+#endif
+}
+
+uint32_t
+crc32c(uint32_t crc, const void * buf, size_t len) {
+    pthread_once(&crc32c_once, crc32c_init);
+
+    return ~crc32c_fn(~crc, buf, len);
+}
@@ -0,0 +1,14 @@
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Update a CRC32C (Castagnoli) checksum with len bytes of buf.  Start with
+ * crc = 0; the result of one call can be passed in to continue the checksum
+ * over the next buffer.  Uses the SSE4.2 crc32 instruction when available.
+ */
+uint32_t crc32c(uint32_t crc, const void * buf, size_t len);
+
+#endif /* CRC32C_H */
@@ -0,0 +1,284 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "ec_async.h"
+#include "erasure_code.h"
+
+struct ec_job_list {
+    struct ec_job * head;
+    struct ec_job * tail;
+};
+
+struct ec_async {
+    int num_threads;
+    pthread_t * threads;
+    int efd;
+
+    pthread_mutex_t lock;
+    pthread_cond_t work;        // queued jobs or stop
+    pthread_cond_t finished;    // a job finished
+    struct ec_job_list queued[EC_JOB_PRIO_NUM];
+    struct ec_job_list completed;
+    int outstanding;            // submitted jobs not finished yet
+    int stop;
+};
+
+static void
+ec_job_list_push(struct ec_job_list * list, struct ec_job * job) {
+    job->next = NULL;
+    if (list->tail)
+        list->tail->next = job;
+    else
+        list->head = job;
+    list->tail = job;
+}
+
+static struct ec_job *
+ec_job_list_pop(struct ec_job_list * list) {
+    struct ec_job * job = list->head;
+
+    if (job) {
+        list->head = job->next;
+        if (!list->head)
+            list->tail = NULL;
+    }
+
+    return job;
+}
+
+/*
+ * Highest priority queued job, or NULL; called with the lock held
+ */
+static struct ec_job *
+ec_async_next(struct ec_async * async) {
+    for (int prio = 0; prio < EC_JOB_PRIO_NUM; prio++) {
+        struct ec_job * job = ec_job_list_pop(&async->queued[prio]);
+        if (job)
+            return job;
+    }
+
+    return NULL;
+}
+
+static int
+ec_job_run(struct ec_job * job) {
+    switch (job->op) {
+        case EC_JOB_ENCODE:
+            return ec_encode_region(job->in, job->out, job->len, NULL);
+        case EC_JOB_DECODE:
+            return ec_decode_region(job->in, job->indices, job->out,
+                                    job->len, NULL);
+        case EC_JOB_RECONSTRUCT:
+            return ec_reconstruct(job->in, job->erased, job->len);
+        default:
+            printf("Unknown job operation %d.\n", job->op);
+            return -1;
+    }
+}
+
+static void *
+ec_async_worker(void * arg) {
+    struct ec_async * async = arg;
+
+    pthread_mutex_lock(&async->lock);
+
+    while (1) {
+        struct ec_job * job = ec_async_next(async);
+
+        if (!job) {
+            if (async->stop)
+                break;
+            pthread_cond_wait(&async->work, &async->lock);
+            continue;
+        }
+
+        pthread_mutex_unlock(&async->lock);
+
+        job->rc = ec_job_run(job);
+
+        // the job belongs to the caller again once done() is called
+        int callback = job->done != NULL;
+        if (callback)
+            job->done(job);
+
+        pthread_mutex_lock(&async->lock);
+
+        if (!callback) {
+            uint64_t one = 1;
+
+            ec_job_list_push(&async->completed, job);
+            if (write(async->efd, &one, sizeof(one)) != sizeof(one))
+                printf("Error signalling job completion. (errno=%d)\n", errno);
+        }
+
+        async->outstanding--;
+        pthread_cond_broadcast(&async->finished);
+    }
+
+    pthread_mutex_unlock(&async->lock);
+
+    return NULL;
+}
+
+struct ec_async *
+ec_async_init(int threads) {
+    int rc = 0;
+
+    struct ec_async * async = calloc(1, sizeof(*async));
+    if (!async) {
+        printf("Error allocating memory for async pool.\n");
+        return NULL;
+    }
+
+    pthread_mutex_init(&async->lock, NULL);
+    pthread_cond_init(&async->work, NULL);
+    pthread_cond_init(&async->finished, NULL);
+
+    async->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (async->efd < 0) {
+        printf("Error creating eventfd. (errno=%d)\n", errno);
+        async->efd = -1;
+        ec_async_cleanup(async);
+        return NULL;
+    }
+
+    if (threads <= 0)
+        threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads <= 0)
+        threads = 1;
+
+    async->threads = calloc(threads, sizeof(*async->threads));
+    if (!async->threads) {
+        printf("Error allocating memory for async pool.\n");
+        ec_async_cleanup(async);
+        return NULL;
+    }
+
+    for (int t = 0; t < threads; t++) {
+        rc = pthread_create(&async->threads[t], NULL, ec_async_worker, async);
+        if (rc) {
+            printf("Error creating thread. (error=%d)\n", rc);
+            ec_async_cleanup(async);
+            return NULL;
+        }
+
+        async->num_threads++;
+    }
+
+    return async;
+}
+
+void
+ec_async_cleanup(struct ec_async * async) {
+    if (!async)
+        return;
+
+    // workers drain the queues before they see stop
+    pthread_mutex_lock(&async->lock);
+    async->stop = 1;
+    pthread_cond_broadcast(&async->work);
+    pthread_mutex_unlock(&async->lock);
+
+    for (int t = 0; t < async->num_threads; t++)
+        pthread_join(async->threads[t], NULL);
+
+    if (async->efd >= 0)
+        close(async->efd);
+
+    free(async->threads);
+    pthread_cond_destroy(&async->finished);
+    pthread_cond_destroy(&async->work);
+    pthread_mutex_destroy(&async->lock);
+    free(async);
+}
+
+int
+ec_async_fd(struct ec_async * async) {
+    return async->efd;
+}
+
+int
+ec_submit_batch(struct ec_async * async, struct ec_job ** jobs, int count) {
+    for (int i = 0; i < count; i++) {
+        if (jobs[i]->priority < 0 || jobs[i]->priority >= EC_JOB_PRIO_NUM) {
+            printf("Invalid job priority %d.\n", jobs[i]->priority);
+            return -1;
+        }
+    }
+
+    pthread_mutex_lock(&async->lock);
+
+    for (int i = 0; i < count; i++)
+        ec_job_list_push(&async->queued[jobs[i]->priority], jobs[i]);
+    async->outstanding += count;
+
+    if (count == 1)
+        pthread_cond_signal(&async->work);
+    else
+        pthread_cond_broadcast(&async->work);
+
+    pthread_mutex_unlock(&async->lock);
+
+    return 0;
+}
+
+int
+ec_submit(struct ec_async * async, struct ec_job * job) {
+    return ec_submit_batch(async, &job, 1);
+}
+
+/*
+ * Take up to max completed jobs; called with the lock held
+ */
+static int
+ec_async_take(struct ec_async * async, struct ec_job ** jobs, int max) {
+    int count = 0;
+
+    while (count < max) {
+        struct ec_job * job = ec_job_list_pop(&async->completed);
+        if (!job)
+            break;
+        jobs[count++] = job;
+    }
+
+    return count;
+}
+
+int
+ec_poll(struct ec_async * async, struct ec_job ** jobs, int max) {
+    uint64_t events = 0;
+    int count = 0;
+
+    // clear the eventfd first so a job finishing after the lists are taken
+    // signals it again
+    if (read(async->efd, &events, sizeof(events)) < 0 && errno != EAGAIN)
+        printf("Error reading eventfd. (errno=%d)\n", errno);
+
+    pthread_mutex_lock(&async->lock);
+    count = ec_async_take(async, jobs, max);
+
+    // jobs left behind by max keep the eventfd readable
+    if (async->completed.head) {
+        uint64_t one = 1;
+
+        if (write(async->efd, &one, sizeof(one)) != sizeof(one))
+            printf("Error writing eventfd. (errno=%d)\n", errno);
+    }
+    pthread_mutex_unlock(&async->lock);
+
+    return count;
+}
+
+int
+ec_wait(struct ec_async * async, struct ec_job ** jobs, int max) {
+    pthread_mutex_lock(&async->lock);
+    while (!async->completed.head && async->outstanding)
+        pthread_cond_wait(&async->finished, &async->lock);
+    pthread_mutex_unlock(&async->lock);
+
+    return ec_poll(async, jobs, max);
+}
@@ -0,0 +1,105 @@
+#ifndef EC_ASYNC_H
+#define EC_ASYNC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Asynchronous encode/decode.  Jobs are queued to an internal pool of worker
+ * threads and completed either through a callback, called from the worker,
+ * or by being handed back from ec_poll()/ec_wait().  An eventfd is signalled
+ * for every job handed back that way so event loops can wait for completions
+ * along with their other file descriptors.
+ */
+struct ec_async;
+
+enum ec_job_op {
+    EC_JOB_ENCODE,      // ec_encode_region(in, out, len)
+    EC_JOB_DECODE,      // ec_decode_region(in, indices, out, len)
+    EC_JOB_RECONSTRUCT, // ec_reconstruct(in, erased, len)
+};
+
+// queued jobs are run highest priority first, in submission order within
+// a priority
+enum ec_job_priority {
+    EC_JOB_PRIO_HIGH,
+    EC_JOB_PRIO_NORMAL,
+    EC_JOB_PRIO_LOW,
+    EC_JOB_PRIO_NUM,
+};
+
+/*
+ * A job is owned by the caller and, together with the buffers it points to,
+ * must stay valid until it completes.
+ */
+struct ec_job {
+    enum ec_job_op op;
+    enum ec_job_priority priority;
+    uint8_t ** in;          // k data shards, k input shards, or n shards
+    uint8_t ** out;         // p parity shards or k recovered data shards
+    int * indices;          // decode only, k indices of the input shards
+    uint8_t * erased;       // reconstruct only, n erasure flags
+    size_t len;             // length of each shard in bytes
+
+    // called from a worker when the job is done; if NULL the job is handed
+    // back by ec_poll()/ec_wait() instead
+    void (*done)(struct ec_job * job);
+    void * arg;             // caller's context
+
+    int rc;                 // result of the operation, set on completion
+
+    struct ec_job * next;   // internal
+};
+
+/*
+ * Start the worker pool
+ *
+ * threads (IN): number of workers, 0 for one per CPU
+ *
+ * returns: the pool, or NULL if failed
+ */
+struct ec_async * ec_async_init(int threads);
+
+/*
+ * Wait for queued jobs to finish and stop the workers.  Jobs waiting to be
+ * polled are dropped.
+ */
+void ec_async_cleanup(struct ec_async * async);
+
+/*
+ * Non-blocking eventfd that becomes readable when jobs are ready for
+ * ec_poll().  ec_poll() clears it, unless it leaves completed jobs behind.
+ */
+int ec_async_fd(struct ec_async * async);
+
+/*
+ * Queue a job
+ *
+ * returns: 0 if success, non-zero if failed
+ */
+int ec_submit(struct ec_async * async, struct ec_job * job);
+
+/*
+ * Queue count jobs at once, waking the workers once
+ *
+ * returns: 0 if success, non-zero if failed
+ */
+int ec_submit_batch(struct ec_async * async, struct ec_job ** jobs, int count);
+
+/*
+ * Take finished jobs that have no callback, without blocking
+ *
+ * jobs (OUT): array to hold up to max finished jobs
+ * max (IN):   size of jobs
+ *
+ * returns: number of jobs returned
+ */
+int ec_poll(struct ec_async * async, struct ec_job ** jobs, int max);
+
+/*
+ * ec_poll(), but wait until at least one job has finished.  Returns 0
+ * without waiting if no jobs are outstanding.
+ */
+int ec_wait(struct ec_async * async, struct ec_job ** jobs, int max);
+
+#endif /* EC_ASYNC_H */
@@ -0,0 +1,299 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "ec_buffer_pool.h"
+
+#define POOL_MIN_SHIFT (12)     // smallest class is 4 KiB
+#define POOL_CLASSES (15)       // largest class is EC_BUFFER_POOL_MAX
+#define POOL_SLAB_SIZE (2 * 1024 * 1024)    // one huge page
+#define POOL_TCACHE_MAX (16)    // free buffers each thread keeps per class
+
+// free buffers are linked through their first bytes
+struct pool_buf {
+    struct pool_buf * next;
+};
+
+// a mapping buffers were carved from
+struct pool_slab {
+    struct pool_slab * next;
+    void * v;
+    size_t len;
+};
+
+struct pool_tcache {
+    struct ec_buffer_pool * pool;
+    struct pool_buf * free[POOL_CLASSES];
+    int count[POOL_CLASSES];
+};
+
+struct ec_buffer_pool {
+    int flags;
+    _Atomic(struct pool_buf *) free[POOL_CLASSES];  // shared free lists
+    struct pool_slab * slabs;
+    pthread_mutex_t lock;   // protects slabs, i.e. only the slow path
+    pthread_key_t tcache_key;
+};
+
+static int
+pool_class(size_t size) {
+    int c = 0;
+
+    while (c < POOL_CLASSES && ((size_t) 1 << (POOL_MIN_SHIFT + c)) < size)
+        c++;
+
+    return c;
+}
+
+static size_t
+pool_class_size(int c) {
+    return (size_t) 1 << (POOL_MIN_SHIFT + c);
+}
+
+/*
+ * Push a chain of buffers onto a shared free list.  Only whole lists are ever
+ * taken off (see pool_grab()), so a plain CAS push has no ABA problem.
+ */
+static void
+pool_push(struct ec_buffer_pool * pool, int c, struct pool_buf * first, struct pool_buf * last) {
+    struct pool_buf * head = atomic_load(&pool->free[c]);
+
+    do {
+        last->next = head;
+    } while (!atomic_compare_exchange_weak(&pool->free[c], &head, first));
+}
+
+static struct pool_buf *
+pool_grab(struct ec_buffer_pool * pool, int c) {
+    return atomic_exchange(&pool->free[c], NULL);
+}
+
+/*
+ * Put back a list of unknown length.  The shared list is usually still empty
+ * from the pool_grab() that took it, and then the tail is not needed.
+ */
+static void
+pool_push_list(struct ec_buffer_pool * pool, int c, struct pool_buf * first) {
+    struct pool_buf * empty = NULL;
+    struct pool_buf * last = first;
+
+    if (atomic_compare_exchange_strong(&pool->free[c], &empty, first))
+        return;
+
+    while (last->next)
+        last = last->next;
+    pool_push(pool, c, first, last);
+}
+
+/*
+ * Give a dying thread's cached buffers back to the shared free lists
+ */
+static void
+pool_tcache_flush(void * arg) {
+    struct pool_tcache * tc = arg;
+
+    for (int c = 0; c < POOL_CLASSES; c++) {
+        struct pool_buf * last = tc->free[c];
+
+        if (!last)
+            continue;
+
+        while (last->next)
+            last = last->next;
+        pool_push(tc->pool, c, tc->free[c], last);
+    }
+
+    free(tc);
+}
+
+static struct pool_tcache *
+pool_tcache_get(struct ec_buffer_pool * pool) {
+    struct pool_tcache * tc = pthread_getspecific(pool->tcache_key);
+
+    if (tc)
+        return tc;
+
+    tc = calloc(1, sizeof(*tc));
+    if (!tc)
+        return NULL;
+
+    tc->pool = pool;
+    pthread_setspecific(pool->tcache_key, tc);
+
+    return tc;
+}
+
+static void *
+pool_map(struct ec_buffer_pool * pool, size_t len) {
+    void * v = MAP_FAILED;
+
+    if (pool->flags & EC_BUFFER_POOL_HUGETLB)
+        v = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+
+    // no reserved huge pages: fall back to transparent ones
+    if (v == MAP_FAILED) {
+        v = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (v == MAP_FAILED)
+            return NULL;
+
+        madvise(v, len, MADV_HUGEPAGE);
+    }
+
+    return v;
+}
+
+/*
+ * Map a new slab for class c and put its buffers on the shared free list
+ */
+static int
+pool_refill(struct ec_buffer_pool * pool, int c) {
+    size_t size = pool_class_size(c);
+    size_t len = (size < POOL_SLAB_SIZE) ? POOL_SLAB_SIZE : size;
+    struct pool_buf * first = 0;
+    struct pool_buf * last = 0;
+
+    struct pool_slab * slab = malloc(sizeof(*slab));
+    if (!slab)
+        return -1;
+
+    slab->len = len;
+    slab->v = pool_map(pool, len);
+    if (!slab->v) {
+        free(slab);
+        return -1;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    slab->next = pool->slabs;
+    pool->slabs = slab;
+    pthread_mutex_unlock(&pool->lock);
+
+    for (size_t off = 0; off + size <= len; off += size) {
+        struct pool_buf * buf = (struct pool_buf *) ((char *) slab->v + off);
+
+        buf->next = NULL;
+        if (last)
+            last->next = buf;
+        else
+            first = buf;
+        last = buf;
+    }
+
+    pool_push(pool, c, first, last);
+
+    return 0;
+}
+
+struct ec_buffer_pool *
+ec_buffer_pool_init(int flags) {
+    struct ec_buffer_pool * pool = calloc(1, sizeof(*pool));
+    if (!pool) {
+        printf("Error allocating memory for buffer pool.\n");
+        return NULL;
+    }
+
+    pool->flags = flags;
+    for (int c = 0; c < POOL_CLASSES; c++)
+        atomic_init(&pool->free[c], NULL);
+
+    pthread_mutex_init(&pool->lock, NULL);
+
+    if (pthread_key_create(&pool->tcache_key, pool_tcache_flush)) {
+        printf("Error creating buffer pool thread cache.\n");
+        pthread_mutex_destroy(&pool->lock);
+        free(pool);
+        return NULL;
+    }
+
+    return pool;
+}
+
+void
+ec_buffer_pool_cleanup(struct ec_buffer_pool * pool) {
+    if (!pool)
+        return;
+
+    // the calling thread's cache only holds buffers from the slabs below
+    free(pthread_getspecific(pool->tcache_key));
+    pthread_key_delete(pool->tcache_key);
+
+    while (pool->slabs) {
+        struct pool_slab * slab = pool->slabs;
+
+        pool->slabs = slab->next;
+        munmap(slab->v, slab->len);
+        free(slab);
+    }
+
+    pthread_mutex_destroy(&pool->lock);
+    free(pool);
+}
+
+void *
+ec_buffer_pool_get(struct ec_buffer_pool * pool, size_t size) {
+    int c = pool_class(size);
+    struct pool_buf * buf = 0;
+
+    if (c >= POOL_CLASSES) {
+        printf("Buffer of %zu bytes is too large for the buffer pool.\n", size);
+        return NULL;
+    }
+
+    struct pool_tcache * tc = pool_tcache_get(pool);
+    if (!tc)
+        return NULL;
+
+    if (!tc->free[c]) {
+        // take the shared list, mapping a new slab if it is empty.  Other
+        // threads may grab a new slab's buffers first, so keep mapping.
+        while (!(tc->free[c] = pool_grab(pool, c))) {
+            if (pool_refill(pool, c)) {
+                printf("Error allocating memory for buffer pool.\n");
+                return NULL;
+            }
+        }
+
+        // keep at most a full cache, the rest stays shared for other threads
+        tc->count[c] = 0;
+        for (buf = tc->free[c]; buf; buf = buf->next) {
+            if (++tc->count[c] == POOL_TCACHE_MAX && buf->next) {
+                pool_push_list(pool, c, buf->next);
+                buf->next = NULL;
+            }
+        }
+    }
+
+    buf = tc->free[c];
+    if (buf) {
+        tc->free[c] = buf->next;
+        tc->count[c]--;
+    }
+
+    return buf;
+}
+
+void
+ec_buffer_pool_put(struct ec_buffer_pool * pool, void * v, size_t size) {
+    int c = pool_class(size);
+    struct pool_buf * buf = v;
+
+    if (!v)
+        return;
+
+    struct pool_tcache * tc = pool_tcache_get(pool);
+
+    // cache full (or no cache): hand it straight to the shared list
+    if (!tc || tc->count[c] >= POOL_TCACHE_MAX) {
+        pool_push(pool, c, buf, buf);
+        return;
+    }
+
+    buf->next = tc->free[c];
+    tc->free[c] = buf;
+    tc->count[c]++;
+}
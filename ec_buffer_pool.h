@@ -0,0 +1,48 @@
+#ifndef EC_BUFFER_POOL_H
+#define EC_BUFFER_POOL_H
+
+#include <stddef.h>
+
+/*
+ * Pool of shard buffers.  Buffers are at least 64-byte aligned (so the SIMD
+ * kernels never take unaligned paths), come in power-of-two size classes
+ * from 4 KiB up, and are carved from huge-page backed slabs to keep TLB
+ * misses down on large stripes.  Each thread keeps a small cache of free
+ * buffers, and buffers are returned to the shared free lists without locks.
+ */
+struct ec_buffer_pool;
+
+// back slabs with explicit huge pages (MAP_HUGETLB) when available, instead
+// of only asking for transparent huge pages
+#define EC_BUFFER_POOL_HUGETLB (1 << 0)
+
+// largest buffer the pool hands out
+#define EC_BUFFER_POOL_MAX ((size_t) 64 * 1024 * 1024)
+
+/*
+ * Create a buffer pool
+ *
+ * flags (IN): EC_BUFFER_POOL_* flags
+ *
+ * returns: the pool, or NULL if failed
+ */
+struct ec_buffer_pool * ec_buffer_pool_init(int flags);
+
+/*
+ * Release all slabs.  Every buffer must have been returned.
+ */
+void ec_buffer_pool_cleanup(struct ec_buffer_pool * pool);
+
+/*
+ * Get a buffer of at least size bytes
+ *
+ * returns: the buffer, or NULL if failed
+ */
+void * ec_buffer_pool_get(struct ec_buffer_pool * pool, size_t size);
+
+/*
+ * Return a buffer.  size must be the size it was requested with.
+ */
+void ec_buffer_pool_put(struct ec_buffer_pool * pool, void * buf, size_t size);
+
+#endif /* EC_BUFFER_POOL_H */
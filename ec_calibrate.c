@@ -0,0 +1,40 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "erasure_code.h"
+
+#define PROG_NAME "ec_calibrate"
+
+const char * usage = 
+"Benchmarks the GF kernels, block sizes and thread counts on this host and\n"
+"saves the fastest combination to a tuning file for EC_TUNING_FILE.\n\n"
+"usage: " PROG_NAME " k p file\n"
+"Example: " PROG_NAME " 10 4 ec_tuning.txt\n\n";
+
+int main(int argc, char* argv[]) {
+    uint32_t k = 0;
+    uint32_t p = 0;
+    int rc = 0;
+
+    if (argc != 4) {
+        printf("Requires 3 parameters.\n\n");
+        printf("%s\n\n", usage);
+        exit(1);
+    }
+
+    k = atoi(argv[1]);
+    p = atoi(argv[2]);
+
+    rc = ec_init(k, p);
+    if (rc) {
+        printf("Error initializing Erasure Code.\n");
+        exit(1);
+    }
+
+    rc = ec_tune(argv[3]);
+    if (rc)
+        printf("Error tuning Erasure Code.\n");
+
+    ec_cleanup();
+
+    return rc;
+}
@@ -0,0 +1,438 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "ec_rebuild.h"
+#include "erasure_code.h"
+
+// stripes with the same erasures rebuilt per ec_reconstruct_batch() call
+#define EC_REBUILD_BATCH (16)
+
+// pacing lets the engine catch up on at most this much idle budget
+#define EC_REBUILD_MAX_BURST_S (1.0)
+
+/*
+ * A stripe found damaged by the scrub
+ */
+struct ec_damage {
+    char * name;
+    uint64_t stripe;
+    struct ec_object_meta meta;
+    int erasures;
+    int n;
+    uint8_t * erased;   // n flags
+};
+
+struct ec_rebuild {
+    struct ec_store * store;
+    struct ec_rebuild_config config;
+    uint32_t k;
+    uint32_t p;
+
+    struct ec_damage * damage;
+    int num_damage;
+    int max_damage;
+
+    uint8_t * buf;      // shard buffers
+    size_t buf_len;
+
+    double start;
+    double paced;       // seconds of budget spent so far
+
+    pthread_mutex_t lock;   // protects stats and stop
+    struct ec_rebuild_stats stats;
+    int stop;
+};
+
+static double
+ec_rebuild_now() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/*
+ * Account for I/O against the budget and sleep while ahead of it
+ */
+static void
+ec_rebuild_pace(struct ec_rebuild * r, uint64_t bytes, uint32_t ops, uint32_t boost) {
+    double elapsed = ec_rebuild_now() - r->start;
+    double t = 0;
+
+    if (boost < 1)
+        boost = 1;
+
+    if (r->config.bytes_per_sec)
+        t = (double) bytes / ((double) r->config.bytes_per_sec * boost);
+    if (r->config.iops && (double) ops / ((double) r->config.iops * boost) > t)
+        t = (double) ops / ((double) r->config.iops * boost);
+
+    if (r->paced < elapsed - EC_REBUILD_MAX_BURST_S)
+        r->paced = elapsed - EC_REBUILD_MAX_BURST_S;
+    r->paced += t;
+
+    double ahead = r->paced - elapsed;
+    if (ahead > 0) {
+        struct timespec ts = {
+            .tv_sec = (time_t) ahead,
+            .tv_nsec = (long) ((ahead - (time_t) ahead) * 1e9),
+        };
+        nanosleep(&ts, NULL);
+    }
+}
+
+static int
+ec_rebuild_stopped(struct ec_rebuild * r) {
+    int stop = 0;
+
+    pthread_mutex_lock(&r->lock);
+    stop = r->stop;
+    pthread_mutex_unlock(&r->lock);
+
+    return stop;
+}
+
+static int
+ec_rebuild_buf_get(struct ec_rebuild * r, size_t len) {
+    if (r->buf_len >= len)
+        return 0;
+
+    uint8_t * buf = realloc(r->buf, len);
+    if (!buf) {
+        printf("Error allocating memory for rebuild.\n");
+        return -1;
+    }
+
+    r->buf = buf;
+    r->buf_len = len;
+
+    return 0;
+}
+
+static int
+ec_damage_add(struct ec_rebuild * r,
+              const char * name,
+              uint64_t stripe,
+              struct ec_object_meta * meta,
+              uint8_t * erased,
+              int erasures) {
+    if (r->num_damage == r->max_damage) {
+        int max = r->max_damage ? 2 * r->max_damage : 64;
+        struct ec_damage * damage = realloc(r->damage, max * sizeof(*damage));
+        if (!damage) {
+            printf("Error allocating memory for rebuild.\n");
+            return -1;
+        }
+        r->damage = damage;
+        r->max_damage = max;
+    }
+
+    struct ec_damage * d = &r->damage[r->num_damage];
+
+    d->name = strdup(name);
+    d->erased = malloc(r->k + r->p);
+    if (!d->name || !d->erased) {
+        printf("Error allocating memory for rebuild.\n");
+        free(d->name);
+        free(d->erased);
+        return -1;
+    }
+
+    memcpy(d->erased, erased, r->k + r->p);
+    d->stripe = stripe;
+    d->meta = *meta;
+    d->erasures = erasures;
+    d->n = r->k + r->p;
+    r->num_damage++;
+
+    return 0;
+}
+
+static void
+ec_damage_clear(struct ec_rebuild * r) {
+    for (int i = 0; i < r->num_damage; i++) {
+        free(r->damage[i].name);
+        free(r->damage[i].erased);
+    }
+
+    r->num_damage = 0;
+}
+
+/*
+ * Scrub every stripe of one object; called from ec_store_foreach()
+ */
+static int
+ec_rebuild_scan_object(const char * name, void * arg) {
+    struct ec_rebuild * r = arg;
+    struct ec_object_meta meta;
+    uint8_t erased[r->k + r->p];
+    uint64_t stripes = 0;
+
+    // removed since the listing
+    if (ec_store_stripe_count(r->store, name, &stripes))
+        return 0;
+
+    for (uint64_t s = 0; s < stripes; s++) {
+        int missing = 0;
+        int corrupt = 0;
+
+        if (ec_rebuild_stopped(r))
+            return -1;
+
+        if (ec_store_stripe_layout(r->store, name, s, &meta))
+            return 0;
+
+        if (ec_rebuild_buf_get(r, meta.shard_len))
+            return -1;
+
+        for (int i = 0; i < r->k + r->p; i++) {
+            enum ec_shard_state state = ec_store_shard_read(r->store, name, s, i,
+                                                            &meta, r->buf);
+
+            erased[i] = state != EC_SHARD_OK;
+            missing += state == EC_SHARD_MISSING;
+            corrupt += state == EC_SHARD_CORRUPT;
+        }
+
+        pthread_mutex_lock(&r->lock);
+        r->stats.stripes_scanned++;
+        r->stats.shards_missing += missing;
+        r->stats.shards_corrupt += corrupt;
+        r->stats.bytes_read += (r->k + r->p) * meta.shard_len;
+        if (missing + corrupt) {
+            r->stats.stripes_damaged++;
+            r->stats.stripes_pending++;
+        }
+        pthread_mutex_unlock(&r->lock);
+
+        if (missing + corrupt
+            && ec_damage_add(r, name, s, &meta, erased, missing + corrupt))
+            return -1;
+
+        ec_rebuild_pace(r, (r->k + r->p) * meta.shard_len, r->k + r->p, 1);
+    }
+
+    return 0;
+}
+
+static int
+ec_damage_cmp(const void * a, const void * b) {
+    const struct ec_damage * x = a;
+    const struct ec_damage * y = b;
+
+    // most damaged first: they are the closest to being lost
+    if (x->erasures != y->erasures)
+        return y->erasures - x->erasures;
+
+    int c = memcmp(x->erased, y->erased, x->n);
+    if (c)
+        return c;
+
+    return (x->meta.shard_len > y->meta.shard_len) - (x->meta.shard_len < y->meta.shard_len);
+}
+
+static int
+ec_damage_same(struct ec_damage * x, struct ec_damage * y, int n) {
+    return x->meta.shard_len == y->meta.shard_len && !memcmp(x->erased, y->erased, n);
+}
+
+/*
+ * Rebuild up to EC_REBUILD_BATCH stripes with the same erasures and length
+ *
+ * returns: number of stripes that could not be repaired
+ */
+static int
+ec_rebuild_batch(struct ec_rebuild * r, struct ec_damage * batch, int count) {
+    int n = r->k + r->p;
+    size_t len = batch[0].meta.shard_len;
+    uint8_t * stripe_shards[count][n];
+    uint8_t ** shards[count];
+    struct ec_damage * stripes[count];
+    int ready = 0;
+    int failed = 0;
+
+    if (ec_rebuild_buf_get(r, count * n * len))
+        return count;
+
+    // read the first k survivors, which ec_reconstruct_batch() decodes from
+    for (int s = 0; s < count; s++) {
+        struct ec_damage * d = &batch[s];
+        int have = 0;
+        int ok = 1;
+
+        for (int i = 0; i < n; i++) {
+            stripe_shards[ready][i] = &r->buf[(ready * n + i) * len];
+
+            if (d->erased[i] || have == r->k)
+                continue;
+
+            ok &= ec_store_shard_read(r->store, d->name, d->stripe, i, &d->meta,
+                                      stripe_shards[ready][i]) == EC_SHARD_OK;
+            have++;
+        }
+
+        pthread_mutex_lock(&r->lock);
+        r->stats.bytes_read += r->k * len;
+        pthread_mutex_unlock(&r->lock);
+
+        // damaged further since the scrub
+        if (!ok) {
+            failed++;
+            continue;
+        }
+
+        shards[ready] = stripe_shards[ready];
+        stripes[ready++] = d;
+    }
+
+    if (ready && ec_reconstruct_batch(shards, batch[0].erased, ready, len)) {
+        failed = count;
+        ready = 0;
+    }
+
+    for (int s = 0; s < ready; s++) {
+        struct ec_damage * d = stripes[s];
+        int written = 0;
+        int ok = 1;
+
+        for (int i = 0; i < n; i++) {
+            if (!d->erased[i])
+                continue;
+
+            ok &= !ec_store_shard_write(r->store, d->name, d->stripe, i, &d->meta,
+                                        shards[s][i]);
+            written++;
+        }
+
+        pthread_mutex_lock(&r->lock);
+        r->stats.bytes_written += written * len;
+        r->stats.shards_rebuilt += written;
+        if (ok)
+            r->stats.stripes_repaired++;
+        pthread_mutex_unlock(&r->lock);
+
+        failed += !ok;
+
+        // stripes down to k shards have no redundancy left and go faster
+        ec_rebuild_pace(r, (r->k + written) * len, r->k + written,
+                        d->erasures == r->p ? r->config.urgent_boost : 1);
+    }
+
+    pthread_mutex_lock(&r->lock);
+    r->stats.stripes_pending -= count;
+    pthread_mutex_unlock(&r->lock);
+
+    return failed;
+}
+
+static int
+ec_rebuild_repair(struct ec_rebuild * r) {
+    int n = r->k + r->p;
+    int failed = 0;
+
+    qsort(r->damage, r->num_damage, sizeof(*r->damage), ec_damage_cmp);
+
+    for (int first = 0; first < r->num_damage; ) {
+        int count = 1;
+
+        while (first + count < r->num_damage && count < EC_REBUILD_BATCH
+               && ec_damage_same(&r->damage[first], &r->damage[first + count], n))
+            count++;
+
+        if (ec_rebuild_stopped(r))
+            return -1;
+
+        if (r->damage[first].erasures > r->p) {
+            pthread_mutex_lock(&r->lock);
+            r->stats.stripes_lost += count;
+            r->stats.stripes_pending -= count;
+            pthread_mutex_unlock(&r->lock);
+
+            for (int s = first; s < first + count; s++)
+                printf("Stripe %llu of %s lost %d shards, cannot rebuild.\n",
+                       (unsigned long long) r->damage[s].stripe,
+                       r->damage[s].name, r->damage[s].erasures);
+            failed += count;
+        } else {
+            failed += ec_rebuild_batch(r, &r->damage[first], count);
+        }
+
+        first += count;
+    }
+
+    return failed ? -1 : 0;
+}
+
+struct ec_rebuild *
+ec_rebuild_create(struct ec_store * store, const struct ec_rebuild_config * config) {
+    struct ec_rebuild * r = calloc(1, sizeof(*r));
+    if (!r) {
+        printf("Error allocating memory for rebuild.\n");
+        return NULL;
+    }
+
+    r->store = store;
+    r->config = *config;
+    ec_get_params(&r->k, &r->p);
+    pthread_mutex_init(&r->lock, NULL);
+
+    return r;
+}
+
+void
+ec_rebuild_free(struct ec_rebuild * r) {
+    if (!r)
+        return;
+
+    ec_damage_clear(r);
+    free(r->damage);
+    free(r->buf);
+    pthread_mutex_destroy(&r->lock);
+    free(r);
+}
+
+int
+ec_rebuild_run(struct ec_rebuild * r) {
+    int rc = 0;
+
+    ec_damage_clear(r);
+
+    r->start = ec_rebuild_now();
+    r->paced = 0;
+
+    pthread_mutex_lock(&r->lock);
+    memset(&r->stats, 0, sizeof(r->stats));
+    r->stop = 0;
+    pthread_mutex_unlock(&r->lock);
+
+    rc = ec_store_foreach(r->store, ec_rebuild_scan_object, r);
+
+    if (!rc && r->config.repair)
+        rc = ec_rebuild_repair(r);
+
+    pthread_mutex_lock(&r->lock);
+    r->stats.elapsed = ec_rebuild_now() - r->start;
+    pthread_mutex_unlock(&r->lock);
+
+    return rc;
+}
+
+void
+ec_rebuild_stop(struct ec_rebuild * r) {
+    pthread_mutex_lock(&r->lock);
+    r->stop = 1;
+    pthread_mutex_unlock(&r->lock);
+}
+
+void
+ec_rebuild_progress(struct ec_rebuild * r, struct ec_rebuild_stats * stats) {
+    pthread_mutex_lock(&r->lock);
+    *stats = r->stats;
+    if (r->start)
+        stats->elapsed = ec_rebuild_now() - r->start;
+    pthread_mutex_unlock(&r->lock);
+}
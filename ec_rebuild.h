@@ -0,0 +1,71 @@
+#ifndef EC_REBUILD_H
+#define EC_REBUILD_H
+
+#include <stdint.h>
+
+#include "ec_store.h"
+
+/*
+ * Background scrub and rebuild of an ec_store.  A pass reads every shard of
+ * every stripe, checking its CRC, then rebuilds the missing and corrupt ones.
+ * Damaged stripes are grouped by erasure pattern so each group is rebuilt
+ * with one matrix, most damaged groups first.  Reads and writes are paced to
+ * a bandwidth and IOPS budget so foreground traffic is not starved.
+ */
+struct ec_rebuild;
+
+struct ec_rebuild_config {
+    uint64_t bytes_per_sec; // shard bytes read plus written, 0 for no limit
+    uint32_t iops;          // shard reads plus writes per second, 0 for no limit
+    uint32_t urgent_boost;  // budget multiplier for stripes with no redundancy
+                            // left, 0 or 1 for none
+    int repair;             // 0 to only scrub and count damage
+};
+
+/*
+ * Counters of the current or last pass; throughput is bytes over elapsed
+ */
+struct ec_rebuild_stats {
+    uint64_t stripes_scanned;
+    uint64_t stripes_damaged;   // with at least one missing or corrupt shard
+    uint64_t stripes_repaired;
+    uint64_t stripes_lost;      // more than p shards gone
+    uint64_t stripes_pending;   // damaged, not yet repaired
+    uint64_t shards_missing;
+    uint64_t shards_corrupt;
+    uint64_t shards_rebuilt;
+    uint64_t bytes_read;
+    uint64_t bytes_written;
+    double elapsed;             // seconds since the pass started
+};
+
+/*
+ * Create a rebuild engine for a store
+ *
+ * returns: the engine, or NULL if failed
+ */
+struct ec_rebuild * ec_rebuild_create(struct ec_store * store,
+                                      const struct ec_rebuild_config * config);
+
+void ec_rebuild_free(struct ec_rebuild * r);
+
+/*
+ * Scrub the whole store and, if configured, rebuild what is damaged.  Blocks
+ * until done or stopped; run it on a thread of its own.
+ *
+ * returns: 0 if every damaged stripe was repaired (or only scrubbing),
+ *          non-zero if some could not be or the pass was stopped
+ */
+int ec_rebuild_run(struct ec_rebuild * r);
+
+/*
+ * Ask a running pass to stop; safe from any thread
+ */
+void ec_rebuild_stop(struct ec_rebuild * r);
+
+/*
+ * Snapshot the counters; safe from any thread while a pass runs
+ */
+void ec_rebuild_progress(struct ec_rebuild * r, struct ec_rebuild_stats * stats);
+
+#endif /* EC_REBUILD_H */
@@ -0,0 +1,739 @@
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "crc32c.h"
+#include "ec_buffer_pool.h"
+#include "ec_store.h"
+#include "erasure_code.h"
+
+#define EC_STORE_PATH_MAX (4096)
+
+// every shard file ends with a CRC32C of each block of its data, so a range
+// read only checks the blocks it touches
+#define EC_STORE_CRC_BLOCK (4096)
+
+struct ec_store {
+    char * root;
+    uint32_t k;
+    uint32_t p;
+    size_t shard_len;   // for new objects
+    struct ec_buffer_pool * pool;   // shard-sized read and parity buffers
+};
+
+/*
+ * An object's entry in the index
+ */
+struct ec_store_object {
+    uint64_t length;    // object length in bytes
+    size_t shard_len;   // shard length of its full stripes
+};
+
+static int
+ec_store_name_valid(const char * name) {
+    if (!*name || strchr(name, '/') || !strcmp(name, ".") || !strcmp(name, "..")) {
+        printf("Invalid object name %s.\n", name);
+        return 0;
+    }
+
+    return 1;
+}
+
+static void
+ec_store_shard_path(struct ec_store * store,
+                    int shard,
+                    const char * name,
+                    uint64_t stripe,
+                    char * path) {
+    snprintf(path, EC_STORE_PATH_MAX, "%s/shard%03d/%s.%llu",
+             store->root, shard, name, (unsigned long long) stripe);
+}
+
+static void
+ec_store_index_path(struct ec_store * store, const char * name, char * path) {
+    snprintf(path, EC_STORE_PATH_MAX, "%s/index/%s", store->root, name);
+}
+
+static int
+ec_store_mkdir(const char * path) {
+    if (mkdir(path, 0755) && errno != EEXIST) {
+        printf("Error creating directory %s. (errno=%d)\n", path, errno);
+        return -1;
+    }
+
+    return 0;
+}
+
+static int
+ec_store_index_read(struct ec_store * store,
+                    const char * name,
+                    struct ec_store_object * obj) {
+    char path[EC_STORE_PATH_MAX];
+    unsigned long long length = 0;
+    size_t shard_len = 0;
+    int rc = 0;
+
+    if (!ec_store_name_valid(name))
+        return -1;
+
+    ec_store_index_path(store, name, path);
+
+    FILE * f = fopen(path, "r");
+    if (!f)
+        return -1;
+
+    if (fscanf(f, "%llu %zu", &length, &shard_len) != 2 || !shard_len) {
+        printf("Corrupt index entry %s.\n", path);
+        rc = -1;
+    }
+
+    fclose(f);
+
+    obj->length = length;
+    obj->shard_len = shard_len;
+
+    return rc;
+}
+
+static uint64_t
+ec_store_stripes(struct ec_store * store, struct ec_store_object * obj) {
+    uint64_t stripe_size = (uint64_t) store->k * obj->shard_len;
+
+    return (obj->length + stripe_size - 1) / stripe_size;
+}
+
+/*
+ * Layout of one stripe of an object; only the last stripe is short
+ */
+static void
+ec_store_stripe_meta(struct ec_store * store,
+                     struct ec_store_object * obj,
+                     uint64_t stripe,
+                     struct ec_object_meta * meta) {
+    uint64_t stripe_size = (uint64_t) store->k * obj->shard_len;
+    uint64_t left = obj->length - stripe * stripe_size;
+
+    meta->length = (left < stripe_size) ? left : stripe_size;
+    meta->shard_len = (meta->length + store->k - 1) / store->k;
+}
+
+static size_t
+ec_store_crc_blocks(size_t valid) {
+    return (valid + EC_STORE_CRC_BLOCK - 1) / EC_STORE_CRC_BLOCK;
+}
+
+static size_t
+ec_store_file_len(size_t valid) {
+    return valid + ec_store_crc_blocks(valid) * sizeof(uint32_t);
+}
+
+/*
+ * CRC32C of each block of valid bytes
+ */
+static void
+ec_store_block_crcs(const uint8_t * buf, size_t valid, uint32_t * crcs) {
+    for (size_t b = 0; b < ec_store_crc_blocks(valid); b++) {
+        size_t off = b * EC_STORE_CRC_BLOCK;
+        size_t len = (valid - off < EC_STORE_CRC_BLOCK) ? valid - off
+                                                        : EC_STORE_CRC_BLOCK;
+
+        crcs[b] = crc32c(0, &buf[off], len);
+    }
+}
+
+static int
+ec_store_write_all(int fd, const uint8_t * buf, size_t len) {
+    while (len) {
+        ssize_t done = write(fd, buf, len);
+        if (done < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        buf += done;
+        len -= done;
+    }
+
+    return 0;
+}
+
+/*
+ * Write a shard file: valid bytes of data followed by the CRC32C of each of
+ * its blocks
+ */
+static int
+ec_store_write_shard(const char * path,
+                     const uint8_t * buf,
+                     size_t valid,
+                     const uint32_t * crcs) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        printf("Error creating %s. (errno=%d)\n", path, errno);
+        return -1;
+    }
+
+    if (ec_store_write_all(fd, buf, valid)
+        || ec_store_write_all(fd, (const uint8_t *) crcs,
+                              ec_store_crc_blocks(valid) * sizeof(*crcs))) {
+        printf("Error writing %s. (errno=%d)\n", path, errno);
+        close(fd);
+        return -1;
+    }
+
+    return close(fd);
+}
+
+static int
+ec_store_pread_all(int fd, void * buf, size_t len, off_t off) {
+    size_t got = 0;
+
+    while (got < len) {
+        ssize_t done = pread(fd, (uint8_t *) buf + got, len - got, off + got);
+        if (done <= 0) {
+            if (done < 0 && errno == EINTR)
+                continue;
+            return -1;
+        }
+        got += done;
+    }
+
+    return 0;
+}
+
+/*
+ * Read [off, off + len) of a shard file that should hold valid bytes; bytes
+ * past the end of the stored data read as zeros.  The blocks the range
+ * touches are read whole and checked against their CRCs.
+ *
+ * returns: state of the shard, buf is only valid for EC_SHARD_OK
+ */
+static enum ec_shard_state
+ec_store_read_range(struct ec_store * store,
+                    const char * path,
+                    size_t valid,
+                    size_t off,
+                    uint8_t * buf,
+                    size_t len) {
+    enum ec_shard_state state = EC_SHARD_OK;
+    struct stat st;
+    uint8_t * blocks = 0;
+    size_t blocks_len = 0;
+    uint32_t * crcs = 0;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return EC_SHARD_MISSING;
+
+    if (fstat(fd, &st) || st.st_size != ec_store_file_len(valid)) {
+        close(fd);
+        return EC_SHARD_CORRUPT;
+    }
+
+    // the stored data, not the CRCs after it
+    size_t want = (off >= valid) ? 0 : (valid - off < len) ? valid - off : len;
+
+    if (want) {
+        size_t first = off / EC_STORE_CRC_BLOCK;
+        size_t last = (off + want - 1) / EC_STORE_CRC_BLOCK;
+        size_t start = first * EC_STORE_CRC_BLOCK;
+        size_t end = (last + 1) * EC_STORE_CRC_BLOCK;
+
+        if (end > valid)
+            end = valid;
+
+        blocks_len = end - start;
+        blocks = ec_buffer_pool_get(store->pool, blocks_len);
+        crcs = malloc((last - first + 1) * sizeof(*crcs));
+        if (!blocks || !crcs) {
+            printf("Error allocating memory for shard read.\n");
+            state = EC_SHARD_CORRUPT;
+            goto read_range_err;
+        }
+
+        if (ec_store_pread_all(fd, blocks, blocks_len, start)
+            || ec_store_pread_all(fd, crcs, (last - first + 1) * sizeof(*crcs),
+                                  valid + first * sizeof(*crcs))) {
+            state = EC_SHARD_CORRUPT;
+            goto read_range_err;
+        }
+
+        for (size_t b = first; b <= last; b++) {
+            size_t b_off = b * EC_STORE_CRC_BLOCK - start;
+            size_t b_len = (end - start - b_off < EC_STORE_CRC_BLOCK)
+                           ? end - start - b_off : EC_STORE_CRC_BLOCK;
+
+            if (crcs[b - first] != crc32c(0, &blocks[b_off], b_len)) {
+                state = EC_SHARD_CORRUPT;
+                goto read_range_err;
+            }
+        }
+
+        memcpy(buf, &blocks[off - start], want);
+    }
+
+    memset(&buf[want], 0, len - want);
+
+read_range_err:
+    free(crcs);
+    ec_buffer_pool_put(store->pool, blocks, blocks_len);
+    close(fd);
+
+    return state;
+}
+
+static int
+ec_store_shard_present(const char * path, size_t valid) {
+    struct stat st;
+
+    return !stat(path, &st) && st.st_size == ec_store_file_len(valid);
+}
+
+/*
+ * Rebuild [off, off + len) of a lost data shard from the same range of k
+ * surviving shards of the stripe.  A survivor whose blocks fail their CRC is
+ * dropped and the decode is planned again without it.
+ */
+static int
+ec_store_read_degraded(struct ec_store * store,
+                       const char * name,
+                       uint64_t stripe,
+                       struct ec_object_meta * meta,
+                       int lost,
+                       size_t off,
+                       uint8_t * buf,
+                       size_t len) {
+    char path[EC_STORE_PATH_MAX];
+    uint8_t usable[store->k + store->p];
+    int available[store->k + store->p];
+    uint8_t * input[store->k];
+    struct ec_decode_plan * plan = 0;
+    int rc = -1;
+
+    for (int i = 0; i < store->k + store->p; i++) {
+        ec_store_shard_path(store, i, name, stripe, path);
+        usable[i] = i != lost
+                    && ec_store_shard_present(path, ec_shard_valid_len(meta, i));
+    }
+
+    memset(input, 0, sizeof(input));
+    for (int pos = 0; pos < store->k; pos++) {
+        input[pos] = ec_buffer_pool_get(store->pool, len);
+        if (!input[pos]) {
+            printf("Error allocating memory for degraded read.\n");
+            goto degraded_err;
+        }
+    }
+
+    while (rc) {
+        int count = 0;
+        int bad = -1;
+
+        for (int i = 0; i < store->k + store->p; i++)
+            if (usable[i])
+                available[count++] = i;
+
+        plan = ec_plan_decode(available, NULL, count);
+        if (!plan) {
+            printf("Cannot rebuild shard %d of %s stripe %llu.\n",
+                   lost, name, (unsigned long long) stripe);
+            break;
+        }
+
+        for (int pos = 0; pos < store->k && bad < 0; pos++) {
+            int i = plan->indices[pos];
+
+            ec_store_shard_path(store, i, name, stripe, path);
+
+            if (ec_store_read_range(store, path, ec_shard_valid_len(meta, i), off,
+                                    input[pos], len) != EC_SHARD_OK) {
+                printf("Shard %s is damaged, not using it.\n", path);
+                bad = i;
+            }
+        }
+
+        if (bad < 0)
+            rc = ec_decode_plan_shard(plan, input, lost, buf, len);
+        else
+            usable[bad] = 0;
+
+        ec_plan_free(plan);
+        plan = 0;
+
+        if (bad < 0)
+            break;
+    }
+
+degraded_err:
+    for (int pos = 0; pos < store->k && input[pos]; pos++)
+        ec_buffer_pool_put(store->pool, input[pos], len);
+
+    return rc;
+}
+
+struct ec_store *
+ec_store_open(const char * root, size_t shard_len) {
+    char path[EC_STORE_PATH_MAX];
+
+    if (!shard_len || shard_len > EC_BUFFER_POOL_MAX) {
+        printf("Invalid shard length %zu.\n", shard_len);
+        return NULL;
+    }
+
+    struct ec_store * store = calloc(1, sizeof(*store));
+    if (!store) {
+        printf("Error allocating memory for store.\n");
+        return NULL;
+    }
+
+    ec_get_params(&store->k, &store->p);
+    store->shard_len = shard_len;
+    store->root = strdup(root);
+    store->pool = ec_buffer_pool_init(0);
+    if (!store->root || !store->pool) {
+        printf("Error allocating memory for store.\n");
+        goto open_err;
+    }
+
+    if (ec_store_mkdir(root))
+        goto open_err;
+
+    snprintf(path, sizeof(path), "%s/index", root);
+    if (ec_store_mkdir(path))
+        goto open_err;
+
+    for (int i = 0; i < store->k + store->p; i++) {
+        snprintf(path, sizeof(path), "%s/shard%03d", root, i);
+        if (ec_store_mkdir(path))
+            goto open_err;
+    }
+
+    return store;
+
+open_err:
+    ec_store_close(store);
+    return NULL;
+}
+
+void
+ec_store_close(struct ec_store * store) {
+    if (!store)
+        return;
+
+    ec_buffer_pool_cleanup(store->pool);
+    free(store->root);
+    free(store);
+}
+
+int
+ec_store_length(struct ec_store * store, const char * name, uint64_t * len) {
+    struct ec_store_object obj;
+
+    if (ec_store_index_read(store, name, &obj))
+        return -1;
+
+    *len = obj.length;
+
+    return 0;
+}
+
+int
+ec_store_remove(struct ec_store * store, const char * name) {
+    char path[EC_STORE_PATH_MAX];
+    struct ec_store_object obj;
+
+    if (ec_store_index_read(store, name, &obj))
+        return -1;
+
+    // the index goes first so a half-removed object is never read
+    ec_store_index_path(store, name, path);
+    if (unlink(path)) {
+        printf("Error removing %s. (errno=%d)\n", path, errno);
+        return -1;
+    }
+
+    for (uint64_t s = 0; s < ec_store_stripes(store, &obj); s++) {
+        for (int i = 0; i < store->k + store->p; i++) {
+            ec_store_shard_path(store, i, name, s, path);
+            unlink(path);
+        }
+    }
+
+    return 0;
+}
+
+int
+ec_store_put(struct ec_store * store,
+             const char * name,
+             const void * data,
+             uint64_t len) {
+    char path[EC_STORE_PATH_MAX];
+    struct ec_store_object obj = {
+        .length = len,
+        .shard_len = store->shard_len,
+    };
+    struct ec_object_meta meta;
+    int n = store->k + store->p;
+    size_t blocks = ec_store_crc_blocks(store->shard_len);
+    uint8_t * parity[store->p];
+    uint32_t * crcs = 0;
+    const uint8_t * src = data;
+    int rc = 0;
+
+    if (!ec_store_name_valid(name))
+        return -1;
+
+    // stripes of the old object may not all be overwritten
+    ec_store_remove(store, name);
+
+    memset(parity, 0, sizeof(parity));
+    crcs = malloc(n * blocks * sizeof(*crcs));
+    rc = crcs ? 0 : -1;
+    for (int i = 0; i < store->p && !rc; i++) {
+        parity[i] = ec_buffer_pool_get(store->pool, store->shard_len);
+        rc = parity[i] ? 0 : -1;
+    }
+    if (rc) {
+        printf("Error allocating memory for parity.\n");
+        goto put_err;
+    }
+
+    for (uint64_t s = 0; s < ec_store_stripes(store, &obj); s++) {
+        const uint8_t * stripe = &src[s * store->k * store->shard_len];
+
+        ec_store_stripe_meta(store, &obj, s, &meta);
+
+        if (meta.length == (uint64_t) store->k * meta.shard_len) {
+            // a full stripe: encode block by block, the block CRCs of every
+            // shard come out of the encode pass
+            for (size_t b = 0; b < ec_store_crc_blocks(meta.shard_len); b++) {
+                size_t off = b * EC_STORE_CRC_BLOCK;
+                size_t len = (meta.shard_len - off < EC_STORE_CRC_BLOCK)
+                             ? meta.shard_len - off : EC_STORE_CRC_BLOCK;
+                uint8_t * in[store->k];
+                uint8_t * out[store->p];
+                uint32_t crc[n];
+
+                for (int i = 0; i < store->k; i++)
+                    in[i] = (uint8_t *) &stripe[i * meta.shard_len + off];
+                for (int i = 0; i < store->p; i++)
+                    out[i] = &parity[i][off];
+
+                rc = ec_encode_region(in, out, len, crc);
+                if (rc)
+                    goto put_err;
+
+                for (int i = 0; i < n; i++)
+                    crcs[i * blocks + b] = crc[i];
+            }
+        } else {
+            // the short last stripe has data shards of differing lengths
+            rc = ec_encode_object(stripe, meta.length, parity, &meta);
+            if (rc)
+                goto put_err;
+
+            for (int i = 0; i < n; i++) {
+                const uint8_t * shard = (i < store->k) ? &stripe[i * meta.shard_len]
+                                                       : parity[i - store->k];
+
+                ec_store_block_crcs(shard, ec_shard_valid_len(&meta, i),
+                                    &crcs[i * blocks]);
+            }
+        }
+
+        for (int i = 0; i < n; i++) {
+            const uint8_t * shard = (i < store->k) ? &stripe[i * meta.shard_len]
+                                                   : parity[i - store->k];
+
+            ec_store_shard_path(store, i, name, s, path);
+            rc = ec_store_write_shard(path, shard, ec_shard_valid_len(&meta, i),
+                                      &crcs[i * blocks]);
+            if (rc)
+                goto put_err;
+        }
+    }
+
+    // the object appears once all of its shards are in place
+    ec_store_index_path(store, name, path);
+
+    FILE * f = fopen(path, "w");
+    if (!f) {
+        printf("Error creating %s. (errno=%d)\n", path, errno);
+        rc = -1;
+        goto put_err;
+    }
+
+    fprintf(f, "%llu %zu\n", (unsigned long long) obj.length, obj.shard_len);
+    if (fclose(f)) {
+        printf("Error writing %s.\n", path);
+        rc = -1;
+    }
+
+put_err:
+    free(crcs);
+    for (int i = 0; i < store->p; i++)
+        ec_buffer_pool_put(store->pool, parity[i], store->shard_len);
+
+    return rc;
+}
+
+int
+ec_store_read(struct ec_store * store,
+              const char * name,
+              uint64_t off,
+              void * buf,
+              size_t len) {
+    char path[EC_STORE_PATH_MAX];
+    struct ec_store_object obj;
+    struct ec_object_meta meta;
+    uint8_t * dst = buf;
+
+    if (ec_store_index_read(store, name, &obj)) {
+        printf("No object %s.\n", name);
+        return -1;
+    }
+
+    if (off > obj.length || len > obj.length - off) {
+        printf("Read past the end of %s.\n", name);
+        return -1;
+    }
+
+    uint64_t stripe_size = (uint64_t) store->k * obj.shard_len;
+    uint64_t end = off + len;
+
+    while (off < end) {
+        uint64_t s = off / stripe_size;
+        uint64_t stripe_start = s * stripe_size;
+        uint64_t stripe_end = (end - stripe_start < stripe_size) ? end
+                                                                 : stripe_start + stripe_size;
+
+        ec_store_stripe_meta(store, &obj, s, &meta);
+
+        // the part of each data shard the range covers
+        while (off < stripe_end) {
+            uint64_t pos = off - stripe_start;
+            int i = pos / meta.shard_len;
+            size_t shard_off = pos - (uint64_t) i * meta.shard_len;
+            size_t chunk = meta.shard_len - shard_off;
+
+            if (chunk > stripe_end - off)
+                chunk = stripe_end - off;
+
+            ec_store_shard_path(store, i, name, s, path);
+            if (ec_store_read_range(store, path, ec_shard_valid_len(&meta, i),
+                                    shard_off, dst, chunk)
+                && ec_store_read_degraded(store, name, s, &meta, i,
+                                          shard_off, dst, chunk))
+                return -1;
+
+            dst += chunk;
+            off += chunk;
+        }
+    }
+
+    return 0;
+}
+
+int
+ec_store_foreach(struct ec_store * store,
+                 int (*fn)(const char * name, void * arg),
+                 void * arg) {
+    char path[EC_STORE_PATH_MAX];
+    struct dirent * ent = 0;
+    int rc = 0;
+
+    snprintf(path, sizeof(path), "%s/index", store->root);
+
+    DIR * dir = opendir(path);
+    if (!dir) {
+        printf("Error opening %s. (errno=%d)\n", path, errno);
+        return -1;
+    }
+
+    while (!rc && (ent = readdir(dir)))
+        if (ent->d_name[0] != '.')
+            rc = fn(ent->d_name, arg);
+
+    closedir(dir);
+
+    return rc;
+}
+
+int
+ec_store_stripe_count(struct ec_store * store, const char * name, uint64_t * count) {
+    struct ec_store_object obj;
+
+    if (ec_store_index_read(store, name, &obj))
+        return -1;
+
+    *count = ec_store_stripes(store, &obj);
+
+    return 0;
+}
+
+int
+ec_store_stripe_layout(struct ec_store * store,
+                       const char * name,
+                       uint64_t stripe,
+                       struct ec_object_meta * meta) {
+    struct ec_store_object obj;
+
+    if (ec_store_index_read(store, name, &obj))
+        return -1;
+
+    if (stripe >= ec_store_stripes(store, &obj)) {
+        printf("No stripe %llu in %s.\n", (unsigned long long) stripe, name);
+        return -1;
+    }
+
+    ec_store_stripe_meta(store, &obj, stripe, meta);
+
+    return 0;
+}
+
+enum ec_shard_state
+ec_store_shard_read(struct ec_store * store,
+                    const char * name,
+                    uint64_t stripe,
+                    int shard,
+                    const struct ec_object_meta * meta,
+                    uint8_t * buf) {
+    char path[EC_STORE_PATH_MAX];
+    size_t valid = ec_shard_valid_len(meta, shard);
+
+    ec_store_shard_path(store, shard, name, stripe, path);
+
+    // checks every block and zero fills the rest of the shard
+    return ec_store_read_range(store, path, valid, 0, buf, meta->shard_len);
+}
+
+int
+ec_store_shard_write(struct ec_store * store,
+                     const char * name,
+                     uint64_t stripe,
+                     int shard,
+                     const struct ec_object_meta * meta,
+                     const uint8_t * buf) {
+    char path[EC_STORE_PATH_MAX];
+    size_t valid = ec_shard_valid_len(meta, shard);
+    uint32_t * crcs = 0;
+    int rc = 0;
+
+    crcs = malloc((ec_store_crc_blocks(valid) + 1) * sizeof(*crcs));
+    if (!crcs) {
+        printf("Error allocating memory for shard CRCs.\n");
+        return -1;
+    }
+
+    ec_store_block_crcs(buf, valid, crcs);
+    ec_store_shard_path(store, shard, name, stripe, path);
+    rc = ec_store_write_shard(path, buf, valid, crcs);
+
+    free(crcs);
+
+    return rc;
+}
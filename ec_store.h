@@ -0,0 +1,149 @@
+#ifndef EC_STORE_H
+#define EC_STORE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "erasure_code.h"
+
+/*
+ * On-disk object store built on the erasure code.  Objects are split into
+ * stripes of k data shards plus p parity shards, and shard i of every stripe
+ * is kept under its own directory <root>/shardNNN, standing in for a separate
+ * disk or node.  Each shard file ends with a CRC32C of every 4 KiB block of
+ * its contents, and every read checks the blocks it touches.
+ * <root>/index/<name> records each object's length and shard size.  The tail
+ * of an object is not padded: see ec_encode_object().
+ *
+ * Reads may ask for any byte range.  When a data shard the range touches is
+ * missing, only the same range of k surviving shards is read and only the
+ * missing part of that shard is reconstructed.  A shard whose blocks fail
+ * their CRC is treated as missing.
+ */
+struct ec_store;
+
+enum ec_shard_state {
+    EC_SHARD_OK,
+    EC_SHARD_MISSING,
+    EC_SHARD_CORRUPT,   // wrong length or CRC mismatch
+};
+
+/*
+ * Open (creating if needed) a store.  ec_init() must have been called.
+ *
+ * root (IN):      directory of the store
+ * shard_len (IN): length of each shard of a full stripe for new objects, at
+ *                 most EC_BUFFER_POOL_MAX
+ *
+ * returns: the store, or NULL if failed
+ */
+struct ec_store * ec_store_open(const char * root, size_t shard_len);
+
+void ec_store_close(struct ec_store * store);
+
+/*
+ * Store an object, replacing any object of the same name
+ *
+ * name (IN): object name, must not contain '/'
+ * data (IN): the object
+ * len (IN):  length of the object in bytes
+ *
+ * returns: 0 if success, non-zero if failed
+ */
+int ec_store_put(struct ec_store * store,
+                 const char * name,
+                 const void * data,
+                 uint64_t len);
+
+/*
+ * Read a byte range of an object, reconstructing missing shards as needed
+ *
+ * name (IN): object name
+ * off (IN):  offset of the range in the object
+ * buf (OUT): buffer for len bytes
+ * len (IN):  length of the range; off + len must be within the object
+ *
+ * returns: 0 if success, non-zero if failed (e.g. more than p shards of a
+ *          stripe lost)
+ */
+int ec_store_read(struct ec_store * store,
+                  const char * name,
+                  uint64_t off,
+                  void * buf,
+                  size_t len);
+
+/*
+ * Get the length of an object
+ *
+ * returns: 0 if success, non-zero if the object does not exist
+ */
+int ec_store_length(struct ec_store * store, const char * name, uint64_t * len);
+
+/*
+ * Remove an object and all of its shards
+ *
+ * returns: 0 if success, non-zero if failed
+ */
+int ec_store_remove(struct ec_store * store, const char * name);
+
+/*
+ * Call fn(name, arg) for every object in the store until it returns non-zero
+ *
+ * returns: 0, or the first non-zero value returned by fn
+ */
+int ec_store_foreach(struct ec_store * store,
+                     int (*fn)(const char * name, void * arg),
+                     void * arg);
+
+/*
+ * Get the number of stripes of an object
+ *
+ * returns: 0 if success, non-zero if the object does not exist
+ */
+int ec_store_stripe_count(struct ec_store * store,
+                          const char * name,
+                          uint64_t * count);
+
+/*
+ * Get the layout of one stripe of an object; only the last stripe may be
+ * shorter than the others
+ *
+ * returns: 0 if success, non-zero if failed
+ */
+int ec_store_stripe_layout(struct ec_store * store,
+                           const char * name,
+                           uint64_t stripe,
+                           struct ec_object_meta * meta);
+
+/*
+ * Read a whole shard and check every block against its CRC
+ *
+ * stripe (IN): stripe of the object
+ * shard (IN):  shard index 0..(n-1)
+ * meta (IN):   layout of the stripe from ec_store_stripe_layout()
+ * buf (OUT):   buffer of meta->shard_len bytes; bytes past the stored part of
+ *              a data shard are zeroed
+ *
+ * returns: state of the shard, buf is only valid for EC_SHARD_OK
+ */
+enum ec_shard_state ec_store_shard_read(struct ec_store * store,
+                                        const char * name,
+                                        uint64_t stripe,
+                                        int shard,
+                                        const struct ec_object_meta * meta,
+                                        uint8_t * buf);
+
+/*
+ * Write a whole shard (its stored part, see ec_shard_valid_len()) and its
+ * block CRCs
+ *
+ * returns: 0 if success, non-zero if failed
+ */
+int ec_store_shard_write(struct ec_store * store,
+                         const char * name,
+                         uint64_t stripe,
+                         int shard,
+                         const struct ec_object_meta * meta,
+                         const uint8_t * buf);
+
+#endif /* EC_STORE_H */
@@ -0,0 +1,199 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ec_stream.h"
+#include "erasure_code.h"
+
+struct ec_stream {
+    uint32_t k;
+    uint32_t p;
+    size_t shard_len;
+    int ring_depth;
+    uint8_t * ring;         // ring_depth stripes of n * shard_len bytes
+    uint8_t ** shards;      // n shard pointers into the current stripe
+    int slot;               // current ring slot
+    size_t fill;            // object bytes in the current stripe
+    uint64_t stripe;        // stripes emitted or read
+    uint64_t length;        // object bytes written or output
+    uint64_t object_len;    // decoder only: bytes the object has
+    ec_stream_emit_fn emit;
+    ec_stream_output_fn output;
+    void * arg;
+};
+
+static size_t
+ec_stream_stripe_size(struct ec_stream * s) {
+    return (s->k + s->p) * s->shard_len;
+}
+
+/*
+ * Point the shard pointers at a ring slot; data shards are back to back so
+ * the object can be copied in contiguously
+ */
+static void
+ec_stream_slot_set(struct ec_stream * s, int slot) {
+    uint8_t * base = &s->ring[slot * ec_stream_stripe_size(s)];
+
+    s->slot = slot;
+    for (int i = 0; i < s->k + s->p; i++)
+        s->shards[i] = &base[i * s->shard_len];
+}
+
+static struct ec_stream *
+ec_stream_create(size_t shard_len, int ring_depth) {
+    if (!shard_len || ring_depth < 1) {
+        printf("Invalid stream shard length %zu or ring depth %d.\n",
+               shard_len, ring_depth);
+        return NULL;
+    }
+
+    struct ec_stream * s = calloc(1, sizeof(*s));
+    if (!s) {
+        printf("Error allocating memory for stream.\n");
+        return NULL;
+    }
+
+    ec_get_params(&s->k, &s->p);
+    s->shard_len = shard_len;
+    s->ring_depth = ring_depth;
+
+    s->ring = malloc(ring_depth * ec_stream_stripe_size(s));
+    s->shards = malloc(sizeof(*s->shards) * (s->k + s->p));
+    if (!s->ring || !s->shards) {
+        printf("Error allocating memory for stream.\n");
+        ec_stream_free(s);
+        return NULL;
+    }
+
+    ec_stream_slot_set(s, 0);
+
+    return s;
+}
+
+void
+ec_stream_free(struct ec_stream * s) {
+    if (!s)
+        return;
+
+    free(s->shards);
+    free(s->ring);
+    free(s);
+}
+
+uint64_t
+ec_stream_length(struct ec_stream * s) {
+    return s->length;
+}
+
+struct ec_stream *
+ec_stream_encoder_create(size_t shard_len,
+                         int ring_depth,
+                         ec_stream_emit_fn emit,
+                         void * arg) {
+    struct ec_stream * s = ec_stream_create(shard_len, ring_depth);
+    if (!s)
+        return NULL;
+
+    s->emit = emit;
+    s->arg = arg;
+
+    return s;
+}
+
+/*
+ * Encode and emit the current stripe, then move to the next ring slot
+ */
+static int
+ec_stream_flush(struct ec_stream * s) {
+    size_t data_size = s->k * s->shard_len;
+    int rc = 0;
+
+    // zero pad a partial last stripe
+    memset(&s->shards[0][s->fill], 0, data_size - s->fill);
+
+    rc = ec_encode_region(s->shards, &s->shards[s->k], s->shard_len, NULL);
+    if (rc)
+        return rc;
+
+    s->emit(s->stripe, s->shards, s->shard_len, s->fill, s->arg);
+
+    s->stripe++;
+    s->fill = 0;
+    ec_stream_slot_set(s, (s->slot + 1) % s->ring_depth);
+
+    return 0;
+}
+
+int
+ec_stream_write(struct ec_stream * s, const void * buf, size_t len) {
+    const uint8_t * src = buf;
+    size_t data_size = s->k * s->shard_len;
+
+    while (len) {
+        size_t chunk = data_size - s->fill;
+        if (chunk > len)
+            chunk = len;
+
+        memcpy(&s->shards[0][s->fill], src, chunk);
+        s->fill += chunk;
+        s->length += chunk;
+        src += chunk;
+        len -= chunk;
+
+        if (s->fill == data_size && ec_stream_flush(s))
+            return -1;
+    }
+
+    return 0;
+}
+
+int
+ec_stream_finish(struct ec_stream * s) {
+    if (!s->fill)
+        return 0;
+
+    return ec_stream_flush(s);
+}
+
+struct ec_stream *
+ec_stream_decoder_create(size_t shard_len,
+                         uint64_t object_len,
+                         ec_stream_output_fn output,
+                         void * arg) {
+    // the decoder only ever holds the stripe being decoded
+    struct ec_stream * s = ec_stream_create(shard_len, 1);
+    if (!s)
+        return NULL;
+
+    s->object_len = object_len;
+    s->output = output;
+    s->arg = arg;
+
+    return s;
+}
+
+int
+ec_stream_read(struct ec_stream * s, uint8_t ** input, int * indices) {
+    uint64_t remaining = s->object_len - s->length;
+    size_t data_size = s->k * s->shard_len;
+    int rc = 0;
+
+    if (!remaining) {
+        printf("Stream already has the whole object.\n");
+        return -1;
+    }
+
+    rc = ec_decode_region(input, indices, s->shards, s->shard_len, NULL);
+    if (rc)
+        return rc;
+
+    // the last stripe is zero padded past the end of the object
+    size_t out = (remaining < data_size) ? remaining : data_size;
+    s->output(s->shards[0], out, s->arg);
+
+    s->length += out;
+    s->stripe++;
+
+    return 0;
+}
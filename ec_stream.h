@@ -0,0 +1,99 @@
+#ifndef EC_STREAM_H
+#define EC_STREAM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Streaming encoder and decoder for objects of any size.  The object is cut
+ * into stripes of k data shards of shard_len bytes each; memory use is a
+ * fixed ring of stripe buffers no matter how large the object is.
+ */
+struct ec_stream;
+
+/*
+ * Called by the encoder for every completed stripe
+ *
+ * stripe (IN):   stripe number, from 0
+ * shards (IN):   n pointers to the data then parity shards of the stripe.
+ *                They stay valid until ring_depth more stripes are emitted.
+ * len (IN):      shard length in bytes
+ * data_len (IN): object bytes in this stripe; less than k * len only for the
+ *                last stripe, whose tail is zero padded
+ * arg (IN):      arg given to ec_stream_encoder_create()
+ */
+typedef void (*ec_stream_emit_fn)(uint64_t stripe,
+                                  uint8_t ** shards,
+                                  size_t len,
+                                  size_t data_len,
+                                  void * arg);
+
+/*
+ * Called by the decoder with the next bytes of the object
+ */
+typedef void (*ec_stream_output_fn)(const uint8_t * data, size_t len, void * arg);
+
+/*
+ * Create a streaming encoder.  ec_init() must have been called.
+ *
+ * shard_len (IN):  bytes per shard of each stripe
+ * ring_depth (IN): number of stripe buffers, at least 1
+ * emit (IN):       called with each completed stripe
+ * arg (IN):        passed to emit
+ *
+ * returns: the encoder, or NULL if failed
+ */
+struct ec_stream * ec_stream_encoder_create(size_t shard_len,
+                                            int ring_depth,
+                                            ec_stream_emit_fn emit,
+                                            void * arg);
+
+/*
+ * Append len bytes of the object.  Every stripe this completes is encoded
+ * and emitted before returning.
+ *
+ * returns: 0 if success, non-zero if failed
+ */
+int ec_stream_write(struct ec_stream * s, const void * buf, size_t len);
+
+/*
+ * Pad, encode and emit the last partial stripe, if any
+ *
+ * returns: 0 if success, non-zero if failed
+ */
+int ec_stream_finish(struct ec_stream * s);
+
+/*
+ * Create a streaming decoder for an object written by a streaming encoder
+ *
+ * shard_len (IN):  bytes per shard, as given to the encoder
+ * object_len (IN): total object length, i.e. ec_stream_length() of the
+ *                  encoder
+ * output (IN):     called with the decoded object bytes, in order
+ * arg (IN):        passed to output
+ *
+ * returns: the decoder, or NULL if failed
+ */
+struct ec_stream * ec_stream_decoder_create(size_t shard_len,
+                                            uint64_t object_len,
+                                            ec_stream_output_fn output,
+                                            void * arg);
+
+/*
+ * Decode the next stripe from any k of its shards and output its data
+ *
+ * input (IN):   array of k pointers to shards of shard_len bytes
+ * indices (IN): array of k indices from 0..(n-1) of the input shards
+ *
+ * returns: 0 if success, non-zero if failed
+ */
+int ec_stream_read(struct ec_stream * s, uint8_t ** input, int * indices);
+
+/*
+ * Object bytes written to an encoder, or output by a decoder, so far
+ */
+uint64_t ec_stream_length(struct ec_stream * s);
+
+void ec_stream_free(struct ec_stream * s);
+
+#endif /* EC_STREAM_H */
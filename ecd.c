@@ -0,0 +1,485 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "ec_async.h"
+#include "ecd_proto.h"
+#include "erasure_code.h"
+
+#define PROG_NAME "ecd"
+
+#define ECD_MAX_CLIENTS (64)
+#define ECD_POLL_BATCH (64)
+#define ECD_MAX_FDS (4)
+
+const char * usage = 
+"Serves encode, decode and reconstruct requests from local processes over a\n"
+"Unix domain socket, on one shared worker pool.  Shard data is exchanged\n"
+"through shared memory attached by each client.\n\n"
+"usage: " PROG_NAME " socket k p [threads]\n"
+"threads: number of workers, default one per CPU\n"
+"Example: " PROG_NAME " /run/ecd.sock 10 4 8\n\n";
+
+struct ecd_conn {
+    int fd;             // -1 once the client has hung up
+    int dropped;        // stopped reading responses, closed on next poll
+    uint8_t * shm;
+    size_t shm_size;
+    int pending;        // jobs not finished yet
+};
+
+/*
+ * A request being worked on; the job's shard arrays point into ptrs
+ */
+struct ecd_job {
+    struct ec_job job;
+    struct ecd_conn * conn;
+    uint32_t id;
+    uint8_t * ptrs[2 * ECD_MAX_SHARDS];
+    int indices[ECD_MAX_SHARDS];
+    uint8_t erased[ECD_MAX_SHARDS];
+};
+
+static volatile sig_atomic_t stop;
+
+static struct ecd_conn * conns[ECD_MAX_CLIENTS];
+static int num_conns;
+
+static uint32_t k;
+static uint32_t p;
+
+static void
+ecd_stop(int sig) {
+    stop = 1;
+}
+
+static void
+ecd_respond(struct ecd_conn * conn, uint32_t id, int rc) {
+    struct ecd_response resp = {
+        .id = id,
+        .rc = rc,
+        .k = k,
+        .p = p,
+    };
+
+    if (conn->fd < 0 || conn->dropped)
+        return;
+
+    // the daemon must not block on one client, so a client whose socket
+    // buffer is full of unread responses is dropped
+    if (send(conn->fd, &resp, sizeof(resp), MSG_NOSIGNAL) < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+            printf("Client is not reading responses, dropping it.\n");
+        else
+            printf("Error responding to client. (errno=%d)\n", errno);
+
+        // poll() then reports the hangup and the main loop closes it
+        conn->dropped = 1;
+        shutdown(conn->fd, SHUT_RDWR);
+    }
+}
+
+static void
+ecd_conn_put(struct ecd_conn * conn) {
+    if (conn->fd >= 0 || conn->pending)
+        return;
+
+    if (conn->shm)
+        munmap(conn->shm, conn->shm_size);
+    free(conn);
+}
+
+static void
+ecd_conn_close(int i) {
+    struct ecd_conn * conn = conns[i];
+
+    close(conn->fd);
+    conn->fd = -1;
+    conns[i] = conns[--num_conns];
+
+    // freed here or when its last job finishes
+    ecd_conn_put(conn);
+}
+
+static int
+ecd_attach(struct ecd_conn * conn, struct ecd_request * req, int shm_fd) {
+    struct stat st;
+    int seals = 0;
+
+    if (shm_fd < 0 || conn->shm || !req->len) {
+        printf("Invalid shared memory attach.\n");
+        return -1;
+    }
+
+    // a mapping past the end of the file, or a file truncated later, would
+    // fault in the daemon rather than in the client
+    if (fstat(shm_fd, &st) || st.st_size < 0 || (uint64_t) st.st_size < req->len) {
+        printf("Client shared memory is smaller than %lu bytes.\n",
+               (unsigned long) req->len);
+        return -1;
+    }
+
+    seals = fcntl(shm_fd, F_GET_SEALS);
+    if (seals < 0 || !(seals & F_SEAL_SHRINK)) {
+        printf("Client shared memory is not sealed against shrinking.\n");
+        return -1;
+    }
+
+    void * shm = mmap(NULL, req->len, PROT_READ | PROT_WRITE, MAP_SHARED,
+                      shm_fd, 0);
+    if (shm == MAP_FAILED) {
+        printf("Error mapping client shared memory. (errno=%d)\n", errno);
+        return -1;
+    }
+
+    conn->shm = shm;
+    conn->shm_size = req->len;
+
+    return 0;
+}
+
+/*
+ * Turn a request into a job, checking everything it points to is inside the
+ * client's shared memory
+ *
+ * returns: the job, or NULL if the request is invalid
+ */
+static struct ecd_job *
+ecd_job_create(struct ecd_conn * conn, struct ecd_request * req) {
+    int count = 0;
+
+    switch (req->op) {
+        case ECD_OP_ENCODE:
+            count = k + p;
+            break;
+        case ECD_OP_DECODE:
+            count = 2 * k;
+            break;
+        case ECD_OP_RECONSTRUCT:
+            count = k + p;
+            break;
+        default:
+            printf("Unknown request %u.\n", req->op);
+            return NULL;
+    }
+
+    if (!conn->shm || req->len > conn->shm_size) {
+        printf("Request outside of client shared memory.\n");
+        return NULL;
+    }
+
+    for (int i = 0; i < count; i++) {
+        if (req->off[i] > conn->shm_size - req->len) {
+            printf("Request outside of client shared memory.\n");
+            return NULL;
+        }
+    }
+
+    if (req->op == ECD_OP_DECODE) {
+        for (int i = 0; i < k; i++) {
+            if (req->indices[i] < 0 || req->indices[i] >= k + p) {
+                printf("Invalid shard index %d.\n", req->indices[i]);
+                return NULL;
+            }
+        }
+    }
+
+    struct ecd_job * j = calloc(1, sizeof(*j));
+    if (!j) {
+        printf("Error allocating memory for request.\n");
+        return NULL;
+    }
+
+    j->conn = conn;
+    j->id = req->id;
+
+    for (int i = 0; i < count; i++)
+        j->ptrs[i] = &conn->shm[req->off[i]];
+    for (int i = 0; i < k; i++)
+        j->indices[i] = req->indices[i];
+    memcpy(j->erased, req->erased, k + p);
+
+    j->job.priority = EC_JOB_PRIO_NORMAL;
+    j->job.len = req->len;
+    j->job.in = j->ptrs;
+    j->job.indices = j->indices;
+    j->job.erased = j->erased;
+    j->job.arg = j;
+
+    switch (req->op) {
+        case ECD_OP_ENCODE:
+            j->job.op = EC_JOB_ENCODE;
+            j->job.out = &j->ptrs[k];
+            break;
+        case ECD_OP_DECODE:
+            j->job.op = EC_JOB_DECODE;
+            j->job.out = &j->ptrs[k];
+            break;
+        default:
+            j->job.op = EC_JOB_RECONSTRUCT;
+    }
+
+    conn->pending++;
+
+    return j;
+}
+
+/*
+ * Read one request from a client.  Attach requests are answered right away,
+ * work is added to jobs.
+ *
+ * returns: 0 if success, -1 if the connection should be closed
+ */
+static int
+ecd_conn_read(struct ecd_conn * conn, struct ec_job ** jobs, int * num_jobs) {
+    struct ecd_request req;
+    char ctrl[CMSG_SPACE(sizeof(int) * ECD_MAX_FDS)];
+    struct iovec iov = {
+        .iov_base = &req,
+        .iov_len = sizeof(req),
+    };
+    struct msghdr msg = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = ctrl,
+        .msg_controllen = sizeof(ctrl),
+    };
+    int shm_fd = -1;
+
+    if (conn->dropped)
+        return -1;
+
+    ssize_t len = recvmsg(conn->fd, &msg, MSG_CMSG_CLOEXEC);
+    if (len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        return 0;
+    if (len <= 0)
+        return -1;
+
+    // keep the first descriptor passed, close any others
+    for (struct cmsghdr * cmsg = CMSG_FIRSTHDR(&msg); cmsg;
+         cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+            continue;
+
+        int count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        for (int i = 0; i < count; i++) {
+            int fd = -1;
+
+            memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+            if (shm_fd < 0)
+                shm_fd = fd;
+            else
+                close(fd);
+        }
+    }
+
+    if (len != sizeof(req)) {
+        printf("Short request from client.\n");
+        ecd_respond(conn, 0, -1);
+    } else if (req.op == ECD_OP_ATTACH) {
+        ecd_respond(conn, req.id, ecd_attach(conn, &req, shm_fd));
+    } else {
+        struct ecd_job * j = ecd_job_create(conn, &req);
+        if (j)
+            jobs[(*num_jobs)++] = &j->job;
+        else
+            ecd_respond(conn, req.id, -1);
+    }
+
+    // the mapping, if any, keeps the memory alive
+    if (shm_fd >= 0)
+        close(shm_fd);
+
+    return 0;
+}
+
+/*
+ * Respond to finished jobs.  With wait set, wait for all outstanding jobs
+ * rather than only taking those finished so far.
+ */
+static void
+ecd_complete(struct ec_async * async, int wait) {
+    struct ec_job * done[ECD_POLL_BATCH];
+    int count = 0;
+
+    while ((count = wait ? ec_wait(async, done, ECD_POLL_BATCH)
+                         : ec_poll(async, done, ECD_POLL_BATCH)) > 0) {
+        for (int i = 0; i < count; i++) {
+            struct ecd_job * j = done[i]->arg;
+            struct ecd_conn * conn = j->conn;
+
+            ecd_respond(conn, j->id, j->job.rc);
+            conn->pending--;
+            ecd_conn_put(conn);
+            free(j);
+        }
+    }
+}
+
+static int
+ecd_listen(const char * path) {
+    struct sockaddr_un addr = {
+        .sun_family = AF_UNIX,
+    };
+
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        printf("Socket path %s is too long.\n", path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        printf("Error creating socket. (errno=%d)\n", errno);
+        return -1;
+    }
+
+    unlink(path);
+    if (bind(fd, (struct sockaddr *) &addr, sizeof(addr))
+        || listen(fd, ECD_MAX_CLIENTS)) {
+        printf("Error listening on %s. (errno=%d)\n", path, errno);
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+int main(int argc, char* argv[]) {
+    int threads = 0;
+    int rc = 0;
+    int listen_fd = -1;
+    struct ec_async * async = 0;
+    struct sigaction sa;
+
+    if (argc != 4 && argc != 5) {
+        printf("Requires 3 or 4 parameters.\n\n");
+        printf("%s\n\n", usage);
+        exit(1);
+    }
+
+    k = atoi(argv[2]);
+    p = atoi(argv[3]);
+    if (argc == 5)
+        threads = atoi(argv[4]);
+
+    if (k + p > ECD_MAX_SHARDS) {
+        printf("k + p must be at most %d.\n", ECD_MAX_SHARDS);
+        exit(1);
+    }
+
+    rc = ec_init(k, p);
+    if (rc) {
+        printf("Error initializing Erasure Code.\n");
+        exit(1);
+    }
+
+    async = ec_async_init(threads);
+    if (!async) {
+        rc = -1;
+        goto err;
+    }
+
+    listen_fd = ecd_listen(argv[1]);
+    if (listen_fd < 0) {
+        rc = -1;
+        goto err;
+    }
+
+    // no SA_RESTART, so poll() returns when asked to stop
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = ecd_stop;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    printf("Listening on %s.\n", argv[1]);
+
+    while (!stop) {
+        struct pollfd fds[2 + ECD_MAX_CLIENTS];
+        struct ec_job * jobs[ECD_MAX_CLIENTS];
+        int num_jobs = 0;
+        int count = num_conns;
+
+        fds[0].fd = listen_fd;
+        fds[0].events = POLLIN;
+        fds[1].fd = ec_async_fd(async);
+        fds[1].events = POLLIN;
+        for (int i = 0; i < count; i++) {
+            fds[2 + i].fd = conns[i]->fd;
+            fds[2 + i].events = POLLIN;
+        }
+
+        if (poll(fds, 2 + count, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            printf("Error polling. (errno=%d)\n", errno);
+            rc = -1;
+            break;
+        }
+
+        if (fds[1].revents)
+            ecd_complete(async, 0);
+
+        // one request per client per round, submitted to the pool together;
+        // go backwards as closing a connection moves the last one into its
+        // place
+        for (int i = count - 1; i >= 0; i--) {
+            if (!fds[2 + i].revents)
+                continue;
+
+            if (ecd_conn_read(conns[i], jobs, &num_jobs))
+                ecd_conn_close(i);
+        }
+
+        if (num_jobs)
+            ec_submit_batch(async, jobs, num_jobs);
+
+        if (fds[0].revents) {
+            int fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK);
+            struct ecd_conn * conn = 0;
+
+            if (fd >= 0 && num_conns < ECD_MAX_CLIENTS)
+                conn = calloc(1, sizeof(*conn));
+
+            if (conn) {
+                conn->fd = fd;
+                conns[num_conns++] = conn;
+            } else if (fd >= 0) {
+                printf("Too many clients, dropping connection.\n");
+                close(fd);
+            }
+        }
+    }
+
+    printf("Shutting down.\n");
+
+err:
+    // answer the jobs still queued before the pool goes away
+    if (async)
+        ecd_complete(async, 1);
+    ec_async_cleanup(async);
+
+    for (int i = num_conns - 1; i >= 0; i--) {
+        conns[i]->pending = 0;
+        ecd_conn_close(i);
+    }
+
+    if (listen_fd >= 0) {
+        close(listen_fd);
+        unlink(argv[1]);
+    }
+
+    ec_cleanup();
+
+    return rc;
+}
@@ -0,0 +1,260 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "ecd_client.h"
+#include "ecd_proto.h"
+
+struct ecd_client {
+    int fd;
+    int shm_fd;
+    uint8_t * shm;
+    size_t shm_size;
+    uint32_t k;
+    uint32_t p;
+    uint32_t next_id;
+    pthread_mutex_t lock;
+};
+
+/*
+ * Send a request and wait for its response; called with the lock held
+ */
+static int
+ecd_call(struct ecd_client * c,
+         struct ecd_request * req,
+         int pass_fd,
+         struct ecd_response * resp) {
+    char ctrl[CMSG_SPACE(sizeof(int))];
+    struct iovec iov = {
+        .iov_base = req,
+        .iov_len = sizeof(*req),
+    };
+    struct msghdr msg = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+    };
+
+    req->id = c->next_id++;
+
+    if (pass_fd >= 0) {
+        memset(ctrl, 0, sizeof(ctrl));
+        msg.msg_control = ctrl;
+        msg.msg_controllen = sizeof(ctrl);
+
+        struct cmsghdr * cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &pass_fd, sizeof(int));
+    }
+
+    if (sendmsg(c->fd, &msg, MSG_NOSIGNAL) != sizeof(*req)) {
+        printf("Error sending request to ecd. (errno=%d)\n", errno);
+        return -1;
+    }
+
+    if (recv(c->fd, resp, sizeof(*resp), 0) != sizeof(*resp)
+        || resp->id != req->id) {
+        printf("Error receiving response from ecd. (errno=%d)\n", errno);
+        return -1;
+    }
+
+    return resp->rc;
+}
+
+/*
+ * Offsets in the shared memory of count shards of len bytes
+ */
+static int
+ecd_offsets(struct ecd_client * c,
+            uint8_t ** shards,
+            int count,
+            size_t len,
+            uint64_t * off) {
+    for (int i = 0; i < count; i++) {
+        if (shards[i] < c->shm || shards[i] + len > c->shm + c->shm_size) {
+            printf("Shard %d is not in the ecd shared memory.\n", i);
+            return -1;
+        }
+        off[i] = shards[i] - c->shm;
+    }
+
+    return 0;
+}
+
+struct ecd_client *
+ecd_connect(const char * path, size_t shm_size) {
+    struct sockaddr_un addr = {
+        .sun_family = AF_UNIX,
+    };
+    struct ecd_request req;
+    struct ecd_response resp;
+
+    struct ecd_client * c = calloc(1, sizeof(*c));
+    if (!c) {
+        printf("Error allocating memory for ecd client.\n");
+        return NULL;
+    }
+
+    c->fd = -1;
+    c->shm_fd = -1;
+    c->shm = MAP_FAILED;
+    c->shm_size = shm_size;
+    pthread_mutex_init(&c->lock, NULL);
+
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        printf("ecd socket path %s is too long.\n", path);
+        goto connect_err;
+    }
+    strcpy(addr.sun_path, path);
+
+    // sealed at its size, so ecd can map it without risking SIGBUS
+    c->shm_fd = memfd_create("ecd_shm", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (c->shm_fd < 0 || ftruncate(c->shm_fd, shm_size)
+        || fcntl(c->shm_fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW)) {
+        printf("Error creating ecd shared memory. (errno=%d)\n", errno);
+        goto connect_err;
+    }
+
+    c->shm = mmap(NULL, shm_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                  c->shm_fd, 0);
+    if (c->shm == MAP_FAILED) {
+        printf("Error mapping ecd shared memory. (errno=%d)\n", errno);
+        goto connect_err;
+    }
+
+    c->fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (c->fd < 0 || connect(c->fd, (struct sockaddr *) &addr, sizeof(addr))) {
+        printf("Error connecting to ecd at %s. (errno=%d)\n", path, errno);
+        goto connect_err;
+    }
+
+    memset(&req, 0, sizeof(req));
+    req.op = ECD_OP_ATTACH;
+    req.len = shm_size;
+
+    if (ecd_call(c, &req, c->shm_fd, &resp)) {
+        printf("ecd refused the shared memory.\n");
+        goto connect_err;
+    }
+
+    c->k = resp.k;
+    c->p = resp.p;
+
+    return c;
+
+connect_err:
+    ecd_disconnect(c);
+    return NULL;
+}
+
+void
+ecd_disconnect(struct ecd_client * c) {
+    if (!c)
+        return;
+
+    if (c->fd >= 0)
+        close(c->fd);
+    if (c->shm != MAP_FAILED)
+        munmap(c->shm, c->shm_size);
+    if (c->shm_fd >= 0)
+        close(c->shm_fd);
+
+    pthread_mutex_destroy(&c->lock);
+    free(c);
+}
+
+void *
+ecd_shm(struct ecd_client * c) {
+    return c->shm;
+}
+
+void
+ecd_params(struct ecd_client * c, uint32_t * k, uint32_t * p) {
+    if (k)
+        *k = c->k;
+    if (p)
+        *p = c->p;
+}
+
+int
+ecd_encode(struct ecd_client * c, uint8_t ** data, uint8_t ** parity, size_t len) {
+    struct ecd_request req;
+    struct ecd_response resp;
+    int rc = 0;
+
+    memset(&req, 0, sizeof(req));
+    req.op = ECD_OP_ENCODE;
+    req.len = len;
+
+    if (ecd_offsets(c, data, c->k, len, req.off)
+        || ecd_offsets(c, parity, c->p, len, &req.off[c->k]))
+        return -1;
+
+    pthread_mutex_lock(&c->lock);
+    rc = ecd_call(c, &req, -1, &resp);
+    pthread_mutex_unlock(&c->lock);
+
+    return rc;
+}
+
+int
+ecd_decode(struct ecd_client * c,
+           uint8_t ** input,
+           const int * indices,
+           uint8_t ** result,
+           size_t len) {
+    struct ecd_request req;
+    struct ecd_response resp;
+    int rc = 0;
+
+    memset(&req, 0, sizeof(req));
+    req.op = ECD_OP_DECODE;
+    req.len = len;
+
+    if (ecd_offsets(c, input, c->k, len, req.off)
+        || ecd_offsets(c, result, c->k, len, &req.off[c->k]))
+        return -1;
+
+    for (int i = 0; i < c->k; i++)
+        req.indices[i] = indices[i];
+
+    pthread_mutex_lock(&c->lock);
+    rc = ecd_call(c, &req, -1, &resp);
+    pthread_mutex_unlock(&c->lock);
+
+    return rc;
+}
+
+int
+ecd_reconstruct(struct ecd_client * c,
+                uint8_t ** shards,
+                const uint8_t * erased,
+                size_t len) {
+    struct ecd_request req;
+    struct ecd_response resp;
+    int rc = 0;
+
+    memset(&req, 0, sizeof(req));
+    req.op = ECD_OP_RECONSTRUCT;
+    req.len = len;
+
+    if (ecd_offsets(c, shards, c->k + c->p, len, req.off))
+        return -1;
+
+    memcpy(req.erased, erased, c->k + c->p);
+
+    pthread_mutex_lock(&c->lock);
+    rc = ecd_call(c, &req, -1, &resp);
+    pthread_mutex_unlock(&c->lock);
+
+    return rc;
+}
@@ -0,0 +1,59 @@
+#ifndef ECD_CLIENT_H
+#define ECD_CLIENT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Client of the ecd encode service.  Shards passed to the calls below must
+ * live in the connection's shared memory, see ecd_shm(); they are encoded in
+ * place by the daemon without being copied.  A connection may be shared by
+ * threads, but calls on it are serialized.
+ */
+struct ecd_client;
+
+/*
+ * Connect to ecd and attach a shared memory area for shards
+ *
+ * path (IN):     path of the daemon's Unix domain socket
+ * shm_size (IN): size of the shared memory area in bytes
+ *
+ * returns: the connection, or NULL if failed
+ */
+struct ecd_client * ecd_connect(const char * path, size_t shm_size);
+
+void ecd_disconnect(struct ecd_client * c);
+
+/*
+ * Start of the shared memory area, shm_size bytes long
+ */
+void * ecd_shm(struct ecd_client * c);
+
+/*
+ * Get the k and p the daemon was started with
+ */
+void ecd_params(struct ecd_client * c, uint32_t * k, uint32_t * p);
+
+/*
+ * ec_encode_region(), ec_decode_region() and ec_reconstruct() run by the
+ * daemon
+ *
+ * returns: 0 if success, non-zero if failed
+ */
+int ecd_encode(struct ecd_client * c,
+               uint8_t ** data,
+               uint8_t ** parity,
+               size_t len);
+
+int ecd_decode(struct ecd_client * c,
+               uint8_t ** input,
+               const int * indices,
+               uint8_t ** result,
+               size_t len);
+
+int ecd_reconstruct(struct ecd_client * c,
+                    uint8_t ** shards,
+                    const uint8_t * erased,
+                    size_t len);
+
+#endif /* ECD_CLIENT_H */
@@ -0,0 +1,40 @@
+#ifndef ECD_PROTO_H
+#define ECD_PROTO_H
+
+#include <stdint.h>
+
+/*
+ * Wire format between ecd and its clients.  Messages go over a
+ * SOCK_SEQPACKET Unix domain socket, one request or response per packet.
+ * Shard data never crosses the socket: a client first attaches a memfd
+ * (passed with SCM_RIGHTS) that both sides map, and requests name shards by
+ * their offset in it.  The memfd must be at least the attached size and
+ * sealed with F_SEAL_SHRINK.
+ */
+
+#define ECD_MAX_SHARDS (256)
+
+enum ecd_op {
+    ECD_OP_ATTACH,      // len is the size of the memfd passed along
+    ECD_OP_ENCODE,      // off: k data shards, then p parity shards
+    ECD_OP_DECODE,      // off: k input shards, then k result shards
+    ECD_OP_RECONSTRUCT, // off: n shards, erased: n flags
+};
+
+struct ecd_request {
+    uint32_t op;
+    uint32_t id;                        // echoed in the response
+    uint64_t len;                       // length of each shard in bytes
+    uint64_t off[2 * ECD_MAX_SHARDS];   // shard offsets in the shared memory
+    int32_t indices[ECD_MAX_SHARDS];    // decode only
+    uint8_t erased[ECD_MAX_SHARDS];     // reconstruct only
+};
+
+struct ecd_response {
+    uint32_t id;
+    int32_t rc;
+    uint32_t k;         // code parameters of the daemon
+    uint32_t p;
+};
+
+#endif /* ECD_PROTO_H */
@@ -1,18 +1,138 @@
+#include <fcntl.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
 
+#if defined(__x86_64__) || defined(__i386__)
+#define EC_HAVE_X86 1
+#include <emmintrin.h>
+#endif
+
+#include "crc32c.h"
+#include "erasure_code.h"
 #include "gf_base2.h"
+#include "gf_static_tables.h"
+
+#define EC_DECODE_CACHE_MIN_SLOTS (1024)
+#define EC_DECODE_CACHE_BUDGET (64 * 1024 * 1024)
+#define EC_DECODE_CACHE_PROBES (4)
+
+#define EC_FILE_MAGIC "ECCTX01"
+
+// default block size for region operations, see ec_set_block_size()
+#define EC_REGION_BLOCK (4096)
+
+// parity recomputed by ec_verify() lives in a stack buffer this big
+#define EC_VERIFY_BLOCK (1024)
+
+// per-thread staging area for packing small stripes in ec_encode_region_batch()
+#define EC_BATCH_SCRATCH (256 * 1024)
+
+static __thread uint8_t * batch_scratch;
+
+// frees the scratch buffers below when a thread exits
+static pthread_key_t scratch_key;
+static pthread_once_t scratch_once = PTHREAD_ONCE_INIT;
+
+// default shard length at and above which outputs bypass the cache
+#define EC_STREAM_THRESHOLD (4 * 1024 * 1024)
+
+#define EC_CACHE_LINE (64)
+
+// per-thread output accumulators for streaming mode
+static __thread uint8_t * stream_scratch;
+static __thread size_t stream_scratch_len;
+
+/*
+ * Decode matrices keyed by the ordered list of input indices.  Each slot is
+ * laid out as [valid][k indices][k x k decode matrix].
+ */
+struct ec_decode_cache {
+    uint32_t slots;
+    size_t slot_size;
+    uint8_t * v;
+    pthread_rwlock_t lock;
+};
 
 struct ec_config {
     uint32_t k; // number of input bytes
     uint32_t p; // number of parity bytes
     uint32_t n; // number of output bytes
+    enum ec_matrix_type type;  // how the encoding matrix was generated
     struct gf_matrix * matrix; // encoding matrix
+    struct ec_decode_cache cache;
+    void * map;     // context file the matrix and cache live in, if mmap'ed
+    size_t map_len;
+};
+
+/*
+ * Header of a saved context file.  It is followed by the n x k encoding
+ * matrix and the decode cache slots, so both can be used straight from the
+ * mapping.
+ */
+struct ec_file_header {
+    char magic[8];
+    uint32_t k;
+    uint32_t p;
+    uint32_t type;
+    uint32_t gf_m;
+    uint32_t gf_g;
+    uint32_t cache_slots;
 };
 
 struct ec_config ec;
 
+static size_t region_block = EC_REGION_BLOCK;
+
+static size_t stream_threshold = EC_STREAM_THRESHOLD;
+
+// shard length and minimum run time of each ec_tune() measurement
+#define EC_TUNE_LEN (1024 * 1024)
+#define EC_TUNE_MIN_S (0.02)
+
+// region operations are split across threads only if each gets this much
+#define EC_THREAD_MIN_LEN (256 * 1024)
+
+static int region_threads = 1;
+
+/*
+ * One thread's slice of a region operation
+ */
+struct ec_region_slice {
+    struct gf_matrix * m;
+    uint8_t ** in;
+    uint8_t ** out;
+    size_t len;
+    int * remaining;    // slices of the operation not finished yet
+    struct ec_region_slice * next;
+};
+
+/*
+ * Workers started by ec_set_threads() that run queued slices.  Callers queue
+ * their slices and work on the queue too while they wait, so concurrent
+ * region operations share the workers.
+ */
+struct ec_region_pool {
+    pthread_mutex_t lock;
+    pthread_cond_t work;
+    pthread_cond_t done;
+    struct ec_region_slice * queue;
+    pthread_t * tids;
+    int num_threads;
+    int stop;
+};
+
+static struct ec_region_pool region_pool = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .work = PTHREAD_COND_INITIALIZER,
+    .done = PTHREAD_COND_INITIALIZER,
+};
+
 /*
  * Assume matrix is r by c, where r > c.
  */
@@ -27,6 +147,65 @@ cauchy_matrix_gen(struct gf_matrix * m) {
             m->v[r * m->cols + c] = gf_mult_inv(gf_add(r, c));
 }
 
+/*
+ * Number of 1s in the 8 x 8 bit matrix of multiplication by c.  Column t is
+ * c * x^t, and each 1 costs an XOR when encoding with bit matrices.
+ */
+static int
+gf_bitmatrix_ones(uint8_t c) {
+    int ones = 0;
+
+    for (int t = 0; t < 8; t++)
+        ones += __builtin_popcount(gf_mult(c, 1 << t));
+
+    return ones;
+}
+
+/*
+ * Cauchy matrix with its parity columns and rows scaled to make encoding
+ * cheap.  Scaling rows or columns of a Cauchy matrix by non-zero constants
+ * keeps every square submatrix invertible, so the code stays MDS.
+ */
+void
+cauchy_opt_matrix_gen(struct gf_matrix * m) {
+    cauchy_matrix_gen(m);
+
+    if (m->rows == m->cols)
+        return;
+
+    // scale columns so the first parity row is all 1s, i.e. plain XOR
+    uint8_t * first = &m->v[m->cols * m->cols];
+    for (int c = 0; c < m->cols; c++) {
+        uint8_t scale = gf_mult_inv(first[c]);
+
+        for (int r = m->cols; r < m->rows; r++)
+            m->v[r * m->cols + c] = gf_mult(scale, m->v[r * m->cols + c]);
+    }
+
+    // scale every other parity row by whichever of its elements' inverse
+    // leaves the fewest 1s in its bit matrices
+    for (int r = m->cols + 1; r < m->rows; r++) {
+        uint8_t * row = &m->v[r * m->cols];
+        uint8_t best_scale = 1;
+        int best = -1;
+
+        for (int i = 0; i < m->cols; i++) {
+            uint8_t scale = gf_mult_inv(row[i]);
+            int ones = 0;
+
+            for (int c = 0; c < m->cols; c++)
+                ones += gf_bitmatrix_ones(gf_mult(scale, row[c]));
+
+            if (best < 0 || ones < best) {
+                best = ones;
+                best_scale = scale;
+            }
+        }
+
+        gf_region_mult(row, row, best_scale, m->cols);
+    }
+}
+
 void
 rs_matrix_gen(struct gf_matrix * m) {
     // top rows form the identity matrix
@@ -105,19 +284,181 @@ vandermonde_matrix_gen(struct gf_matrix * m) {
     return 0;
 }
 
+static int
+ec_matrix_gen(struct gf_matrix * m, enum ec_matrix_type type) {
+    switch (type) {
+        case EC_MATRIX_VANDERMONDE:
+            return vandermonde_matrix_gen(m);
+
+        case EC_MATRIX_CAUCHY:
+            cauchy_matrix_gen(m);
+            return 0;
+
+        case EC_MATRIX_RS:
+            rs_matrix_gen(m);
+            return 0;
+
+        case EC_MATRIX_CAUCHY_OPT:
+            cauchy_opt_matrix_gen(m);
+            return 0;
+
+        default:
+            printf("Unknown matrix type %d.\n", type);
+            return -1;
+    }
+}
+
+int
+ec_matrix_cost(enum ec_matrix_type type,
+               const uint32_t k,
+               const uint32_t p,
+               struct ec_matrix_cost * cost) {
+    int rc = 0;
+
+    // Need to initialize GF before doing any math
+    rc = gf_init_static(gf_static_m, gf_static_g,
+                        gf_static_mult_tbl, gf_static_mult_inv_tbl);
+    if (rc)
+        return rc;
+
+    struct gf_matrix * m = gf_matrix_create(k + p, k);
+    if (!m)
+        return -1;
+
+    rc = ec_matrix_gen(m, type);
+    if (rc)
+        goto cost_err;
+
+    memset(cost, 0, sizeof(*cost));
+
+    // the RS construction is not guaranteed to keep every k rows invertible
+    cost->mds = (type != EC_MATRIX_RS);
+
+    for (int r = k; r < k + p; r++) {
+        uint8_t * row = &m->v[r * k];
+
+        for (int c = 0; c < k; c++) {
+            if (row[c] == 1)
+                cost->ones++;
+            else if (row[c])
+                cost->nontrivial++;
+        }
+
+        // each output bit XORs together every input bit its bit-matrix row
+        // selects
+        for (int b = 0; b < 8; b++) {
+            int bits = 0;
+
+            for (int c = 0; c < k; c++)
+                for (int t = 0; t < 8; t++)
+                    bits += (gf_mult(row[c], 1 << t) >> b) & 1;
+
+            if (bits)
+                cost->xors += bits - 1;
+        }
+    }
+
+cost_err:
+    gf_matrix_delete(m);
+    return rc;
+}
+
+/*
+ * Cheapest MDS matrix type by XOR count
+ */
+static enum ec_matrix_type
+ec_matrix_type_pick(const uint32_t k, const uint32_t p) {
+    enum ec_matrix_type best_type = EC_MATRIX_VANDERMONDE;
+    int best = -1;
+
+    for (int type = 0; type < EC_MATRIX_AUTO; type++) {
+        struct ec_matrix_cost cost;
+
+        if (ec_matrix_cost(type, k, p, &cost) || !cost.mds)
+            continue;
+
+        if (best < 0 || cost.xors < best) {
+            best = cost.xors;
+            best_type = type;
+        }
+    }
+
+    return best_type;
+}
+
 void
 ec_cleanup() {
     gf_cleanup();
-    gf_matrix_delete(ec.matrix);
+
+    pthread_rwlock_destroy(&ec.cache.lock);
+
+    if (ec.map) {
+        // matrix and cache point into the mapping
+        free(ec.matrix);
+        munmap(ec.map, ec.map_len);
+    } else {
+        gf_matrix_delete(ec.matrix);
+        free(ec.cache.v);
+    }
+
+    memset(&ec, 0, sizeof(ec));
 }
 
-int
-ec_init(const uint32_t k, const uint32_t p) {
+/*
+ * Set the code parameters and everything that does not depend on the matrix
+ */
+static int
+ec_config_set(const uint32_t k, const uint32_t p) {
     memset(&ec, 0, sizeof(ec));
     ec.k = k;
     ec.p = p;
     ec.n = k + p;
 
+    pthread_rwlock_init(&ec.cache.lock, NULL);
+
+    // indices are stored as bytes, and GF(2^8) has no more distinct points
+    if (!k || ec.n > 256) {
+        printf("Unsupported code size k = %d, p = %d.\n", k, p);
+        return -1;
+    }
+
+    // Need to initialize GF before doing any math
+    int rc = gf_init_static(gf_static_m, gf_static_g,
+                            gf_static_mult_tbl, gf_static_mult_inv_tbl);
+    if (rc) {
+        printf("Error initializing Galois Field.\n");
+        return -1;
+    }
+
+    // room for every single and double failure pattern, with slack, as far
+    // as the memory budget allows.  Slots hold k x k matrices, so wide codes
+    // get fewer of them.
+    uint32_t warm = ec.n + ec.n * (ec.n - 1) / 2;
+    ec.cache.slot_size = 1 + ec.k + ec.k * ec.k;
+    ec.cache.slots = EC_DECODE_CACHE_MIN_SLOTS;
+    while (ec.cache.slots < 2 * warm
+           && 2 * ec.cache.slots * ec.cache.slot_size <= EC_DECODE_CACHE_BUDGET)
+        ec.cache.slots <<= 1;
+    while (ec.cache.slots > EC_DECODE_CACHE_PROBES
+           && ec.cache.slots * ec.cache.slot_size > EC_DECODE_CACHE_BUDGET)
+        ec.cache.slots >>= 1;
+
+    return 0;
+}
+
+int
+ec_init(const uint32_t k, const uint32_t p) {
+    return ec_init_matrix(k, p, EC_MATRIX_VANDERMONDE);
+}
+
+int
+ec_init_matrix(const uint32_t k, const uint32_t p, enum ec_matrix_type type) {
+    int rc = ec_config_set(k, p);
+    if (rc) {
+        ec_cleanup();
+        return -1;
+    }
+
     ec.matrix = gf_matrix_create(ec.n, ec.k);
     if (!ec.matrix) {
         printf("Failed to create matrix.\n");
@@ -125,17 +466,20 @@ ec_init(const uint32_t k, const uint32_t p) {
         return -1;
     }
 
-    // Need to initialize GF before doing any math
-    int rc = gf_init(8, 283);
-    if (rc) {
-        printf("Error initializing Galois Field.\n");
+    // slots are filled on decode misses; untouched ones are zero pages that
+    // are never faulted in
+    ec.cache.v = calloc(ec.cache.slots, ec.cache.slot_size);
+    if (!ec.cache.v) {
+        printf("Failed to allocate decode cache.\n");
         ec_cleanup();
         return -1;
     }
 
-    //cauchy_matrix_gen(ec.matrix);
-    //rs_matrix_gen(ec.matrix);
-    rc = vandermonde_matrix_gen(ec.matrix);
+    if (type == EC_MATRIX_AUTO)
+        type = ec_matrix_type_pick(k, p);
+
+    ec.type = type;
+    rc = ec_matrix_gen(ec.matrix, type);
     if (rc) {
         printf("Error generating encoding matrix.\n");
         return rc;
@@ -144,11 +488,106 @@ ec_init(const uint32_t k, const uint32_t p) {
     printf("Encoding matrix:\n");
     gf_matrix_print(ec.matrix);
 
+    // optional: reuse or create the tuning for this host
+    const char * tuning = getenv("EC_TUNING_FILE");
+    if (tuning) {
+        if (!access(tuning, R_OK))
+            rc = ec_tune_load(tuning);
+        else
+            rc = ec_tune(tuning);
+
+        if (rc)
+            printf("Continuing with default tuning.\n");
+    }
+
     printf("Erasure Code module initialized.\n");
 
     return 0;
 }
 
+void
+ec_get_params(uint32_t * k, uint32_t * p) {
+    if (k)
+        *k = ec.k;
+    if (p)
+        *p = ec.p;
+}
+
+int
+ec_init_from_file(const char * path) {
+    struct ec_file_header * hdr = 0;
+    struct stat st;
+    void * map = 0;
+    int rc = 0;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        printf("Error opening %s.\n", path);
+        return -1;
+    }
+
+    rc = fstat(fd, &st);
+    if (rc || st.st_size < sizeof(*hdr)) {
+        printf("Invalid context file %s.\n", path);
+        close(fd);
+        return -1;
+    }
+
+    // private writable mapping: the cache can keep filling in this process
+    // without touching the file
+    map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        printf("Error mapping %s.\n", path);
+        return -1;
+    }
+
+    hdr = map;
+    if (memcmp(hdr->magic, EC_FILE_MAGIC, sizeof(hdr->magic))
+        || hdr->gf_m != gf_static_m || hdr->gf_g != gf_static_g
+        || hdr->type >= EC_MATRIX_AUTO
+        || !hdr->cache_slots || (hdr->cache_slots & (hdr->cache_slots - 1))) {
+        printf("Invalid context file %s.\n", path);
+        munmap(map, st.st_size);
+        return -1;
+    }
+
+    rc = ec_config_set(hdr->k, hdr->p);
+    if (rc) {
+        munmap(map, st.st_size);
+        ec_cleanup();
+        return -1;
+    }
+
+    ec.map = map;
+    ec.map_len = st.st_size;
+    ec.type = hdr->type;
+    ec.cache.slots = hdr->cache_slots;
+
+    if (sizeof(*hdr) + ec.n * ec.k + ec.cache.slots * ec.cache.slot_size
+        != ec.map_len) {
+        printf("Invalid context file %s.\n", path);
+        ec_cleanup();
+        return -1;
+    }
+
+    ec.matrix = malloc(sizeof(*ec.matrix));
+    if (!ec.matrix) {
+        printf("Failed to create matrix.\n");
+        ec_cleanup();
+        return -1;
+    }
+
+    ec.matrix->rows = ec.n;
+    ec.matrix->cols = ec.k;
+    ec.matrix->v = (uint8_t *) map + sizeof(*hdr);
+    ec.cache.v = ec.matrix->v + ec.n * ec.k;
+
+    printf("Erasure Code module initialized from %s.\n", path);
+
+    return 0;
+}
+
 int
 ec_encode(uint8_t * input, uint8_t * parity) {
     int rc = 0;
@@ -177,54 +616,1746 @@ ec_encode(uint8_t * input, uint8_t * parity) {
     return gf_matrix_mult(&encoding_m, &input_m, &parity_m);
 }
 
-int
-ec_decode(uint8_t * input, int * indices, uint8_t * result) {
-    int rc = 0;
-    int row = 0;
+void
+ec_set_block_size(size_t size) {
+    region_block = size ? size : EC_REGION_BLOCK;
+}
 
-    struct gf_matrix input_m = {
-        .rows = ec.k,
-        .cols = 1,
-        .v = input,
-    };
+void
+ec_set_stream_threshold(size_t len) {
+    stream_threshold = len;
+}
 
-    struct gf_matrix result_m = {
-        .rows = ec.k,
-        .cols = 1,
-        .v = result,
-    };
+/*
+ * Copy an output block that will not be read again soon, without pulling it
+ * into the cache
+ */
+static void
+ec_stream_copy(uint8_t * dst, const uint8_t * src, size_t len) {
+#ifdef EC_HAVE_X86
+    size_t i = 0;
+    size_t head = (-(uintptr_t) dst) & 15;
 
-    struct gf_matrix * decode_m = gf_matrix_create(ec.k, ec.k);
-    struct gf_matrix * decode_inv_m = gf_matrix_create(ec.k, ec.k);
+    if (head > len)
+        head = len;
+    memcpy(dst, src, head);
 
-    // copy the rows corresponding to the indices from ec.matrix to decode_m
-    for (int i = 0; i < ec.k; i++) {
-        row = indices[i];
-        for (int j = 0; j < ec.k; j++)
-            decode_m->v[i * ec.k + j] = ec.matrix->v[row * ec.k + j];
-    }
+    for (i = head; i + 16 <= len; i += 16)
+        _mm_stream_si128((__m128i *) &dst[i],
+                         _mm_loadu_si128((const __m128i *) &src[i]));
 
-    rc = gf_matrix_inv(decode_m, decode_inv_m); 
-    if (rc) {
-        printf("Error decoding - cannot find inverse of encoding matrix.\n");
-        printf("Input was:\n");
-        for (int i = 0; i < ec.k; i++) {
-            printf("%02x ", input[i]);
+    memcpy(&dst[i], &src[i], len - i);
+#else
+    memcpy(dst, src, len);
+#endif
+}
+
+static void
+ec_scratch_free(void * arg) {
+    free(batch_scratch);
+    batch_scratch = NULL;
+    free(stream_scratch);
+    stream_scratch = NULL;
+    stream_scratch_len = 0;
+}
+
+static void
+ec_scratch_key_create() {
+    if (pthread_key_create(&scratch_key, ec_scratch_free))
+        printf("Error creating scratch buffer key.\n");
+}
+
+/*
+ * Have the calling thread's scratch buffers freed when it exits
+ */
+static void
+ec_scratch_track() {
+    pthread_once(&scratch_once, ec_scratch_key_create);
+    pthread_setspecific(scratch_key, &scratch_once);
+}
+
+/*
+ * Streaming version of the block loop in ec_region_mult(), for regions so
+ * large that the outputs would only evict everybody else's working set.
+ * Outputs are accumulated in a per-thread scratch block and written out with
+ * non-temporal stores; the next block of each input is prefetched while the
+ * current one is worked on.
+ */
+static int
+ec_region_mult_stream(struct gf_matrix * m,
+                      uint8_t ** in,
+                      uint8_t ** out,
+                      size_t len,
+                      uint32_t * in_crc,
+                      uint32_t * out_crc) {
+    size_t need = m->rows * region_block;
+
+    if (stream_scratch_len < need) {
+        void * buf = 0;
+
+        if (posix_memalign(&buf, EC_CACHE_LINE, need)) {
+            printf("Error allocating memory for streaming.\n");
+            return -1;
         }
-        printf("\n");
-        printf("Indices was:\n");
-        for (int i = 0; i < ec.k; i++) {
-            printf("%d ", indices[i]);
+
+        free(stream_scratch);
+        stream_scratch = buf;
+        stream_scratch_len = need;
+        ec_scratch_track();
+    }
+
+    for (size_t off = 0; off < len; off += region_block) {
+        size_t blk = (len - off < region_block) ? len - off : region_block;
+        size_t next = off + blk;
+        size_t next_blk = (len - next < region_block) ? len - next : region_block;
+
+        for (int j = 0; j < m->cols; j++)
+            for (size_t l = 0; next < len && l < next_blk; l += EC_CACHE_LINE)
+                __builtin_prefetch(&in[j][next + l], 0, 0);
+
+        memset(stream_scratch, 0, m->rows * blk);
+
+        for (int j = 0; j < m->cols; j++)
+            for (int i = 0; i < m->rows; i++)
+                gf_region_mult_add(&stream_scratch[i * blk], &in[j][off],
+                                   m->v[i * m->cols + j], blk);
+
+        if (in_crc)
+            for (int j = 0; j < m->cols; j++)
+                in_crc[j] = crc32c(in_crc[j], &in[j][off], blk);
+
+        for (int i = 0; i < m->rows; i++) {
+            if (out_crc)
+                out_crc[i] = crc32c(out_crc[i], &stream_scratch[i * blk], blk);
+            ec_stream_copy(&out[i][off], &stream_scratch[i * blk], blk);
         }
-        printf("\n");
-        goto decode_err;
     }
 
-    gf_matrix_mult(decode_inv_m, &input_m, &result_m);
+#ifdef EC_HAVE_X86
+    // make the non-temporal stores visible before returning
+    _mm_sfence();
+#endif
 
-decode_err:
-    gf_matrix_delete(decode_inv_m);
-    gf_matrix_delete(decode_m);
+    return 0;
+}
 
-    return rc;
+/*
+ * out[i] = sum_j m[i][j] * in[j] over len bytes, for a rows x cols matrix m.
+ *
+ * Works block by block.  Within a block each input is read once and added
+ * into all the output accumulators while it is hot, so every input byte is
+ * streamed from memory once no matter how many outputs there are.  When
+ * in_crc/out_crc are given, each block of the inputs and outputs is also
+ * checksummed while it is still in cache.
+ */
+static void
+ec_region_mult_range(struct gf_matrix * m,
+                     uint8_t ** in,
+                     uint8_t ** out,
+                     size_t len,
+                     uint32_t * in_crc,
+                     uint32_t * out_crc) {
+    if (in_crc)
+        memset(in_crc, 0, sizeof(*in_crc) * m->cols);
+    if (out_crc)
+        memset(out_crc, 0, sizeof(*out_crc) * m->rows);
+
+    if (len >= stream_threshold
+        && !ec_region_mult_stream(m, in, out, len, in_crc, out_crc))
+        return;
+
+    for (size_t off = 0; off < len; off += region_block) {
+        size_t blk = (len - off < region_block) ? len - off : region_block;
+
+        for (int i = 0; i < m->rows; i++)
+            memset(&out[i][off], 0, blk);
+
+        for (int j = 0; j < m->cols; j++)
+            for (int i = 0; i < m->rows; i++)
+                gf_region_mult_add(&out[i][off], &in[j][off],
+                                   m->v[i * m->cols + j], blk);
+
+        if (in_crc)
+            for (int j = 0; j < m->cols; j++)
+                in_crc[j] = crc32c(in_crc[j], &in[j][off], blk);
+
+        if (out_crc)
+            for (int i = 0; i < m->rows; i++)
+                out_crc[i] = crc32c(out_crc[i], &out[i][off], blk);
+    }
+}
+
+static void
+ec_region_slice_run(struct ec_region_slice * slice) {
+    ec_region_mult_range(slice->m, slice->in, slice->out, slice->len,
+                         NULL, NULL);
+
+    pthread_mutex_lock(&region_pool.lock);
+    if (!--*slice->remaining)
+        pthread_cond_broadcast(&region_pool.done);
+    pthread_mutex_unlock(&region_pool.lock);
+}
+
+/*
+ * Take the next queued slice; called with the lock held
+ */
+static struct ec_region_slice *
+ec_region_pool_pop() {
+    struct ec_region_slice * slice = region_pool.queue;
+
+    if (slice)
+        region_pool.queue = slice->next;
+
+    return slice;
+}
+
+static void *
+ec_region_worker(void * arg) {
+    pthread_mutex_lock(&region_pool.lock);
+
+    while (1) {
+        struct ec_region_slice * slice = ec_region_pool_pop();
+
+        if (!slice) {
+            if (region_pool.stop)
+                break;
+            pthread_cond_wait(&region_pool.work, &region_pool.lock);
+            continue;
+        }
+
+        pthread_mutex_unlock(&region_pool.lock);
+        ec_region_slice_run(slice);
+        pthread_mutex_lock(&region_pool.lock);
+    }
+
+    pthread_mutex_unlock(&region_pool.lock);
+
+    return NULL;
+}
+
+static void
+ec_region_pool_stop() {
+    pthread_mutex_lock(&region_pool.lock);
+    region_pool.stop = 1;
+    pthread_cond_broadcast(&region_pool.work);
+    pthread_mutex_unlock(&region_pool.lock);
+
+    for (int t = 0; t < region_pool.num_threads; t++)
+        pthread_join(region_pool.tids[t], NULL);
+
+    free(region_pool.tids);
+    region_pool.tids = NULL;
+    region_pool.num_threads = 0;
+    region_pool.stop = 0;
+}
+
+void
+ec_set_threads(int threads) {
+    threads = (threads > 0) ? threads : 1;
+
+    if (threads == region_threads)
+        return;
+
+    ec_region_pool_stop();
+    region_threads = threads;
+
+    if (threads < 2)
+        return;
+
+    // the calling thread works on its own operations, so one less worker
+    region_pool.tids = malloc(sizeof(*region_pool.tids) * (threads - 1));
+    if (!region_pool.tids) {
+        printf("Error allocating memory for region threads.\n");
+        return;
+    }
+
+    // with fewer workers than asked for, callers run the extra slices
+    for (int t = 0; t < threads - 1; t++) {
+        int rc = pthread_create(&region_pool.tids[t], NULL, ec_region_worker, NULL);
+        if (rc) {
+            printf("Error creating region thread. (error=%d)\n", rc);
+            break;
+        }
+        region_pool.num_threads++;
+    }
+}
+
+/*
+ * ec_region_mult_range(), split by offset across region_threads threads when
+ * the region is large enough.  Checksums are sequential over a shard, so
+ * checksummed regions stay on one thread.
+ */
+static void
+ec_region_mult(struct gf_matrix * m,
+               uint8_t ** in,
+               uint8_t ** out,
+               size_t len,
+               uint32_t * in_crc,
+               uint32_t * out_crc) {
+    int threads = region_threads;
+
+    if (len / EC_THREAD_MIN_LEN < threads)
+        threads = len / EC_THREAD_MIN_LEN;
+
+    if (threads < 2 || in_crc || out_crc) {
+        ec_region_mult_range(m, in, out, len, in_crc, out_crc);
+        return;
+    }
+
+    struct ec_region_slice slices[threads];
+    uint8_t * ptrs[threads][m->cols + m->rows];
+    int remaining = threads;
+
+    // slices start on cache line boundaries
+    size_t per = ((len / threads) + EC_CACHE_LINE - 1) & ~(size_t) (EC_CACHE_LINE - 1);
+
+    for (int t = 0; t < threads; t++) {
+        size_t off = t * per;
+        struct ec_region_slice * slice = &slices[t];
+
+        slice->m = m;
+        slice->in = ptrs[t];
+        slice->out = &ptrs[t][m->cols];
+        slice->len = (off >= len) ? 0 : (len - off < per) ? len - off : per;
+        slice->remaining = &remaining;
+
+        for (int j = 0; j < m->cols; j++)
+            slice->in[j] = in[j] + off;
+        for (int i = 0; i < m->rows; i++)
+            slice->out[i] = out[i] + off;
+    }
+
+    // queue all but the last slice, which the calling thread does itself
+    pthread_mutex_lock(&region_pool.lock);
+    for (int t = threads - 2; t >= 0; t--) {
+        slices[t].next = region_pool.queue;
+        region_pool.queue = &slices[t];
+    }
+    pthread_cond_broadcast(&region_pool.work);
+    pthread_mutex_unlock(&region_pool.lock);
+
+    ec_region_slice_run(&slices[threads - 1]);
+
+    // help with queued slices rather than wait idle for busy workers
+    pthread_mutex_lock(&region_pool.lock);
+    while (remaining) {
+        struct ec_region_slice * slice = ec_region_pool_pop();
+
+        if (slice) {
+            pthread_mutex_unlock(&region_pool.lock);
+            ec_region_slice_run(slice);
+            pthread_mutex_lock(&region_pool.lock);
+        } else {
+            pthread_cond_wait(&region_pool.done, &region_pool.lock);
+        }
+    }
+    pthread_mutex_unlock(&region_pool.lock);
+}
+
+int
+ec_encode_region(uint8_t ** data, uint8_t ** parity, size_t len, uint32_t * crc) {
+    // The bottom part of the encoding matrix is used for encoding.
+    struct gf_matrix encoding_m = {
+        .rows = ec.p,
+        .cols = ec.k,
+        .v = &(ec.matrix->v[ec.k * ec.k]),
+    };
+
+    ec_region_mult(&encoding_m, data, parity, len,
+                   crc, crc ? &crc[ec.k] : NULL);
+
+    return 0;
+}
+
+/*
+ * Index of the first differing byte of a and b, or len if they are equal
+ */
+static size_t
+ec_first_diff(const uint8_t * a, const uint8_t * b, size_t len) {
+    size_t i = 0;
+
+    for (; i + 8 <= len; i += 8) {
+        uint64_t x = 0;
+        uint64_t y = 0;
+
+        memcpy(&x, &a[i], sizeof(x));
+        memcpy(&y, &b[i], sizeof(y));
+        if (x != y)
+            break;
+    }
+
+    for (; i < len; i++)
+        if (a[i] != b[i])
+            break;
+
+    return i;
+}
+
+int
+ec_verify(uint8_t ** data,
+          uint8_t ** parity,
+          size_t len,
+          size_t * bad_offset,
+          int * bad_row) {
+    uint8_t expected[EC_VERIFY_BLOCK];
+    uint8_t * coeffs = &ec.matrix->v[ec.k * ec.k];
+
+    for (size_t off = 0; off < len; off += EC_VERIFY_BLOCK) {
+        size_t blk = (len - off < EC_VERIFY_BLOCK) ? len - off : EC_VERIFY_BLOCK;
+
+        for (int i = 0; i < ec.p; i++) {
+            memset(expected, 0, blk);
+            for (int j = 0; j < ec.k; j++)
+                gf_region_mult_add(expected, &data[j][off],
+                                   coeffs[i * ec.k + j], blk);
+
+            size_t diff = ec_first_diff(expected, &parity[i][off], blk);
+            if (diff < blk) {
+                if (bad_offset)
+                    *bad_offset = off + diff;
+                if (bad_row)
+                    *bad_row = i;
+                return 1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+static int
+ec_batch_scratch_get() {
+    if (!batch_scratch) {
+        batch_scratch = malloc(EC_BATCH_SCRATCH);
+        if (!batch_scratch) {
+            printf("Error allocating memory for batch encoding.\n");
+            return -1;
+        }
+        ec_scratch_track();
+    }
+
+    return 0;
+}
+
+int
+ec_encode_region_batch(uint8_t *** data,
+                       uint8_t *** parity,
+                       int count,
+                       size_t len) {
+    uint8_t * in[ec.k];
+    uint8_t * out[ec.p];
+    int per_pass = 0;
+
+    if (!len || count <= 0)
+        return 0;
+
+    per_pass = EC_BATCH_SCRATCH / (ec.n * len);
+
+    // stripes too big to pack are already efficient one at a time
+    if (per_pass < 2) {
+        for (int s = 0; s < count; s++)
+            ec_encode_region(data[s], parity[s], len, NULL);
+        return 0;
+    }
+
+    if (ec_batch_scratch_get())
+        return -1;
+
+    struct gf_matrix encoding_m = {
+        .rows = ec.p,
+        .cols = ec.k,
+        .v = &(ec.matrix->v[ec.k * ec.k]),
+    };
+
+    for (int first = 0; first < count; first += per_pass) {
+        int num = (count - first < per_pass) ? count - first : per_pass;
+        size_t packed = num * len;
+
+        // structure of arrays: shard j of every stripe back to back
+        for (int j = 0; j < ec.k; j++) {
+            in[j] = &batch_scratch[j * packed];
+            for (int s = 0; s < num; s++)
+                memcpy(&in[j][s * len], data[first + s][j], len);
+        }
+
+        for (int i = 0; i < ec.p; i++)
+            out[i] = &batch_scratch[(ec.k + i) * packed];
+
+        ec_region_mult(&encoding_m, in, out, packed, NULL, NULL);
+
+        for (int i = 0; i < ec.p; i++)
+            for (int s = 0; s < num; s++)
+                memcpy(parity[first + s][i], &out[i][s * len], len);
+    }
+
+    return 0;
+}
+
+#ifdef EC_HAVE_X86
+/*
+ * Transpose a 16 x 16 byte block held in 16 vectors.  Interleaving vector i
+ * with vector i + 8 rotates the 8-bit (vector, byte) index left by one bit,
+ * so four rounds swap the vector and byte indices.
+ */
+static void
+ec_transpose_16x16(__m128i * v) {
+    __m128i t[16];
+
+    for (int round = 0; round < 4; round++) {
+        for (int i = 0; i < 8; i++) {
+            t[2 * i] = _mm_unpacklo_epi8(v[i], v[i + 8]);
+            t[2 * i + 1] = _mm_unpackhi_epi8(v[i], v[i + 8]);
+        }
+        memcpy(v, t, sizeof(t));
+    }
+}
+
+/*
+ * Rows r..r+15 of width (16 or 8) columns starting at column c of an
+ * interleaved buffer into the matching shards
+ */
+static void
+ec_deinterleave_block(const uint8_t * src,
+                      int count,
+                      uint8_t ** shards,
+                      size_t r,
+                      int c,
+                      int width) {
+    __m128i v[16];
+
+    for (int i = 0; i < 16; i++) {
+        const uint8_t * row = &src[(r + i) * count + c];
+        v[i] = (width == 16) ? _mm_loadu_si128((__m128i *) row)
+                             : _mm_loadl_epi64((__m128i *) row);
+    }
+
+    ec_transpose_16x16(v);
+
+    for (int i = 0; i < width; i++)
+        _mm_storeu_si128((__m128i *) &shards[c + i][r], v[i]);
+}
+
+/*
+ * The reverse of ec_deinterleave_block()
+ */
+static void
+ec_interleave_block(uint8_t ** shards,
+                    int count,
+                    uint8_t * dst,
+                    size_t r,
+                    int c,
+                    int width) {
+    __m128i v[16];
+
+    for (int i = 0; i < 16; i++)
+        v[i] = (i < width) ? _mm_loadu_si128((__m128i *) &shards[c + i][r])
+                           : _mm_setzero_si128();
+
+    ec_transpose_16x16(v);
+
+    for (int i = 0; i < 16; i++) {
+        uint8_t * row = &dst[(r + i) * count + c];
+        if (width == 16)
+            _mm_storeu_si128((__m128i *) row, v[i]);
+        else
+            _mm_storel_epi64((__m128i *) row, v[i]);
+    }
+}
+#endif
+
+void
+ec_deinterleave(const uint8_t * src, int count, uint8_t ** shards, size_t len) {
+    size_t r = 0;
+
+#ifdef EC_HAVE_X86
+    for (; r + 16 <= len; r += 16) {
+        int c = 0;
+
+        for (; c + 16 <= count; c += 16)
+            ec_deinterleave_block(src, count, shards, r, c, 16);
+        if (c + 8 <= count) {
+            ec_deinterleave_block(src, count, shards, r, c, 8);
+            c += 8;
+        }
+
+        for (; c < count; c++)
+            for (size_t i = r; i < r + 16; i++)
+                shards[c][i] = src[i * count + c];
+    }
+#endif
+
+    for (; r < len; r++)
+        for (int c = 0; c < count; c++)
+            shards[c][r] = src[r * count + c];
+}
+
+void
+ec_interleave(uint8_t ** shards, int count, uint8_t * dst, size_t len) {
+    size_t r = 0;
+
+#ifdef EC_HAVE_X86
+    for (; r + 16 <= len; r += 16) {
+        int c = 0;
+
+        for (; c + 16 <= count; c += 16)
+            ec_interleave_block(shards, count, dst, r, c, 16);
+        if (c + 8 <= count) {
+            ec_interleave_block(shards, count, dst, r, c, 8);
+            c += 8;
+        }
+
+        for (; c < count; c++)
+            for (size_t i = r; i < r + 16; i++)
+                dst[i * count + c] = shards[c][i];
+    }
+#endif
+
+    for (; r < len; r++)
+        for (int c = 0; c < count; c++)
+            dst[r * count + c] = shards[c][r];
+}
+
+int
+ec_encode_interleaved(const uint8_t * data, uint8_t * parity, size_t len) {
+    uint8_t * in[ec.k];
+    uint8_t * out[ec.p];
+    // whole 16-row transpose blocks per pass
+    size_t per_pass = (EC_BATCH_SCRATCH / ec.n) & ~(size_t) 15;
+
+    if (ec_batch_scratch_get())
+        return -1;
+
+    struct gf_matrix encoding_m = {
+        .rows = ec.p,
+        .cols = ec.k,
+        .v = &(ec.matrix->v[ec.k * ec.k]),
+    };
+
+    for (int j = 0; j < ec.k; j++)
+        in[j] = &batch_scratch[j * per_pass];
+    for (int i = 0; i < ec.p; i++)
+        out[i] = &batch_scratch[(ec.k + i) * per_pass];
+
+    for (size_t r = 0; r < len; r += per_pass) {
+        size_t rows = (len - r < per_pass) ? len - r : per_pass;
+
+        ec_deinterleave(&data[r * ec.k], ec.k, in, rows);
+        ec_region_mult_range(&encoding_m, in, out, rows, NULL, NULL);
+        ec_interleave(out, ec.p, &parity[r * ec.p], rows);
+    }
+
+    return 0;
+}
+
+/*
+ * Invert the m x m submatrix of the encoding matrix made of the given parity
+ * rows and lost data columns.  Cauchy submatrices have a closed-form inverse.
+ */
+static int
+ec_parity_submatrix_inv(int * rows, int * cols, int m, struct gf_matrix * inv) {
+    int rc = 0;
+
+    if (ec.type == EC_MATRIX_CAUCHY || ec.type == EC_MATRIX_CAUCHY_OPT) {
+        uint8_t x[m];
+        uint8_t y[m];
+        uint8_t row_scale[m];
+        uint8_t col_scale[m];
+
+        // cauchy_matrix_gen() sets row r, col c to 1/(r + c), and
+        // cauchy_opt_matrix_gen() scales that to rs_r * cs_c / (r + c).
+        // Recover the scales of this submatrix relative to its first row.
+        for (int i = 0; i < m; i++) {
+            x[i] = rows[i];
+            y[i] = cols[i];
+        }
+
+        for (int j = 0; j < m; j++)
+            col_scale[j] = gf_mult(ec.matrix->v[rows[0] * ec.k + cols[j]],
+                                   gf_add(x[0], y[j]));
+
+        for (int i = 0; i < m; i++)
+            row_scale[i] = gf_mult(gf_mult(ec.matrix->v[rows[i] * ec.k + cols[0]],
+                                           gf_add(x[i], y[0])),
+                                   gf_mult_inv(col_scale[0]));
+
+        rc = gf_cauchy_matrix_inv(x, y, m, inv);
+        if (rc)
+            return rc;
+
+        // (Dr A Dc)^-1 = Dc^-1 A^-1 Dr^-1
+        for (int i = 0; i < m; i++)
+            for (int j = 0; j < m; j++)
+                inv->v[i * m + j] = gf_mult(inv->v[i * m + j],
+                                            gf_mult_inv(gf_mult(col_scale[i],
+                                                                row_scale[j])));
+
+        return 0;
+    }
+
+    struct gf_matrix * sub = gf_matrix_create(m, m);
+    if (!sub)
+        return -1;
+
+    for (int i = 0; i < m; i++)
+        for (int j = 0; j < m; j++)
+            sub->v[i * m + j] = ec.matrix->v[rows[i] * ec.k + cols[j]];
+
+    rc = gf_matrix_inv(sub, inv);
+
+    gf_matrix_delete(sub);
+    return rc;
+}
+
+/*
+ * Build the k x k matrix that maps the k inputs at the given indices back to
+ * the original data.
+ *
+ * The top k rows of the encoding matrix form the identity, so each surviving
+ * data byte maps straight through.  If m data bytes were lost, they are
+ * recovered from m parity rows, and only the m x m submatrix formed by those
+ * parity rows and the lost columns has to be inverted:
+ *
+ *   lost = C^-1 * (parity + C' * survived)
+ *
+ * where C' is the parity rows restricted to the surviving columns.
+ */
+static int
+ec_decode_matrix_gen(int * indices, struct gf_matrix * decode_m) {
+    int rc = 0;
+    int pos[ec.k];          // input position of each data index, or -1
+    int lost[ec.k];         // lost data indices
+    int parity_rows[ec.k];  // parity rows used for recovery
+    int parity_pos[ec.k];   // input positions of those parity rows
+    int m = 0;
+    int np = 0;
+
+    for (int i = 0; i < ec.k; i++)
+        pos[i] = -1;
+
+    for (int i = 0; i < ec.k; i++) {
+        int idx = indices[i];
+
+        if (idx < 0 || idx >= ec.n) {
+            printf("Invalid index %d.\n", idx);
+            return -1;
+        }
+
+        if (idx < ec.k) {
+            if (pos[idx] >= 0) {
+                printf("Duplicate index %d.\n", idx);
+                return -1;
+            }
+            pos[idx] = i;
+        } else {
+            for (int j = 0; j < np; j++) {
+                if (parity_rows[j] == idx) {
+                    printf("Duplicate index %d.\n", idx);
+                    return -1;
+                }
+            }
+            parity_rows[np] = idx;
+            parity_pos[np] = i;
+            np++;
+        }
+    }
+
+    memset(decode_m->v, 0, ec.k * ec.k);
+
+    for (int i = 0; i < ec.k; i++) {
+        if (pos[i] >= 0)
+            decode_m->v[i * ec.k + pos[i]] = 1;
+        else
+            lost[m++] = i;
+    }
+
+    if (!m)
+        return 0;
+
+    struct gf_matrix * sub_inv = gf_matrix_create(m, m);
+    if (!sub_inv)
+        return -1;
+
+    rc = ec_parity_submatrix_inv(parity_rows, lost, m, sub_inv);
+    if (rc)
+        goto gen_err;
+
+    for (int a = 0; a < m; a++) {
+        uint8_t * out = &decode_m->v[lost[a] * ec.k];
+
+        for (int b = 0; b < m; b++) {
+            uint8_t c = sub_inv->v[a * m + b];
+            uint8_t * parity_row = &ec.matrix->v[parity_rows[b] * ec.k];
+
+            out[parity_pos[b]] = c;
+
+            // fold in the surviving data through this parity row
+            for (int s = 0; s < ec.k; s++)
+                if (pos[s] >= 0)
+                    out[pos[s]] = gf_add(out[pos[s]],
+                                         gf_mult(c, parity_row[s]));
+        }
+    }
+
+gen_err:
+    gf_matrix_delete(sub_inv);
+    return rc;
+}
+
+static uint32_t
+ec_decode_cache_hash(int * indices) {
+    // FNV-1a
+    uint32_t h = 2166136261u;
+
+    for (int i = 0; i < ec.k; i++)
+        h = (h ^ (uint8_t) indices[i]) * 16777619u;
+
+    return h;
+}
+
+static int
+ec_decode_cache_match(uint8_t * slot, int * indices) {
+    if (!slot[0])
+        return 0;
+
+    for (int i = 0; i < ec.k; i++)
+        if (slot[1 + i] != indices[i])
+            return 0;
+
+    return 1;
+}
+
+/*
+ * Get the decode matrix for the given indices from the decode cache,
+ * generating and caching it on a miss.
+ */
+static int
+ec_decode_matrix_get(int * indices, struct gf_matrix * decode_m) {
+    int rc = 0;
+    uint32_t home = ec_decode_cache_hash(indices) & (ec.cache.slots - 1);
+    uint8_t * slot = 0;
+    uint8_t * free_slot = 0;
+
+    pthread_rwlock_rdlock(&ec.cache.lock);
+    for (int i = 0; i < EC_DECODE_CACHE_PROBES; i++) {
+        slot = &ec.cache.v[((home + i) & (ec.cache.slots - 1))
+                           * ec.cache.slot_size];
+        if (ec_decode_cache_match(slot, indices)) {
+            memcpy(decode_m->v, &slot[1 + ec.k], ec.k * ec.k);
+            pthread_rwlock_unlock(&ec.cache.lock);
+            return 0;
+        }
+    }
+    pthread_rwlock_unlock(&ec.cache.lock);
+
+    rc = ec_decode_matrix_gen(indices, decode_m);
+    if (rc)
+        return rc;
+
+    pthread_rwlock_wrlock(&ec.cache.lock);
+    for (int i = 0; i < EC_DECODE_CACHE_PROBES; i++) {
+        slot = &ec.cache.v[((home + i) & (ec.cache.slots - 1))
+                           * ec.cache.slot_size];
+        if (!slot[0] || ec_decode_cache_match(slot, indices)) {
+            free_slot = slot;
+            break;
+        }
+    }
+
+    // all probed slots are taken; evict the home slot
+    if (!free_slot)
+        free_slot = &ec.cache.v[home * ec.cache.slot_size];
+
+    free_slot[0] = 1;
+    for (int i = 0; i < ec.k; i++)
+        free_slot[1 + i] = indices[i];
+    memcpy(&free_slot[1 + ec.k], decode_m->v, ec.k * ec.k);
+    pthread_rwlock_unlock(&ec.cache.lock);
+
+    return 0;
+}
+
+/*
+ * Fill the decode cache for every pattern of one or two lost bytes, using the
+ * first k remaining indices in order.  Patterns that would not fit with slack
+ * in a capped cache are left to be filled on demand.
+ */
+static int
+ec_decode_cache_warm() {
+    int rc = 0;
+    int indices[ec.k];
+    int max_lost = (ec.p < 2) ? ec.p : 2;
+
+    if (max_lost == 2 && 2 * (ec.n + ec.n * (ec.n - 1) / 2) > ec.cache.slots)
+        max_lost = 1;
+    if (max_lost == 1 && 2 * ec.n > ec.cache.slots)
+        max_lost = 0;
+
+    if (!max_lost)
+        return 0;
+
+    struct gf_matrix * decode_m = gf_matrix_create(ec.k, ec.k);
+    if (!decode_m)
+        return -1;
+
+    for (int lost1 = 0; lost1 < ec.n && !rc; lost1++) {
+        // lost2 == lost1 stands for the single failure
+        for (int lost2 = lost1; lost2 < ec.n && !rc; lost2++) {
+            if (lost2 != lost1 && max_lost < 2)
+                break;
+
+            for (int i = 0, j = 0; j < ec.k; i++)
+                if (i != lost1 && i != lost2)
+                    indices[j++] = i;
+
+            rc = ec_decode_matrix_get(indices, decode_m);
+        }
+    }
+
+    gf_matrix_delete(decode_m);
+    return rc;
+}
+
+int
+ec_save(const char * path) {
+    int rc = 0;
+    struct ec_file_header hdr;
+
+    rc = ec_decode_cache_warm();
+    if (rc) {
+        printf("Error warming decode cache.\n");
+        return rc;
+    }
+
+    FILE * f = fopen(path, "wb");
+    if (!f) {
+        printf("Error opening %s.\n", path);
+        return -1;
+    }
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, EC_FILE_MAGIC, sizeof(hdr.magic));
+    hdr.k = ec.k;
+    hdr.p = ec.p;
+    hdr.type = ec.type;
+    hdr.gf_m = gf_static_m;
+    hdr.gf_g = gf_static_g;
+    hdr.cache_slots = ec.cache.slots;
+
+    pthread_rwlock_rdlock(&ec.cache.lock);
+    if (fwrite(&hdr, sizeof(hdr), 1, f) != 1
+        || fwrite(ec.matrix->v, ec.n * ec.k, 1, f) != 1
+        || fwrite(ec.cache.v, ec.cache.slot_size, ec.cache.slots, f)
+           != ec.cache.slots) {
+        printf("Error writing %s.\n", path);
+        rc = -1;
+    }
+    pthread_rwlock_unlock(&ec.cache.lock);
+
+    if (fclose(f))
+        rc = -1;
+
+    return rc;
+}
+
+int
+ec_decode(uint8_t * input, int * indices, uint8_t * result) {
+    int rc = 0;
+
+    struct gf_matrix input_m = {
+        .rows = ec.k,
+        .cols = 1,
+        .v = input,
+    };
+
+    struct gf_matrix result_m = {
+        .rows = ec.k,
+        .cols = 1,
+        .v = result,
+    };
+
+    struct gf_matrix * decode_inv_m = gf_matrix_create(ec.k, ec.k);
+    if (!decode_inv_m)
+        return -1;
+
+    rc = ec_decode_matrix_get(indices, decode_inv_m);
+    if (rc) {
+        printf("Error decoding - cannot find inverse of encoding matrix.\n");
+        printf("Input was:\n");
+        for (int i = 0; i < ec.k; i++) {
+            printf("%02x ", input[i]);
+        }
+        printf("\n");
+        printf("Indices was:\n");
+        for (int i = 0; i < ec.k; i++) {
+            printf("%d ", indices[i]);
+        }
+        printf("\n");
+        goto decode_err;
+    }
+
+    gf_matrix_mult(decode_inv_m, &input_m, &result_m);
+
+decode_err:
+    gf_matrix_delete(decode_inv_m);
+
+    return rc;
+}
+
+int
+ec_decode_region(uint8_t ** input,
+                 int * indices,
+                 uint8_t ** result,
+                 size_t len,
+                 uint32_t * crc) {
+    int rc = 0;
+
+    struct gf_matrix * decode_inv_m = gf_matrix_create(ec.k, ec.k);
+    if (!decode_inv_m)
+        return -1;
+
+    rc = ec_decode_matrix_get(indices, decode_inv_m);
+    if (rc) {
+        printf("Error decoding - cannot find inverse of encoding matrix.\n");
+        goto decode_err;
+    }
+
+    ec_region_mult(decode_inv_m, input, result, len,
+                   crc, crc ? &crc[ec.k] : NULL);
+
+decode_err:
+    gf_matrix_delete(decode_inv_m);
+
+    return rc;
+}
+
+/*
+ * Orders candidate shards for ec_plan_decode(): cheapest first, data before
+ * parity at equal cost, then by index
+ */
+struct ec_plan_candidate {
+    int index;
+    uint32_t cost;
+};
+
+static int
+ec_plan_candidate_cmp(const void * a, const void * b) {
+    const struct ec_plan_candidate * x = a;
+    const struct ec_plan_candidate * y = b;
+    int x_parity = x->index >= ec.k;
+    int y_parity = y->index >= ec.k;
+
+    if (x->cost != y->cost)
+        return (x->cost < y->cost) ? -1 : 1;
+
+    if (x_parity != y_parity)
+        return x_parity - y_parity;
+
+    return x->index - y->index;
+}
+
+static int
+ec_int_cmp(const void * a, const void * b) {
+    return *(const int *) a - *(const int *) b;
+}
+
+void
+ec_plan_free(struct ec_decode_plan * plan) {
+    if (!plan)
+        return;
+
+    free(plan->indices);
+    gf_matrix_delete(plan->matrix);
+    free(plan);
+}
+
+/*
+ * Create a decode plan for the given input indices, in the given order
+ */
+static struct ec_decode_plan *
+ec_plan_create(const int * indices) {
+    struct ec_decode_plan * plan = calloc(1, sizeof(*plan));
+    if (!plan) {
+        printf("Error allocating memory for decode plan.\n");
+        return NULL;
+    }
+
+    plan->indices = malloc(sizeof(*plan->indices) * ec.k);
+    plan->matrix = gf_matrix_create(ec.k, ec.k);
+    if (!plan->indices || !plan->matrix) {
+        printf("Error allocating memory for decode plan.\n");
+        ec_plan_free(plan);
+        return NULL;
+    }
+
+    for (int i = 0; i < ec.k; i++) {
+        plan->indices[i] = indices[i];
+        if (indices[i] >= ec.k)
+            plan->reconstruct++;
+    }
+
+    if (ec_decode_matrix_get(plan->indices, plan->matrix)) {
+        printf("Error decoding - cannot find inverse of encoding matrix.\n");
+        ec_plan_free(plan);
+        return NULL;
+    }
+
+    return plan;
+}
+
+struct ec_decode_plan *
+ec_plan_decode(const int * available, const uint32_t * cost, int count) {
+    struct ec_plan_candidate cand[count];
+    struct ec_decode_plan * plan = 0;
+    int indices[ec.k];
+    uint32_t total = 0;
+
+    if (count < ec.k) {
+        printf("Need at least %d shards to decode, got %d.\n", ec.k, count);
+        return NULL;
+    }
+
+    for (int i = 0; i < count; i++) {
+        cand[i].index = available[i];
+        cand[i].cost = cost ? cost[i] : 0;
+    }
+
+    // any k shards of an MDS code decode, so the k cheapest are the best
+    qsort(cand, count, sizeof(cand[0]), ec_plan_candidate_cmp);
+
+    for (int i = 0; i < ec.k; i++) {
+        indices[i] = cand[i].index;
+        total += cand[i].cost;
+    }
+
+    // a canonical order makes every plan for the same set hit the same
+    // decode cache slot
+    qsort(indices, ec.k, sizeof(*indices), ec_int_cmp);
+
+    plan = ec_plan_create(indices);
+    if (plan)
+        plan->cost = total;
+
+    return plan;
+}
+
+int
+ec_decode_plan_region(struct ec_decode_plan * plan,
+                      uint8_t ** input,
+                      uint8_t ** result,
+                      size_t len) {
+    uint8_t rows[ec.k * ec.k];
+    uint8_t * out[ec.k];
+    int m = 0;
+
+    for (int i = 0; i < ec.k; i++) {
+        int pos = 0;
+
+        while (pos < ec.k && plan->indices[pos] != i)
+            pos++;
+
+        // surviving data shard
+        if (pos < ec.k) {
+            if (result[i] != input[pos])
+                memcpy(result[i], input[pos], len);
+            continue;
+        }
+
+        memcpy(&rows[m * ec.k], &plan->matrix->v[i * ec.k], ec.k);
+        out[m++] = result[i];
+    }
+
+    struct gf_matrix rebuild_m = {
+        .rows = m,
+        .cols = ec.k,
+        .v = rows,
+    };
+
+    ec_region_mult(&rebuild_m, input, out, len, NULL, NULL);
+
+    return 0;
+}
+
+int
+ec_decode_plan_shard(struct ec_decode_plan * plan,
+                     uint8_t ** input,
+                     int index,
+                     uint8_t * result,
+                     size_t len) {
+    if (index < 0 || index >= ec.k) {
+        printf("Invalid data shard index %d.\n", index);
+        return -1;
+    }
+
+    for (int pos = 0; pos < ec.k; pos++) {
+        if (plan->indices[pos] == index) {
+            if (result != input[pos])
+                memcpy(result, input[pos], len);
+            return 0;
+        }
+    }
+
+    struct gf_matrix rebuild_m = {
+        .rows = 1,
+        .cols = ec.k,
+        .v = &plan->matrix->v[index * ec.k],
+    };
+
+    ec_region_mult(&rebuild_m, input, &result, len, NULL, NULL);
+
+    return 0;
+}
+
+int
+ec_decode_region_batch(uint8_t *** input,
+                       int * indices,
+                       uint8_t *** result,
+                       int count,
+                       size_t len) {
+    // one inversion (or cache lookup) for every stripe
+    struct ec_decode_plan * plan = ec_plan_create(indices);
+    if (!plan)
+        return -1;
+
+    for (int s = 0; s < count; s++)
+        ec_decode_plan_region(plan, input[s], result[s], len);
+
+    ec_plan_free(plan);
+
+    return 0;
+}
+
+int
+ec_reconstruct_batch(uint8_t *** shards,
+                     const uint8_t * erased,
+                     int count,
+                     size_t len) {
+    int indices[ec.k];
+    uint8_t * in[ec.k];
+    uint8_t rows[ec.n * ec.k];
+    uint8_t * out[ec.n];
+    int have = 0;
+    int m = 0;
+    int rc = 0;
+
+    for (int i = 0; i < ec.n && have < ec.k; i++)
+        if (!erased[i])
+            indices[have++] = i;
+
+    if (have < ec.k) {
+        printf("Error reconstructing - fewer than %u shards survive.\n", ec.k);
+        return -1;
+    }
+
+    struct gf_matrix * decode_inv_m = gf_matrix_create(ec.k, ec.k);
+    if (!decode_inv_m)
+        return -1;
+
+    rc = ec_decode_matrix_get(indices, decode_inv_m);
+    if (rc) {
+        printf("Error decoding - cannot find inverse of encoding matrix.\n");
+        goto reconstruct_err;
+    }
+
+    for (int i = 0; i < ec.n; i++) {
+        uint8_t * row = &rows[m * ec.k];
+
+        if (!erased[i])
+            continue;
+
+        if (i < ec.k) {
+            memcpy(row, &decode_inv_m->v[i * ec.k], ec.k);
+        } else {
+            // parity row of the encoding matrix applied to the decoded data
+            uint8_t * coeffs = &ec.matrix->v[i * ec.k];
+
+            memset(row, 0, ec.k);
+            for (int j = 0; j < ec.k; j++)
+                for (int c = 0; c < ec.k; c++)
+                    row[c] ^= gf_mult(coeffs[j], decode_inv_m->v[j * ec.k + c]);
+        }
+
+        m++;
+    }
+
+    struct gf_matrix rebuild_m = {
+        .rows = m,
+        .cols = ec.k,
+        .v = rows,
+    };
+
+    // one rebuild matrix for every stripe
+    for (int s = 0; s < count && m; s++) {
+        int o = 0;
+
+        for (int j = 0; j < ec.k; j++)
+            in[j] = shards[s][indices[j]];
+        for (int i = 0; i < ec.n; i++)
+            if (erased[i])
+                out[o++] = shards[s][i];
+
+        ec_region_mult(&rebuild_m, in, out, len, NULL, NULL);
+    }
+
+reconstruct_err:
+    gf_matrix_delete(decode_inv_m);
+
+    return rc;
+}
+
+int
+ec_reconstruct(uint8_t ** shards, const uint8_t * erased, size_t len) {
+    return ec_reconstruct_batch(&shards, erased, 1, len);
+}
+
+/*
+ * ec_region_mult_range() for inputs and outputs that are shorter than the
+ * region: input j only has in_len[j] bytes, the rest being zeros, and only the
+ * first out_len[i] bytes of output i are produced.
+ */
+static void
+ec_region_mult_masked(struct gf_matrix * m,
+                      uint8_t ** in,
+                      const size_t * in_len,
+                      uint8_t ** out,
+                      const size_t * out_len,
+                      size_t len) {
+    for (size_t off = 0; off < len; off += region_block) {
+        size_t blk = (len - off < region_block) ? len - off : region_block;
+
+        for (int i = 0; i < m->rows; i++) {
+            if (out_len[i] <= off)
+                continue;
+
+            size_t out_blk = (out_len[i] - off < blk) ? out_len[i] - off : blk;
+            memset(&out[i][off], 0, out_blk);
+        }
+
+        for (int j = 0; j < m->cols; j++) {
+            if (in_len[j] <= off)
+                continue;
+
+            size_t in_blk = (in_len[j] - off < blk) ? in_len[j] - off : blk;
+
+            for (int i = 0; i < m->rows; i++) {
+                if (out_len[i] <= off)
+                    continue;
+
+                size_t out_blk = (out_len[i] - off < in_blk) ? out_len[i] - off : in_blk;
+                gf_region_mult_add(&out[i][off], &in[j][off],
+                                   m->v[i * m->cols + j], out_blk);
+            }
+        }
+    }
+}
+
+size_t
+ec_shard_valid_len(const struct ec_object_meta * meta, int index) {
+    uint64_t start = (uint64_t) index * meta->shard_len;
+
+    if (index >= ec.k)
+        return meta->shard_len;
+    if (start >= meta->length)
+        return 0;
+
+    return (meta->length - start < meta->shard_len) ? meta->length - start
+                                                    : meta->shard_len;
+}
+
+int
+ec_encode_object(const uint8_t * obj,
+                 uint64_t len,
+                 uint8_t ** parity,
+                 struct ec_object_meta * meta) {
+    uint8_t * in[ec.k];
+    size_t in_len[ec.k];
+    size_t out_len[ec.p];
+
+    meta->length = len;
+    meta->shard_len = (len + ec.k - 1) / ec.k;
+
+    struct gf_matrix encoding_m = {
+        .rows = ec.p,
+        .cols = ec.k,
+        .v = &(ec.matrix->v[ec.k * ec.k]),
+    };
+
+    for (int j = 0; j < ec.k; j++) {
+        in_len[j] = ec_shard_valid_len(meta, j);
+        in[j] = in_len[j] ? (uint8_t *) &obj[j * meta->shard_len] : NULL;
+    }
+
+    for (int i = 0; i < ec.p; i++)
+        out_len[i] = meta->shard_len;
+
+    ec_region_mult_masked(&encoding_m, in, in_len, parity, out_len,
+                          meta->shard_len);
+
+    return 0;
+}
+
+int
+ec_decode_object(uint8_t ** input,
+                 int * indices,
+                 const struct ec_object_meta * meta,
+                 uint8_t * obj) {
+    uint8_t rows[ec.k * ec.k];
+    uint8_t * out[ec.k];
+    size_t in_len[ec.k];
+    size_t out_len[ec.k];
+    int m = 0;
+    int rc = 0;
+
+    for (int j = 0; j < ec.k; j++)
+        in_len[j] = ec_shard_valid_len(meta, indices[j]);
+
+    struct gf_matrix * decode_inv_m = gf_matrix_create(ec.k, ec.k);
+    if (!decode_inv_m)
+        return -1;
+
+    rc = ec_decode_matrix_get(indices, decode_inv_m);
+    if (rc) {
+        printf("Error decoding - cannot find inverse of encoding matrix.\n");
+        goto decode_object_err;
+    }
+
+    for (int i = 0; i < ec.k; i++) {
+        size_t valid = ec_shard_valid_len(meta, i);
+        uint8_t * dst = &obj[i * meta->shard_len];
+        int pos = 0;
+
+        if (!valid)
+            continue;
+
+        while (pos < ec.k && indices[pos] != i)
+            pos++;
+
+        // surviving data shard
+        if (pos < ec.k) {
+            if (dst != input[pos])
+                memcpy(dst, input[pos], valid);
+            continue;
+        }
+
+        memcpy(&rows[m * ec.k], &decode_inv_m->v[i * ec.k], ec.k);
+        out[m] = dst;
+        out_len[m++] = valid;
+    }
+
+    struct gf_matrix rebuild_m = {
+        .rows = m,
+        .cols = ec.k,
+        .v = rows,
+    };
+
+    ec_region_mult_masked(&rebuild_m, input, in_len, out, out_len,
+                          meta->shard_len);
+
+decode_object_err:
+    gf_matrix_delete(decode_inv_m);
+
+    return rc;
+}
+
+static double
+ec_now() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/*
+ * Encoding throughput of the current settings in bytes of data per second
+ */
+static double
+ec_tune_measure(uint8_t ** shards, size_t len) {
+    int reps = 0;
+    double start = ec_now();
+    double elapsed = 0;
+
+    do {
+        ec_encode_region(shards, &shards[ec.k], len, NULL);
+        reps++;
+        elapsed = ec_now() - start;
+    } while (elapsed < EC_TUNE_MIN_S);
+
+    return (double) reps * ec.k * len / elapsed;
+}
+
+int
+ec_tune(const char * path) {
+    static const size_t blocks[] = {1024, 2048, 4096, 8192, 16384, 32768, 65536};
+    int rc = 0;
+    int cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t len = EC_TUNE_LEN;
+    uint8_t * shards[ec.n];
+    enum gf_kernel best_kernel = gf_kernel_get();
+    size_t best_block = region_block;
+    int best_threads = 1;
+    double best = 0;
+    size_t saved_threshold = stream_threshold;
+
+    if (cpus < 1)
+        cpus = 1;
+    if (len < cpus * EC_THREAD_MIN_LEN)
+        len = cpus * EC_THREAD_MIN_LEN;
+
+    memset(shards, 0, sizeof(shards));
+    for (int i = 0; i < ec.n; i++) {
+        shards[i] = malloc(len);
+        if (!shards[i]) {
+            printf("Error allocating memory for tuning.\n");
+            rc = -1;
+            goto tune_err;
+        }
+
+        for (size_t j = 0; j < len; j++)
+            shards[i][j] = (uint8_t) (rand() % (UINT8_MAX + 1));
+    }
+
+    printf("Tuning for k = %d, p = %d...\n", ec.k, ec.p);
+
+    stream_threshold = SIZE_MAX;
+    ec_set_threads(1);
+
+    // kernel and block size together, single threaded
+    for (int k = 0; k < GF_KERNEL_NUM; k++) {
+        if (!gf_kernel_supported(k))
+            continue;
+
+        gf_kernel_set(k);
+        for (int b = 0; b < sizeof(blocks) / sizeof(blocks[0]); b++) {
+            ec_set_block_size(blocks[b]);
+
+            double rate = ec_tune_measure(shards, len);
+            if (rate > best) {
+                best = rate;
+                best_kernel = k;
+                best_block = blocks[b];
+            }
+        }
+    }
+
+    gf_kernel_set(best_kernel);
+    ec_set_block_size(best_block);
+
+    // then the thread count
+    for (int t = 2; t <= cpus; t *= 2) {
+        ec_set_threads(t);
+
+        double rate = ec_tune_measure(shards, len);
+        if (rate > best) {
+            best = rate;
+            best_threads = t;
+        }
+    }
+
+    ec_set_threads(best_threads);
+
+    printf("Tuned: kernel %s, block size %zu, %d threads, %.0f MB/s.\n",
+           gf_kernel_name(best_kernel), best_block, best_threads, best / 1e6);
+
+    if (path) {
+        FILE * f = fopen(path, "w");
+        if (!f) {
+            printf("Error opening %s.\n", path);
+            rc = -1;
+            goto tune_err;
+        }
+
+        fprintf(f, "k %u\n", ec.k);
+        fprintf(f, "p %u\n", ec.p);
+        fprintf(f, "kernel %s\n", gf_kernel_name(best_kernel));
+        fprintf(f, "block_size %zu\n", best_block);
+        fprintf(f, "threads %d\n", best_threads);
+
+        if (fclose(f)) {
+            printf("Error writing %s.\n", path);
+            rc = -1;
+        }
+    }
+
+tune_err:
+    stream_threshold = saved_threshold;
+    for (int i = 0; i < ec.n; i++)
+        free(shards[i]);
+
+    return rc;
+}
+
+int
+ec_tune_load(const char * path) {
+    char key[32];
+    char value[32];
+    uint32_t k = 0;
+    uint32_t p = 0;
+    int kernel = -1;
+    size_t block = 0;
+    int threads = 0;
+
+    FILE * f = fopen(path, "r");
+    if (!f) {
+        printf("Error opening %s.\n", path);
+        return -1;
+    }
+
+    while (fscanf(f, "%31s %31s", key, value) == 2) {
+        if (!strcmp(key, "k")) {
+            k = atoi(value);
+        } else if (!strcmp(key, "p")) {
+            p = atoi(value);
+        } else if (!strcmp(key, "kernel")) {
+            for (int i = 0; i < GF_KERNEL_NUM; i++)
+                if (!strcmp(value, gf_kernel_name(i)))
+                    kernel = i;
+        } else if (!strcmp(key, "block_size")) {
+            block = strtoul(value, NULL, 10);
+        } else if (!strcmp(key, "threads")) {
+            threads = atoi(value);
+        }
+    }
+
+    fclose(f);
+
+    if (k != ec.k || p != ec.p) {
+        printf("Tuning file %s is for k = %d, p = %d, not k = %d, p = %d.\n",
+               path, k, p, ec.k, ec.p);
+        return -1;
+    }
+
+    // a file from another host may name a kernel this one lacks
+    if (kernel < 0 || gf_kernel_set(kernel))
+        return -1;
+
+    ec_set_block_size(block);
+    ec_set_threads(threads);
+
+    return 0;
+}
+
+void
+ec_parity_acc_free(struct ec_parity_acc * acc) {
+    if (!acc)
+        return;
+
+    if (acc->parity)
+        for (int i = 0; i < ec.p; i++)
+            free(acc->parity[i]);
+
+    free(acc->parity);
+    free(acc->seen);
+    free(acc);
+}
+
+struct ec_parity_acc *
+ec_parity_acc_create(size_t len) {
+    struct ec_parity_acc * acc = calloc(1, sizeof(*acc));
+    if (!acc) {
+        printf("Error allocating memory for parity accumulator.\n");
+        return NULL;
+    }
+
+    acc->len = len;
+    acc->seen = calloc(ec.k, sizeof(*acc->seen));
+    acc->parity = calloc(ec.p, sizeof(*acc->parity));
+    if (!acc->seen || !acc->parity) {
+        printf("Error allocating memory for parity accumulator.\n");
+        ec_parity_acc_free(acc);
+        return NULL;
+    }
+
+    // parity of nothing is zero
+    for (int i = 0; i < ec.p; i++) {
+        acc->parity[i] = calloc(len ? len : 1, 1);
+        if (!acc->parity[i]) {
+            printf("Error allocating memory for parity accumulator.\n");
+            ec_parity_acc_free(acc);
+            return NULL;
+        }
+    }
+
+    return acc;
+}
+
+int
+ec_parity_accumulate(struct ec_parity_acc * acc,
+                     int shard_index,
+                     const uint8_t * data,
+                     size_t len) {
+    if (shard_index < 0 || shard_index >= ec.k || len != acc->len) {
+        printf("Invalid shard %d of %zu bytes to accumulate.\n",
+               shard_index, len);
+        return -1;
+    }
+
+    if (acc->seen[shard_index]) {
+        printf("Shard %d already accumulated.\n", shard_index);
+        return -1;
+    }
+
+    // column shard_index of the parity rows is this shard's contribution
+    for (size_t off = 0; off < len; off += region_block) {
+        size_t blk = (len - off < region_block) ? len - off : region_block;
+
+        for (int i = 0; i < ec.p; i++)
+            gf_region_mult_add(&acc->parity[i][off], &data[off],
+                               ec.matrix->v[(ec.k + i) * ec.k + shard_index],
+                               blk);
+    }
+
+    acc->seen[shard_index] = 1;
+
+    return 0;
+}
+
+int
+ec_parity_acc_merge(struct ec_parity_acc * dst, struct ec_parity_acc * src) {
+    if (dst->len != src->len) {
+        printf("Cannot merge parity accumulators of different lengths.\n");
+        return -1;
+    }
+
+    for (int j = 0; j < ec.k; j++) {
+        if (dst->seen[j] && src->seen[j]) {
+            printf("Shard %d accumulated twice.\n", j);
+            return -1;
+        }
+    }
+
+    // the code is linear, so partial parities just add up
+    for (int i = 0; i < ec.p; i++)
+        gf_region_mult_add(dst->parity[i], src->parity[i], 1, dst->len);
+
+    for (int j = 0; j < ec.k; j++)
+        dst->seen[j] |= src->seen[j];
+
+    return 0;
+}
+
+int
+ec_parity_acc_merge_tree(struct ec_parity_acc ** accs, int count) {
+    // merge neighbours, then neighbours of the results, and so on; the
+    // merges of one level touch disjoint accumulators
+    for (int stride = 1; stride < count; stride *= 2)
+        for (int i = 0; i + stride < count; i += 2 * stride)
+            if (ec_parity_acc_merge(accs[i], accs[i + stride]))
+                return -1;
+
+    return 0;
+}
+
+int
+ec_parity_finalize(struct ec_parity_acc * acc, uint8_t ** parity) {
+    for (int j = 0; j < ec.k; j++) {
+        if (!acc->seen[j]) {
+            printf("Shard %d has not been accumulated.\n", j);
+            return -1;
+        }
+    }
+
+    if (parity)
+        for (int i = 0; i < ec.p; i++)
+            memcpy(parity[i], acc->parity[i], acc->len);
+
+    return 0;
 }
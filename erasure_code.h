@@ -1,10 +1,67 @@
 #ifndef ERASURE_CODE_H
 #define ERASURE_CODE_H
 
+#include <stddef.h>
 #include <stdint.h>
 
+#include "gf_base2.h"
+
+/*
+ * Partial parity of a stripe, built up one data shard at a time.  Created by
+ * ec_parity_acc_create(), freed by ec_parity_acc_free().
+ */
+struct ec_parity_acc {
+    uint8_t ** parity;  // p partial parity shards
+    size_t len;         // length of each shard in bytes
+    uint8_t * seen;     // k flags, non-zero for shards accumulated so far
+};
+
+/*
+ * Which shards to read for a degraded read, and how to decode them.  Created
+ * by ec_plan_decode(), freed by ec_plan_free().
+ */
+struct ec_decode_plan {
+    int * indices;              // k shard indices to read, in input order
+    struct gf_matrix * matrix;  // k x k decode matrix for those shards
+    uint32_t cost;              // total cost of reading the shards
+    int reconstruct;            // number of data shards that must be computed
+};
+
+/*
+ * Layout of an object encoded by ec_encode_object(), to be stored with its
+ * shards.  Data shard i holds bytes [i * shard_len, (i + 1) * shard_len) of
+ * the object; bytes past the end of the object are implicit zeros that are
+ * never stored or copied.
+ */
+struct ec_object_meta {
+    uint64_t length;    // logical length of the object in bytes
+    size_t shard_len;   // length of each shard in bytes
+};
+
 /*
- * Initialize erasure code encoder/decoder
+ * How the encoding matrix is constructed
+ */
+enum ec_matrix_type {
+    EC_MATRIX_VANDERMONDE,  // Vandermonde, column-reduced to systematic form
+    EC_MATRIX_CAUCHY,       // identity over a Cauchy matrix
+    EC_MATRIX_RS,           // identity over powers of 2; not always MDS
+    EC_MATRIX_CAUCHY_OPT,   // Cauchy scaled to maximize 1s and cut XORs
+    EC_MATRIX_AUTO,         // the MDS type with the fewest XORs
+};
+
+/*
+ * Encoding cost of a matrix type, see ec_matrix_cost()
+ */
+struct ec_matrix_cost {
+    int ones;       // parity coefficients equal to 1, i.e. plain XORs
+    int nontrivial; // parity coefficients other than 0 and 1
+    int xors;       // XORs per byte of each shard with bit-matrix encoding
+    int mds;        // non-zero if any k shards are guaranteed to decode
+};
+
+/*
+ * Initialize erasure code encoder/decoder with a Vandermonde matrix.  Tuning
+ * follows EC_TUNING_FILE as for ec_init_matrix().
  *
  * k (IN):  number of input bytes to encode at a time
  * p (IN):  number of parity bytes to generate from the k input bytes
@@ -13,6 +70,67 @@
  */
 int ec_init(const uint32_t k, const uint32_t p);
 
+/*
+ * Initialize erasure code encoder/decoder with the given type of encoding
+ * matrix.  If the EC_TUNING_FILE environment variable is set, the tuning in
+ * that file is applied; if the file does not exist, ec_tune() first
+ * benchmarks the host for about a second and writes it.
+ *
+ * k (IN):    number of input bytes to encode at a time
+ * p (IN):    number of parity bytes to generate from the k input bytes
+ * type (IN): matrix construction, or EC_MATRIX_AUTO to pick the cheapest
+ *            MDS one by ec_matrix_cost()
+ *
+ * returns: 0 if success, non-zero if failed
+ */
+int ec_init_matrix(const uint32_t k, const uint32_t p, enum ec_matrix_type type);
+
+/*
+ * Report how expensive encoding with a matrix type would be for k and p
+ *
+ * type (IN):  matrix construction, not EC_MATRIX_AUTO
+ * k (IN):     number of input bytes
+ * p (IN):     number of parity bytes
+ * cost (OUT): coefficient and XOR counts of the parity rows
+ *
+ * returns: 0 if success, non-zero if failed
+ */
+int ec_matrix_cost(enum ec_matrix_type type,
+                   const uint32_t k,
+                   const uint32_t p,
+                   struct ec_matrix_cost * cost);
+
+/*
+ * Initialize erasure code encoder/decoder from a context file written by
+ * ec_save().  The file is mmap'ed, so startup skips generating the GF tables,
+ * the encoding matrix and the decode matrices it holds.
+ *
+ * path (IN): context file
+ *
+ * returns: 0 if success, non-zero if failed
+ */
+int ec_init_from_file(const char * path);
+
+/*
+ * Save the encoding matrix and a decode cache warmed with all single and
+ * double failures to a file, to be loaded with ec_init_from_file().  For
+ * wide codes the decode cache is capped in size; failures that do not fit
+ * are decoded on demand after loading.
+ *
+ * path (IN): context file to write
+ *
+ * returns: 0 if success, non-zero if failed
+ */
+int ec_save(const char * path);
+
+/*
+ * Get the k and p the encoder/decoder was initialized with
+ *
+ * k (OUT): number of input bytes, may be NULL
+ * p (OUT): number of parity bytes, may be NULL
+ */
+void ec_get_params(uint32_t * k, uint32_t * p);
+
 /*
  * Cleans up the erasure code encoder/decoder
  */
@@ -48,4 +166,368 @@ int ec_encode(uint8_t * input, uint8_t * parity);
  */
 int ec_decode(uint8_t * input, int * indices, uint8_t * result);
 
+/*
+ * Set the block size region operations work in.  Each block of every input
+ * shard is loaded once and applied to all outputs while it is in cache, so
+ * (outputs + 1) blocks should fit in L1 or L2.  Default is 4 KiB.
+ *
+ * size (IN): block size in bytes, 0 for the default
+ */
+void ec_set_block_size(size_t size);
+
+/*
+ * Set the shard length at and above which region operations stream: outputs
+ * are written with non-temporal stores and inputs are prefetched, so large
+ * rebuilds do not flush the cache for everything else on the host.  Default
+ * is 4 MiB.
+ *
+ * len (IN): shard length in bytes, SIZE_MAX to never stream
+ */
+void ec_set_stream_threshold(size_t len);
+
+/*
+ * Set the number of threads large region operations are split across.
+ * Default is 1.  The worker threads are started here and kept until the
+ * count is changed again; do not call it while region operations run.
+ */
+void ec_set_threads(int threads);
+
+/*
+ * Pick the fastest GF kernel, region block size and thread count for the
+ * current k and p by benchmarking region encoding, apply them, and save them
+ * to a tuning file if path is not NULL.  ec_init() does this automatically
+ * when the EC_TUNING_FILE environment variable names a file that does not
+ * exist yet, and loads the file when it does.
+ *
+ * returns: 0 if success, non-zero if failed
+ */
+int ec_tune(const char * path);
+
+/*
+ * Apply the settings in a tuning file written by ec_tune().  The file must
+ * have been tuned for the current k and p.
+ *
+ * returns: 0 if success, non-zero if failed
+ */
+int ec_tune_load(const char * path);
+
+/*
+ * Generate parity shards for k data shards.  This is ec_encode() applied to
+ * every byte position of the shards.
+ *
+ * data (IN):    array of k pointers to data shards
+ * parity (OUT): array of p pointers to parity shards
+ * len (IN):     length of each shard in bytes
+ * crc (OUT):    optional array of n CRC32C checksums, one per data shard
+ *               followed by one per parity shard, computed in the same pass
+ *               as the encoding.  NULL to skip checksumming.
+ *
+ * returns: 0 if success, non-zero if failed
+ */
+int ec_encode_region(uint8_t ** data,
+                     uint8_t ** parity,
+                     size_t len,
+                     uint32_t * crc);
+
+/*
+ * Generate parity for many small stripes in one call.  Stripes are packed
+ * shard by shard into a per-thread staging area so the GF kernels run over
+ * long regions regardless of the stripe size, then parity is copied out.
+ *
+ * data (IN):    array of count stripes, each an array of k pointers to data
+ *               shards
+ * parity (OUT): array of count stripes, each an array of p pointers to parity
+ *               shards
+ * count (IN):   number of stripes
+ * len (IN):     length of each shard in bytes, the same for every stripe
+ *
+ * returns: 0 if success, non-zero if failed
+ */
+int ec_encode_region_batch(uint8_t *** data,
+                           uint8_t *** parity,
+                           int count,
+                           size_t len);
+
+/*
+ * Split a byte-interleaved buffer into shards: byte i of row r, at
+ * src[r * count + i], becomes byte r of shards[i].  This is the layout of the
+ * input to ec_encode(), one row per byte column.
+ *
+ * src (IN):     len rows of count bytes each
+ * count (IN):   number of shards
+ * shards (OUT): array of count pointers to shards of len bytes
+ * len (IN):     number of rows, i.e. the length of each shard
+ */
+void ec_deinterleave(const uint8_t * src,
+                     int count,
+                     uint8_t ** shards,
+                     size_t len);
+
+/*
+ * The reverse of ec_deinterleave(): gather count shards into len rows of
+ * count bytes each.
+ *
+ * shards (IN): array of count pointers to shards of len bytes
+ * count (IN):  number of shards
+ * dst (OUT):   len rows of count bytes each
+ * len (IN):    length of each shard
+ */
+void ec_interleave(uint8_t ** shards,
+                   int count,
+                   uint8_t * dst,
+                   size_t len);
+
+/*
+ * Generate parity for byte-interleaved data, the layout of ec_encode() over
+ * many byte columns at once.  Rows are transposed a block at a time into a
+ * per-thread staging area, encoded with the region kernels and transposed
+ * back, so the caller needs no shard buffers of its own.
+ *
+ * data (IN):    len rows of k data bytes each
+ * parity (OUT): len rows of p parity bytes each
+ * len (IN):     number of rows
+ *
+ * returns: 0 if success, non-zero if failed
+ */
+int ec_encode_interleaved(const uint8_t * data, uint8_t * parity, size_t len);
+
+/*
+ * Check that the parity shards match the data shards, e.g. when scrubbing.
+ * Parity is recomputed a small block at a time and compared as it goes, so no
+ * parity buffers are allocated, and checking stops at the first mismatch.
+ *
+ * data (IN):        array of k pointers to data shards
+ * parity (IN):      array of p pointers to the stored parity shards
+ * len (IN):         length of each shard in bytes
+ * bad_offset (OUT): optional, byte offset of the first mismatch
+ * bad_row (OUT):    optional, parity shard (0..p-1) of the first mismatch
+ *
+ * returns: 0 if parity matches, 1 if a mismatch was found
+ */
+int ec_verify(uint8_t ** data,
+              uint8_t ** parity,
+              size_t len,
+              size_t * bad_offset,
+              int * bad_row);
+
+/*
+ * Recover k data shards from any k shards.  This is ec_decode() applied to
+ * every byte position of the shards.
+ *
+ * input (IN):   array of k pointers to shards, data or parity
+ * indices (IN): array of k indices from 0..(n-1) of the input shards
+ * result (OUT): array of k pointers to hold the recovered data shards
+ * len (IN):     length of each shard in bytes
+ * crc (OUT):    optional array of 2k CRC32C checksums, one per input shard
+ *               followed by one per recovered shard, computed in the same
+ *               pass as the decoding.  NULL to skip checksumming.
+ *
+ * returns: 0 if success, non-zero if failed
+ */
+int ec_decode_region(uint8_t ** input,
+                     int * indices,
+                     uint8_t ** result,
+                     size_t len,
+                     uint32_t * crc);
+
+/*
+ * Choose the cheapest k shards to decode from.  At equal cost, data shards are
+ * preferred over parity shards since they are copied rather than computed.
+ *
+ * available (IN): array of indices 0..(n-1) of the shards that can be read
+ * cost (IN):      array of the cost of reading each available shard (e.g.
+ *                 remote vs local, busy disk), or NULL if all cost the same
+ * count (IN):     number of available shards, at least k
+ *
+ * returns: decode plan with the cached decode matrix, or NULL if failed
+ */
+struct ec_decode_plan * ec_plan_decode(const int * available,
+                                       const uint32_t * cost,
+                                       int count);
+
+void ec_plan_free(struct ec_decode_plan * plan);
+
+/*
+ * Recover the data shards of many stripes that lost the same shards, e.g.
+ * every stripe on a failed drive.  The decode matrix is computed once for the
+ * whole batch.
+ *
+ * input (IN):   array of count stripes, each an array of k pointers to shards
+ * indices (IN): array of k indices from 0..(n-1) of the input shards, the
+ *               same for every stripe
+ * result (OUT): array of count stripes, each an array of k pointers to hold
+ *               the recovered data shards
+ * count (IN):   number of stripes
+ * len (IN):     length of each shard in bytes
+ *
+ * returns: 0 if success, non-zero if failed
+ */
+int ec_decode_region_batch(uint8_t *** input,
+                           int * indices,
+                           uint8_t *** result,
+                           int count,
+                           size_t len);
+
+/*
+ * Rebuild erased shards in place.  The first k surviving shards are decoded
+ * straight into the erased slots, data or parity, so survivors do not need to
+ * be gathered into a separate input array and are left untouched.
+ *
+ * shards (IN/OUT): array of n pointers to shards; erased ones are overwritten
+ * erased (IN):     array of n flags, non-zero for erased shards
+ * len (IN):        length of each shard in bytes
+ *
+ * returns: 0 if success, non-zero if failed (e.g. more than p erasures)
+ */
+int ec_reconstruct(uint8_t ** shards, const uint8_t * erased, size_t len);
+
+/*
+ * ec_reconstruct() for many stripes with the same erasures, e.g. when
+ * rebuilding a failed disk.  The rebuild matrix is computed once.
+ *
+ * shards (IN/OUT): array of count stripes, each an array of n shard pointers
+ * erased (IN):     array of n flags, the same for every stripe
+ * count (IN):      number of stripes
+ * len (IN):        length of each shard in bytes
+ *
+ * returns: 0 if success, non-zero if failed
+ */
+int ec_reconstruct_batch(uint8_t *** shards,
+                         const uint8_t * erased,
+                         int count,
+                         size_t len);
+
+/*
+ * Recover k data shards using a decode plan.  Surviving data shards are
+ * copied (or left alone if result[i] == input[i]); only missing ones are
+ * computed.
+ *
+ * plan (IN):    decode plan from ec_plan_decode()
+ * input (IN):   array of k pointers to the shards listed in plan->indices
+ * result (OUT): array of k pointers to hold the recovered data shards
+ * len (IN):     length of each shard in bytes
+ */
+int ec_decode_plan_region(struct ec_decode_plan * plan,
+                          uint8_t ** input,
+                          uint8_t ** result,
+                          size_t len);
+
+/*
+ * Recover a single data shard using a decode plan, e.g. the part of a lost
+ * shard covered by a range read.  Only that shard is computed.
+ *
+ * plan (IN):    decode plan from ec_plan_decode()
+ * input (IN):   array of k pointers to the shards listed in plan->indices
+ * index (IN):   index 0..(k-1) of the data shard to recover
+ * result (OUT): buffer for the recovered shard
+ * len (IN):     length of each shard in bytes
+ *
+ * returns: 0 if success, non-zero if failed
+ */
+int ec_decode_plan_shard(struct ec_decode_plan * plan,
+                         uint8_t ** input,
+                         int index,
+                         uint8_t * result,
+                         size_t len);
+
+/*
+ * Number of bytes of a shard that are actually stored: shard_len for parity
+ * shards, and the part of the object that falls in the shard for data shards,
+ * which is less than shard_len (possibly 0) at the tail of the object.
+ *
+ * meta (IN):  object layout
+ * index (IN): shard index 0..(n-1)
+ */
+size_t ec_shard_valid_len(const struct ec_object_meta * meta, int index);
+
+/*
+ * Generate parity for a whole object of any length.  The data shards are
+ * slices of the object itself, see struct ec_object_meta; the tail past the
+ * end of the object is treated as zeros inside the kernel rather than padded.
+ *
+ * obj (IN):     the object
+ * len (IN):     length of the object in bytes
+ * parity (OUT): array of p pointers to parity shards of meta->shard_len bytes
+ * meta (OUT):   layout of the object, to be stored with the shards
+ *
+ * returns: 0 if success, non-zero if failed
+ */
+int ec_encode_object(const uint8_t * obj,
+                     uint64_t len,
+                     uint8_t ** parity,
+                     struct ec_object_meta * meta);
+
+/*
+ * Recover a whole object from any k of its shards.  Data shards only need
+ * their ec_shard_valid_len() bytes; only missing data shards are computed,
+ * straight into the object.
+ *
+ * input (IN):   array of k pointers to shards, data or parity
+ * indices (IN): array of k indices from 0..(n-1) of the input shards
+ * meta (IN):    layout of the object from ec_encode_object()
+ * obj (OUT):    buffer of meta->length bytes for the object
+ *
+ * returns: 0 if success, non-zero if failed
+ */
+int ec_decode_object(uint8_t ** input,
+                     int * indices,
+                     const struct ec_object_meta * meta,
+                     uint8_t * obj);
+
+/*
+ * Create an empty parity accumulator for shards of len bytes.
+ *
+ * Parity is linear in the data, so each data shard's contribution can be
+ * added on its own, in any order, as shards arrive.  Shards arriving on
+ * different threads (or nodes) can go into separate accumulators that are
+ * merged at the end.  An accumulator must only be used by one thread at a
+ * time.
+ *
+ * returns: the accumulator, or NULL if failed
+ */
+struct ec_parity_acc * ec_parity_acc_create(size_t len);
+
+void ec_parity_acc_free(struct ec_parity_acc * acc);
+
+/*
+ * Add one data shard's contribution to the parity
+ *
+ * acc (IN/OUT):     accumulator
+ * shard_index (IN): index 0..(k-1) of the data shard
+ * data (IN):        the data shard
+ * len (IN):         length of the shard, must match the accumulator
+ *
+ * returns: 0 if success, non-zero if failed (e.g. shard added twice)
+ */
+int ec_parity_accumulate(struct ec_parity_acc * acc,
+                         int shard_index,
+                         const uint8_t * data,
+                         size_t len);
+
+/*
+ * Add the partial parity of src into dst.  The two must cover disjoint sets
+ * of shards.
+ *
+ * returns: 0 if success, non-zero if failed
+ */
+int ec_parity_acc_merge(struct ec_parity_acc * dst, struct ec_parity_acc * src);
+
+/*
+ * Merge count accumulators pairwise in a tree, into accs[0]
+ *
+ * returns: 0 if success, non-zero if failed
+ */
+int ec_parity_acc_merge_tree(struct ec_parity_acc ** accs, int count);
+
+/*
+ * Check that every data shard was accumulated and copy out the parity
+ *
+ * acc (IN):     accumulator
+ * parity (OUT): array of p pointers to parity shards, or NULL to leave the
+ *               parity in acc->parity only
+ *
+ * returns: 0 if success, non-zero if some shard is missing
+ */
+int ec_parity_finalize(struct ec_parity_acc * acc, uint8_t ** parity);
+
 #endif
@@ -0,0 +1,567 @@
+#ifndef ERASURE_CODE_HPP
+#define ERASURE_CODE_HPP
+
+/*
+ * Header-only C++20 interface.
+ *
+ * ec::Codec<K, P> is self-contained: its GF(2^8) tables and encoding matrix
+ * are generated at compile time, so there is no gf_init()/ec_init() and the
+ * encode loops are specialized for K and P.  Its region kernels use SSSE3
+ * where the CPU has it and 64-bit SWAR elsewhere.  It uses the Cauchy matrix of
+ * EC_MATRIX_CAUCHY, so its shards are interchangeable with the C library's.
+ *
+ * ec::Context is an RAII wrapper of the C library for k and p only known at
+ * run time, with the library's SIMD kernels, decode cache and threading.
+ *
+ * Errors are reported by throwing std::invalid_argument (bad arguments) or
+ * std::runtime_error (the library failed).
+ */
+
+#if __cplusplus < 202002L
+#error "erasure_code.hpp requires C++20 (std::span)"
+#endif
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <stdexcept>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define EC_HPP_HAVE_X86 1
+#include <tmmintrin.h>
+#endif
+
+extern "C" {
+#include "erasure_code.h"
+}
+
+namespace ec {
+
+namespace detail {
+
+// GF(2^8) with g(x) = x^8 + x^4 + x^3 + x + 1, as gf_static_tables.c
+inline constexpr unsigned gf_poly = 283;
+
+constexpr uint8_t
+gf_long_mult(uint8_t x, uint8_t y) {
+    unsigned yy = y;
+    unsigned prod = 0;
+
+    // Multiply
+    while (x) {
+        if (x & 1)
+            prod ^= yy;
+        x >>= 1;
+        yy <<= 1;
+    }
+
+    // Reduce by g(x)
+    for (int i = 6; i >= 0; i--)
+        if (prod & (0x100u << i))
+            prod ^= gf_poly << i;
+
+    return static_cast<uint8_t>(prod);
+}
+
+struct gf_tables {
+    std::array<std::array<uint8_t, 256>, 256> mult;
+    std::array<uint8_t, 256> mult_inv;
+};
+
+/*
+ * x + 1 generates the multiplicative group, so products and inverses come
+ * from exp/log tables; multiplying out all 64K products with gf_long_mult()
+ * would exceed the compilers' constexpr evaluation limits.
+ */
+constexpr gf_tables
+gf_tables_gen() {
+    gf_tables t{};
+    std::array<uint8_t, 255> exp{};
+    std::array<unsigned, 256> log{};
+    uint8_t x = 1;
+
+    for (unsigned i = 0; i < 255; i++) {
+        exp[i] = x;
+        log[x] = i;
+        x = gf_long_mult(x, 3);
+    }
+
+    // rows and columns for 0 stay 0
+    for (unsigned row = 1; row < 256; row++)
+        for (unsigned col = 1; col < 256; col++)
+            t.mult[row][col] = exp[(log[row] + log[col]) % 255];
+
+    // mult. inverse for 0 is undefined
+    for (unsigned i = 1; i < 256; i++)
+        t.mult_inv[i] = exp[(255 - log[i]) % 255];
+
+    return t;
+}
+
+inline constexpr gf_tables gf = gf_tables_gen();
+
+// products of each constant with the low and the high nibbles
+constexpr std::array<std::array<std::array<uint8_t, 16>, 2>, 256>
+gf_nibbles_gen() {
+    std::array<std::array<std::array<uint8_t, 16>, 2>, 256> t{};
+
+    for (unsigned c = 0; c < 256; c++) {
+        for (unsigned j = 0; j < 16; j++) {
+            t[c][0][j] = gf.mult[c][j];
+            t[c][1][j] = gf.mult[c][j << 4];
+        }
+    }
+
+    return t;
+}
+
+inline constexpr auto gf_nibbles = gf_nibbles_gen();
+
+// region block size of the encode loops, as EC_REGION_BLOCK
+inline constexpr std::size_t region_block = 4096;
+
+#ifdef EC_HPP_HAVE_X86
+/*
+ * dst ^= c * src, 16 bytes at a time with two 16-entry shuffle lookups, one
+ * per nibble, as gf_region_mult_add_ssse3()
+ *
+ * returns: number of bytes done, the tail is left to the caller
+ */
+__attribute__((target("ssse3")))
+inline std::size_t
+region_mult_add_ssse3(uint8_t * dst, const uint8_t * src, uint8_t c, std::size_t len) {
+    std::size_t i = 0;
+
+    __m128i tbl_lo = _mm_loadu_si128(reinterpret_cast<const __m128i *>(gf_nibbles[c][0].data()));
+    __m128i tbl_hi = _mm_loadu_si128(reinterpret_cast<const __m128i *>(gf_nibbles[c][1].data()));
+    __m128i mask = _mm_set1_epi8(0x0f);
+
+    for (; i + 16 <= len; i += 16) {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+        __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i *>(dst + i));
+        __m128i l = _mm_shuffle_epi8(tbl_lo, _mm_and_si128(x, mask));
+        __m128i h = _mm_shuffle_epi8(tbl_hi,
+                                     _mm_and_si128(_mm_srli_epi64(x, 4), mask));
+        d = _mm_xor_si128(d, _mm_xor_si128(l, h));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), d);
+    }
+
+    return i;
+}
+
+inline bool
+have_ssse3() {
+    static const bool have = __builtin_cpu_supports("ssse3");
+    return have;
+}
+#endif
+
+/*
+ * dst ^= c * src for c > 1, 64 bytes at a time.  Bit b of every byte of a
+ * word is spread into a byte mask that selects c * 2^b, as
+ * gf_region_mult_add_swar(), with no table lookups or data-dependent
+ * branches; compilers turn the eight words into vector code.
+ *
+ * returns: number of bytes done, the tail is left to the caller
+ */
+inline std::size_t
+region_mult_add_swar(uint8_t * dst, const uint8_t * src, uint8_t c, std::size_t len) {
+    constexpr uint64_t ones = 0x0101010101010101ULL;
+    std::array<uint64_t, 8> cb;
+    std::size_t i = 0;
+
+    // c * 2^b in every byte
+    for (unsigned b = 0; b < 8; b++)
+        cb[b] = gf.mult[c][1u << b] * ones;
+
+    for (; i + 64 <= len; i += 64) {
+        uint64_t x[8];
+        uint64_t d[8];
+
+        std::memcpy(x, src + i, sizeof(x));
+        std::memcpy(d, dst + i, sizeof(d));
+
+        for (unsigned b = 0; b < 8; b++) {
+            for (unsigned w = 0; w < 8; w++) {
+                uint64_t bit = (x[w] >> b) & ones;
+                // 0x01 -> 0xff in each byte, without borrows between bytes
+                d[w] ^= ((bit << 8) - bit) & cb[b];
+            }
+        }
+
+        std::memcpy(dst + i, d, sizeof(d));
+    }
+
+    return i;
+}
+
+/*
+ * dst ^= c * src.  c == 1 is a plain XOR, 8 bytes at a time; other constants
+ * use the SSSE3 shuffles where the CPU has them and SWAR elsewhere.  Tails
+ * go through the table.
+ */
+inline void
+region_mult_add(uint8_t * dst, const uint8_t * src, uint8_t c, std::size_t len) {
+    std::size_t i = 0;
+
+    if (c == 0)
+        return;
+
+    if (c == 1) {
+        for (; i + 8 <= len; i += 8) {
+            uint64_t x;
+            uint64_t d;
+
+            std::memcpy(&x, src + i, sizeof(x));
+            std::memcpy(&d, dst + i, sizeof(d));
+            d ^= x;
+            std::memcpy(dst + i, &d, sizeof(d));
+        }
+
+        for (; i < len; i++)
+            dst[i] ^= src[i];
+        return;
+    }
+
+#ifdef EC_HPP_HAVE_X86
+    if (have_ssse3())
+        i = region_mult_add_ssse3(dst, src, c, len);
+    else
+#endif
+        i = region_mult_add_swar(dst, src, c, len);
+
+    const auto & row = gf.mult[c];
+    for (; i < len; i++)
+        dst[i] ^= row[src[i]];
+}
+
+/*
+ * dst = m * src over regions of len bytes, one block at a time so inputs
+ * are read from memory once.  R and C are compile-time, so the row and column
+ * loops unroll.
+ */
+template <std::size_t R, std::size_t C>
+void
+region_mult(const std::array<std::array<uint8_t, C>, R> & m,
+            const std::array<const uint8_t *, C> & src,
+            const std::array<uint8_t *, R> & dst,
+            std::size_t len) {
+    for (std::size_t off = 0; off < len; off += region_block) {
+        std::size_t blk = (len - off < region_block) ? len - off : region_block;
+
+        for (std::size_t i = 0; i < R; i++)
+            std::memset(dst[i] + off, 0, blk);
+
+        for (std::size_t j = 0; j < C; j++)
+            for (std::size_t i = 0; i < R; i++)
+                region_mult_add(dst[i] + off, src[j] + off, m[i][j], blk);
+    }
+}
+
+} // namespace detail
+
+/*
+ * Matrix policy: systematic Cauchy matrix, parity row r (K..K+P-1) and
+ * column c being 1 / (r + c), as cauchy_matrix_gen()
+ */
+struct Cauchy {
+    template <std::size_t K, std::size_t P>
+    static constexpr std::array<std::array<uint8_t, K>, P>
+    parity_rows() {
+        std::array<std::array<uint8_t, K>, P> m{};
+
+        for (std::size_t r = 0; r < P; r++)
+            for (std::size_t c = 0; c < K; c++)
+                m[r][c] = detail::gf.mult_inv[(K + r) ^ c];
+
+        return m;
+    }
+};
+
+template <std::size_t K, std::size_t P, class Matrix = Cauchy>
+class Codec {
+    static_assert(K > 0 && P > 0, "need at least one data and one parity shard");
+    static_assert(K + P <= 256, "GF(2^8) codes have at most 256 shards");
+
+public:
+    static constexpr std::size_t k = K;
+    static constexpr std::size_t p = P;
+    static constexpr std::size_t n = K + P;
+
+    // bottom P rows of the encoding matrix; the top K rows are the identity
+    static constexpr auto parity_matrix = Matrix::template parity_rows<K, P>();
+
+    /*
+     * Generate P parity shards from K data shards, all of the same length
+     */
+    static void
+    encode(std::span<const std::span<const uint8_t>, K> data,
+           std::span<const std::span<uint8_t>, P> parity) {
+        std::size_t len = shard_len(data, parity);
+        std::array<const uint8_t *, K> in;
+        std::array<uint8_t *, P> out;
+
+        for (std::size_t j = 0; j < K; j++)
+            in[j] = data[j].data();
+        for (std::size_t i = 0; i < P; i++)
+            out[i] = parity[i].data();
+
+        detail::region_mult(parity_matrix, in, out, len);
+    }
+
+    /*
+     * Recover the K data shards from any K shards
+     *
+     * input:   K shards, data or parity
+     * indices: shard index 0..n-1 of each input
+     * result:  K buffers for the data shards
+     */
+    static void
+    decode(std::span<const std::span<const uint8_t>, K> input,
+           std::span<const int, K> indices,
+           std::span<const std::span<uint8_t>, K> result) {
+        std::size_t len = shard_len(input, result);
+        std::array<const uint8_t *, K> in;
+        std::array<uint8_t *, K> out;
+
+        for (std::size_t j = 0; j < K; j++)
+            in[j] = input[j].data();
+        for (std::size_t i = 0; i < K; i++)
+            out[i] = result[i].data();
+
+        detail::region_mult(decode_matrix(indices), in, out, len);
+    }
+
+    /*
+     * Rebuild erased shards, data or parity, in place from the first K
+     * survivors, as ec_reconstruct()
+     *
+     * shards: all n shards; erased ones are overwritten
+     * erased: true for each erased shard
+     */
+    static void
+    reconstruct(std::span<const std::span<uint8_t>, n> shards,
+                std::span<const bool, n> erased) {
+        std::array<int, K> indices;
+        std::array<std::span<const uint8_t>, K> survivors;
+        std::size_t have = 0;
+
+        for (std::size_t i = 0; i < n && have < K; i++) {
+            if (erased[i])
+                continue;
+            indices[have] = static_cast<int>(i);
+            survivors[have++] = shards[i];
+        }
+
+        if (have < K)
+            throw std::invalid_argument("fewer than k shards survive");
+
+        std::size_t len = shards[0].size();
+        for (const auto & s : shards)
+            if (s.size() != len)
+                throw std::invalid_argument("shards differ in length");
+
+        auto d = decode_matrix(indices);
+        std::array<const uint8_t *, K> in;
+        std::array<uint8_t, K> row;
+
+        for (std::size_t j = 0; j < K; j++)
+            in[j] = survivors[j].data();
+
+        for (std::size_t i = 0; i < n; i++) {
+            if (!erased[i])
+                continue;
+
+            if (i < K) {
+                row = d[i];
+            } else {
+                // parity row of the encoding matrix applied to the decoded data
+                row.fill(0);
+                for (std::size_t j = 0; j < K; j++)
+                    for (std::size_t c = 0; c < K; c++)
+                        row[c] ^= detail::gf.mult[parity_matrix[i - K][j]][d[j][c]];
+            }
+
+            std::array<std::array<uint8_t, K>, 1> m{row};
+            detail::region_mult(m, in, std::array<uint8_t *, 1>{shards[i].data()}, len);
+        }
+    }
+
+private:
+    template <class In, class Out>
+    static std::size_t
+    shard_len(const In & in, const Out & out) {
+        std::size_t len = in[0].size();
+
+        for (const auto & s : in)
+            if (s.size() != len)
+                throw std::invalid_argument("shards differ in length");
+        for (const auto & s : out)
+            if (s.size() != len)
+                throw std::invalid_argument("shards differ in length");
+
+        return len;
+    }
+
+    /*
+     * Inverse of the rows of the encoding matrix for the given shards, by
+     * Gauss-Jordan elimination
+     */
+    static std::array<std::array<uint8_t, K>, K>
+    decode_matrix(std::span<const int, K> indices) {
+        std::array<std::array<uint8_t, K>, K> a{};
+        std::array<std::array<uint8_t, K>, K> inv{};
+
+        for (std::size_t r = 0; r < K; r++) {
+            int idx = indices[r];
+
+            if (idx < 0 || idx >= static_cast<int>(n))
+                throw std::invalid_argument("shard index out of range");
+
+            if (idx < static_cast<int>(K))
+                a[r][idx] = 1;
+            else
+                a[r] = parity_matrix[idx - K];
+            inv[r][r] = 1;
+        }
+
+        for (std::size_t c = 0; c < K; c++) {
+            std::size_t pivot = c;
+
+            while (pivot < K && !a[pivot][c])
+                pivot++;
+            if (pivot == K)
+                throw std::invalid_argument("shard indices are not independent");
+
+            std::swap(a[c], a[pivot]);
+            std::swap(inv[c], inv[pivot]);
+
+            uint8_t scale = detail::gf.mult_inv[a[c][c]];
+            for (std::size_t j = 0; j < K; j++) {
+                a[c][j] = detail::gf.mult[scale][a[c][j]];
+                inv[c][j] = detail::gf.mult[scale][inv[c][j]];
+            }
+
+            for (std::size_t r = 0; r < K; r++) {
+                uint8_t f = a[r][c];
+
+                if (r == c || !f)
+                    continue;
+
+                for (std::size_t j = 0; j < K; j++) {
+                    a[r][j] ^= detail::gf.mult[f][a[c][j]];
+                    inv[r][j] ^= detail::gf.mult[f][inv[c][j]];
+                }
+            }
+        }
+
+        return inv;
+    }
+};
+
+/*
+ * The C library initialized for k and p, cleaned up on destruction.  The
+ * library has one global configuration, so only one Context may be alive at
+ * a time.
+ */
+class Context {
+public:
+    Context(uint32_t k, uint32_t p, ec_matrix_type type = EC_MATRIX_VANDERMONDE)
+        : k_(k), p_(p) {
+        if (ec_init_matrix(k, p, type))
+            throw std::runtime_error("ec_init_matrix failed");
+    }
+
+    ~Context() {
+        ec_cleanup();
+    }
+
+    Context(const Context &) = delete;
+    Context & operator=(const Context &) = delete;
+
+    uint32_t k() const { return k_; }
+    uint32_t p() const { return p_; }
+
+    /*
+     * ec_encode_region(): k data shards in, p parity shards out
+     */
+    void
+    encode(std::span<const std::span<const uint8_t>> data,
+           std::span<const std::span<uint8_t>> parity) const {
+        check(data.size() == k_ && parity.size() == p_, "need k data and p parity shards");
+
+        std::size_t len = data[0].size();
+        auto in = pointers(data, len);
+        auto out = pointers(parity, len);
+
+        if (ec_encode_region(in.data(), out.data(), len, nullptr))
+            throw std::runtime_error("ec_encode_region failed");
+    }
+
+    /*
+     * ec_decode_region(): any k shards in, the k data shards out
+     */
+    void
+    decode(std::span<const std::span<const uint8_t>> input,
+           std::span<const int> indices,
+           std::span<const std::span<uint8_t>> result) const {
+        check(input.size() == k_ && indices.size() == k_ && result.size() == k_,
+              "need k inputs, indices and results");
+
+        std::size_t len = input[0].size();
+        auto in = pointers(input, len);
+        auto out = pointers(result, len);
+        std::vector<int> idx(indices.begin(), indices.end());
+
+        if (ec_decode_region(in.data(), idx.data(), out.data(), len, nullptr))
+            throw std::runtime_error("ec_decode_region failed");
+    }
+
+    /*
+     * ec_reconstruct(): rebuild the erased shards of all n in place
+     */
+    void
+    reconstruct(std::span<const std::span<uint8_t>> shards,
+                std::span<const bool> erased) const {
+        check(shards.size() == k_ + p_ && erased.size() == k_ + p_,
+              "need n shards and erasure flags");
+
+        std::size_t len = shards[0].size();
+        auto ptrs = pointers(shards, len);
+        std::vector<uint8_t> flags(erased.begin(), erased.end());
+
+        if (ec_reconstruct(ptrs.data(), flags.data(), len))
+            throw std::runtime_error("ec_reconstruct failed");
+    }
+
+private:
+    static void
+    check(bool ok, const char * what) {
+        if (!ok)
+            throw std::invalid_argument(what);
+    }
+
+    // the C API takes non-const pointers but does not write its inputs
+    template <class T>
+    static std::vector<uint8_t *>
+    pointers(std::span<const std::span<T>> shards, std::size_t len) {
+        std::vector<uint8_t *> ptrs;
+
+        for (const auto & s : shards) {
+            check(s.size() == len, "shards differ in length");
+            ptrs.push_back(const_cast<uint8_t *>(s.data()));
+        }
+
+        return ptrs;
+    }
+
+    uint32_t k_;
+    uint32_t p_;
+};
+
+} // namespace ec
+
+#endif /* ERASURE_CODE_HPP */
@@ -0,0 +1,227 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <vector>
+#include "erasure_code.hpp"
+
+#define PROG_NAME "erasure_code_hpp_test"
+
+// not a multiple of any kernel's stride, so every tail path runs
+#define SHARD_LEN (1000)
+
+const char * usage =
+"This program checks that ec::Codec encodes the same parity as the C\n"
+"library's Cauchy matrix, and that it reconstructs every pattern of up to\n"
+"p erased shards, for a few code sizes.\n\n"
+"usage: " PROG_NAME " [seed]\n\n";
+
+struct results {
+    uint64_t passed;
+    uint64_t failed;
+};
+
+static results res;
+
+static void
+check(bool ok, const char * what) {
+    if (ok) {
+        res.passed++;
+    } else {
+        res.failed++;
+        printf("Error: %s\n", what);
+    }
+}
+
+/*
+ * c * src by the table, as the kernels should compute it
+ */
+static void
+mult_add_ref(uint8_t * dst, const uint8_t * src, uint8_t c, std::size_t len) {
+    for (std::size_t i = 0; i < len; i++)
+        dst[i] ^= ec::detail::gf.mult[c][src[i]];
+}
+
+/*
+ * Every kernel the header may pick against the table, for all constants and
+ * at unaligned offsets and odd lengths
+ */
+static void
+check_kernels() {
+    const std::size_t lens[] = {0, 1, 7, 8, 15, 16, 17, 63, 64, 65, 127, 1000};
+    std::vector<uint8_t> src(1024 + 8);
+    std::vector<uint8_t> want(1024 + 8);
+    std::vector<uint8_t> got(1024 + 8);
+
+    for (auto & b : src)
+        b = static_cast<uint8_t>(rand());
+
+    for (unsigned c = 0; c < 256; c++) {
+        for (std::size_t off = 0; off < 8; off++) {
+            for (std::size_t len : lens) {
+                const uint8_t * s = &src[off * 3 % 8];
+                uint8_t * w = &want[off];
+                uint8_t * g = &got[off];
+                std::size_t i = 0;
+
+                for (std::size_t b = 0; b < want.size(); b++)
+                    want[b] = got[b] = static_cast<uint8_t>(b);
+
+                mult_add_ref(w, s, c, len);
+
+                ec::detail::region_mult_add(g, s, c, len);
+                check(want == got, "region_mult_add differs from the table");
+
+                if (c < 2)
+                    continue;
+
+                for (std::size_t b = 0; b < got.size(); b++)
+                    got[b] = static_cast<uint8_t>(b);
+                i = ec::detail::region_mult_add_swar(g, s, c, len);
+                mult_add_ref(&g[i], &s[i], c, len - i);
+                check(want == got, "SWAR kernel differs from the table");
+
+#ifdef EC_HPP_HAVE_X86
+                if (!ec::detail::have_ssse3())
+                    continue;
+
+                for (std::size_t b = 0; b < got.size(); b++)
+                    got[b] = static_cast<uint8_t>(b);
+                i = ec::detail::region_mult_add_ssse3(g, s, c, len);
+                mult_add_ref(&g[i], &s[i], c, len - i);
+                check(want == got, "SSSE3 kernel differs from the table");
+#endif
+            }
+        }
+    }
+}
+
+template <std::size_t K, std::size_t P>
+struct codec_case {
+    using codec = ec::Codec<K, P>;
+
+    std::vector<std::vector<uint8_t>> orig;
+    std::vector<std::vector<uint8_t>> shards;
+    std::array<bool, K + P> erased{};
+
+    static void
+    check(bool ok, const char * what) {
+        if (ok) {
+            res.passed++;
+        } else {
+            res.failed++;
+            printf("Error: %s (k=%zu p=%zu)\n", what, K, P);
+        }
+    }
+
+    /*
+     * Erase the flagged shards, reconstruct and compare
+     */
+    void
+    reconstruct_check() {
+        std::array<std::span<uint8_t>, K + P> all;
+
+        for (std::size_t i = 0; i < K + P; i++) {
+            shards[i] = orig[i];
+            if (erased[i])
+                std::memset(shards[i].data(), 0xa5, SHARD_LEN);
+            all[i] = shards[i];
+        }
+
+        codec::reconstruct(all, erased);
+        check(shards == orig, "reconstruct differs from the encoded shards");
+    }
+
+    /*
+     * All combinations of count erased shards, starting at start
+     */
+    void
+    erase(std::size_t count, std::size_t start) {
+        if (!count) {
+            reconstruct_check();
+            return;
+        }
+
+        for (std::size_t i = start; i + count <= K + P; i++) {
+            erased[i] = true;
+            erase(count - 1, i + 1);
+            erased[i] = false;
+        }
+    }
+
+    void
+    run() {
+        orig.assign(K + P, std::vector<uint8_t>(SHARD_LEN));
+        shards.assign(K + P, std::vector<uint8_t>(SHARD_LEN));
+
+        for (std::size_t i = 0; i < K; i++)
+            for (auto & b : orig[i])
+                b = static_cast<uint8_t>(rand());
+
+        std::array<std::span<const uint8_t>, K> data;
+        std::array<std::span<uint8_t>, P> parity;
+
+        for (std::size_t i = 0; i < K; i++)
+            data[i] = orig[i];
+        for (std::size_t i = 0; i < P; i++)
+            parity[i] = orig[K + i];
+
+        codec::encode(data, parity);
+
+        // the same data through the C library
+        {
+            ec::Context ctx(K, P, EC_MATRIX_CAUCHY);
+            std::vector<std::vector<uint8_t>> lib(P, std::vector<uint8_t>(SHARD_LEN));
+            std::vector<std::span<const uint8_t>> in(data.begin(), data.end());
+            std::vector<std::span<uint8_t>> out(lib.begin(), lib.end());
+
+            ctx.encode(in, out);
+            check(std::equal(lib.begin(), lib.end(), orig.begin() + K),
+                  "parity differs from ec_encode_region()");
+
+            // and the library rebuilds what the codec encoded
+            std::vector<std::span<uint8_t>> all;
+            bool flags[K + P] = {};
+
+            for (std::size_t i = 0; i < K + P; i++) {
+                shards[i] = orig[i];
+                all.push_back(shards[i]);
+            }
+            for (std::size_t i = 0; i < P; i++) {
+                flags[i * 2 % (K + P)] = true;
+                std::memset(shards[i * 2 % (K + P)].data(), 0, SHARD_LEN);
+            }
+
+            ctx.reconstruct(all, std::span<const bool>(flags, K + P));
+            check(shards == orig, "ec_reconstruct() differs from the codec");
+        }
+
+        for (std::size_t count = 1; count <= P; count++)
+            erase(count, 0);
+    }
+};
+
+int main(int argc, char* argv[]) {
+    if (argc > 2) {
+        printf("Requires 0 or 1 parameters.\n\n");
+        printf("%s\n\n", usage);
+        exit(1);
+    }
+
+    srand((argc == 2) ? atoi(argv[1]) : time(NULL));
+
+    try {
+        check_kernels();
+        codec_case<4, 2>().run();
+        codec_case<6, 3>().run();
+        codec_case<10, 4>().run();
+    } catch (const std::exception & e) {
+        printf("Error: %s\n", e.what());
+        res.failed++;
+    }
+
+    printf("Results: %lu of %lu passed.\n", res.passed, res.passed + res.failed);
+
+    return res.failed ? 1 : 0;
+}
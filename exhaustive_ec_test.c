@@ -1,9 +1,25 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
 #include <pthread.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
 #include <time.h>
 #include <unistd.h>
+#include "crc32c.h"
+#include "ec_async.h"
+#include "ec_rebuild.h"
+#include "ec_store.h"
+#include "ec_stream.h"
+#include "ecd_client.h"
 #include "erasure_code.h"
+#include "gf_base2.h"
 #include "queue.h"
 
 #define PROG_NAME "exhaustive_ec_test"
@@ -12,12 +28,32 @@
 #define QUEUE_TIMEOUT_S (1)
 #define STATUS_INTERVAL_S (2)
 
+// shard length of the functional checks; not a multiple of any kernel's
+// stride or of the region block, so every tail path runs
+#define CHECK_LEN (5000)
+#define CHECK_STRIPES (5)
+#define CHECK_OBJ_SHARD_MAX (40)
+#define CHECK_ECD_PATH "./ecd"
+#define CHECK_ECD_WAIT_MS (5000)
+// not a multiple of the store's CRC block
+#define CHECK_STORE_SHARD (4096 + 100)
+#define CHECK_STORE_READS (100)
+
 const char * usage = 
 "This program tests Erasure Code decoding for all combinations of bytes lost.\n\n"
-"usage: " PROG_NAME " k p l\n"
+"usage: " PROG_NAME " k p [matrix]\n"
 "k: number of randomly generated input bytes\n"
 "p: number of parity bytes to generate\n"
-"Example: " PROG_NAME " 4 2\n\n";
+"matrix: vandermonde (default), cauchy, rs, cauchy_opt or auto\n"
+"Example: " PROG_NAME " 4 2 cauchy\n\n";
+
+const char * matrix_names[] = {
+    [EC_MATRIX_VANDERMONDE] = "vandermonde",
+    [EC_MATRIX_CAUCHY] = "cauchy",
+    [EC_MATRIX_RS] = "rs",
+    [EC_MATRIX_CAUCHY_OPT] = "cauchy_opt",
+    [EC_MATRIX_AUTO] = "auto",
+};
 
 const char * mem_err = "Error allocating memory.";
 
@@ -150,9 +186,16 @@ void * decode_one(void * arg) {
     int * recv_idx = 0;
     uint8_t * to_decode = 0;
     uint8_t * decoded = 0;
+    uint8_t * rebuilt = 0;
+    uint8_t ** shards = 0;
+    uint8_t * erased = 0;
+    uint32_t n = 0;
 
     printf("Starting thread...\n");
 
+    ec_get_params(NULL, &n);
+    n += thread_data.k;
+
     recv_idx = malloc(sizeof(*recv_idx) * thread_data.k);
     if (!recv_idx) {
         printf("%s\n", mem_err);
@@ -171,6 +214,17 @@ void * decode_one(void * arg) {
         goto decode_one_err;
     }
 
+    rebuilt = malloc(sizeof(*rebuilt) * n);
+    shards = malloc(sizeof(*shards) * n);
+    erased = malloc(sizeof(*erased) * n);
+    if (!rebuilt || !shards || !erased) {
+        printf("%s\n", mem_err);
+        goto decode_one_err;
+    }
+
+    for (i = 0; i < n; i++)
+        shards[i] = &rebuilt[i];
+
     while (1) {
         int rc = 0;
         struct timespec ts;
@@ -215,6 +269,24 @@ void * decode_one(void * arg) {
             }
         }
 
+        if (!rc) {
+            // Rebuild everything that was not received in place
+            memset(erased, 1, n);
+            memset(rebuilt, 0, n);
+            for (i = 0; i < thread_data.k; i++) {
+                erased[recv_idx[i]] = 0;
+                rebuilt[recv_idx[i]] = ec_code[recv_idx[i]];
+            }
+
+            rc = ec_reconstruct(shards, erased, 1);
+            if (rc) {
+                printf("Reconstruct failed\n");
+            } else if (memcmp(rebuilt, ec_code, n)) {
+                printf("Error: Incorrect reconstructed data\n");
+                rc = 1;
+            }
+        }
+
         pthread_mutex_lock(&res.lock);
         if (rc) {
             res.failed++;
@@ -225,6 +297,9 @@ void * decode_one(void * arg) {
     } // while (1)
 
 decode_one_err:
+    free(erased);
+    free(shards);
+    free(rebuilt);
     free(decoded);
     free(to_decode);
     free(recv_idx);
@@ -238,6 +313,1716 @@ void rand_data_gen(uint8_t * data, size_t len) {
         data[i] = (uint8_t) (rand() % (UINT8_MAX + 1));
 }
 
+/*
+ * Results of the functional checks run before the exhaustive decode
+ */
+struct results checks;
+
+void check(int ok, const char * what) {
+    if (ok) {
+        checks.passed++;
+    } else {
+        checks.failed++;
+        printf("Error: %s\n", what);
+    }
+}
+
+/*
+ * Every region kernel against the table kernel, for all constants, at
+ * unaligned offsets and odd lengths.  The whole destination is compared so
+ * writes past the end are caught too.
+ */
+void check_kernels() {
+    const size_t lens[] = {0, 1, 7, 8, 15, 16, 17, 63, 64, 65, 127, 1000, 4097};
+    const size_t max_len = 4097 + 8;
+    enum gf_kernel saved = gf_kernel_get();
+    uint8_t * src = malloc(max_len);
+    uint8_t * ref = malloc(max_len);
+    uint8_t * dst = malloc(max_len);
+
+    if (!src || !ref || !dst) {
+        printf("%s\n", mem_err);
+        check(0, "kernel check setup");
+        goto check_kernels_err;
+    }
+
+    // both destinations stay equal as long as the kernels agree
+    for (size_t i = 0; i < max_len; i++) {
+        src[i] = (uint8_t) rand();
+        ref[i] = dst[i] = (uint8_t) rand();
+    }
+
+    for (enum gf_kernel k = 0; k < GF_KERNEL_NUM; k++) {
+        uint64_t failed = checks.failed;
+
+        if (k == GF_KERNEL_TABLE || !gf_kernel_supported(k))
+            continue;
+
+        for (int c = 0; c <= UINT8_MAX; c++) {
+            for (int off = 0; off < 8; off++) {
+                for (int l = 0; l < sizeof(lens) / sizeof(lens[0]); l++) {
+                    int src_off = (off * 3) % 8;
+
+                    gf_kernel_set(GF_KERNEL_TABLE);
+                    gf_region_mult_add(&ref[off], &src[src_off], c, lens[l]);
+
+                    gf_kernel_set(k);
+                    gf_region_mult_add(&dst[off], &src[src_off], c, lens[l]);
+
+                    if (memcmp(ref, dst, max_len)) {
+                        printf("Kernel %s differs: c = %02x, offset %d, "
+                               "length %zu\n", gf_kernel_name(k), c, off, lens[l]);
+                        memcpy(dst, ref, max_len);
+                        check(0, "region kernel mismatch");
+                    } else {
+                        check(1, NULL);
+                    }
+                }
+            }
+        }
+
+        printf("Kernel %s: %s.\n", gf_kernel_name(k),
+               (checks.failed == failed) ? "matches table" : "MISMATCH");
+    }
+
+check_kernels_err:
+    gf_kernel_set(saved);
+    free(dst);
+    free(ref);
+    free(src);
+}
+
+/*
+ * Allocate count shards of len bytes filled with random data
+ */
+uint8_t ** shards_alloc(int count, size_t len) {
+    uint8_t ** shards = calloc(count, sizeof(*shards));
+
+    if (!shards)
+        return NULL;
+
+    for (int i = 0; i < count; i++) {
+        shards[i] = malloc(len ? len : 1);
+        if (!shards[i]) {
+            for (int j = 0; j < i; j++)
+                free(shards[j]);
+            free(shards);
+            return NULL;
+        }
+
+        for (size_t b = 0; b < len; b++)
+            shards[i][b] = (uint8_t) rand();
+    }
+
+    return shards;
+}
+
+void shards_free(uint8_t ** shards, int count) {
+    for (int i = 0; shards && i < count; i++)
+        free(shards[i]);
+    free(shards);
+}
+
+/*
+ * The CRCs computed along with ec_encode_region() and ec_decode_region()
+ * against a separate crc32c() pass over each shard
+ */
+void check_crc(uint32_t k, uint32_t p) {
+    uint32_t n = k + p;
+    uint8_t ** shards = shards_alloc(n, CHECK_LEN);
+    uint8_t ** result = shards_alloc(k, CHECK_LEN);
+    uint8_t ** input = calloc(k, sizeof(*input));
+    int * indices = calloc(k, sizeof(*indices));
+    uint32_t * crc = calloc(2 * n, sizeof(*crc));
+
+    if (!shards || !result || !input || !indices || !crc) {
+        printf("%s\n", mem_err);
+        check(0, "CRC check setup");
+        goto check_crc_err;
+    }
+
+    check(!ec_encode_region(shards, &shards[k], CHECK_LEN, crc),
+          "ec_encode_region() with CRCs failed");
+    for (int i = 0; i < n; i++)
+        check(crc[i] == crc32c(0, shards[i], CHECK_LEN),
+              "ec_encode_region() CRC differs from crc32c()");
+
+    // decode from the last k shards, so parity is used where there is any
+    for (int i = 0; i < k; i++) {
+        indices[i] = p + i;
+        input[i] = shards[p + i];
+    }
+
+    check(!ec_decode_region(input, indices, result, CHECK_LEN, crc),
+          "ec_decode_region() with CRCs failed");
+    for (int i = 0; i < k; i++) {
+        check(crc[i] == crc32c(0, input[i], CHECK_LEN),
+              "ec_decode_region() input CRC differs from crc32c()");
+        check(crc[k + i] == crc32c(0, shards[i], CHECK_LEN),
+              "ec_decode_region() result CRC differs from crc32c()");
+        check(!memcmp(result[i], shards[i], CHECK_LEN),
+              "ec_decode_region() with CRCs decoded wrong data");
+    }
+
+check_crc_err:
+    free(crc);
+    free(indices);
+    free(input);
+    shards_free(result, k);
+    shards_free(shards, n);
+}
+
+/*
+ * Encode data and decode it back from the last k shards with the region
+ * settings in effect.  crc gets the n encode CRCs followed by the 2k decode
+ * CRCs.
+ *
+ * returns: 0 if success, non-zero if failed
+ */
+int region_roundtrip(uint32_t k,
+                     uint32_t p,
+                     uint8_t ** data,
+                     size_t len,
+                     uint8_t ** parity,
+                     uint8_t ** result,
+                     uint32_t * crc) {
+    uint8_t * input[k];
+    int indices[k];
+
+    if (ec_encode_region(data, parity, len, crc))
+        return -1;
+
+    for (int i = 0; i < k; i++) {
+        indices[i] = p + i;
+        input[i] = (p + i < k) ? data[p + i] : parity[p + i - k];
+    }
+
+    return ec_decode_region(input, indices, result, len, &crc[k + p]);
+}
+
+/*
+ * Region operations streaming from a low threshold give the same parity,
+ * decoded data and CRCs as the cached path, at lengths around the threshold
+ * that are not multiples of any kernel's stride
+ */
+void check_stream_threshold(uint32_t k, uint32_t p) {
+    const size_t lens[] = {1, 4095, 4096, 4097, CHECK_LEN + 3, 65537};
+    const size_t max_len = 65537;
+    uint32_t n = k + p;
+    uint8_t ** data = shards_alloc(k, max_len);
+    uint8_t ** parity = shards_alloc(2 * p, max_len);
+    uint8_t ** result = shards_alloc(2 * k, max_len);
+    uint32_t * crc = calloc(2 * (n + 2 * k), sizeof(*crc));
+
+    if (!data || !parity || !result || !crc) {
+        printf("%s\n", mem_err);
+        check(0, "stream threshold check setup");
+        goto check_stream_threshold_err;
+    }
+
+    for (int l = 0; l < sizeof(lens) / sizeof(lens[0]); l++) {
+        size_t len = lens[l];
+        uint32_t * ref_crc = crc;
+        uint32_t * stream_crc = &crc[n + 2 * k];
+
+        ec_set_stream_threshold(SIZE_MAX);
+        check(!region_roundtrip(k, p, data, len, parity, result, ref_crc),
+              "cached region round-trip failed");
+
+        ec_set_stream_threshold(4096);
+        check(!region_roundtrip(k, p, data, len, &parity[p], &result[k], stream_crc),
+              "streaming region round-trip failed");
+
+        for (int i = 0; i < p; i++)
+            check(!memcmp(parity[i], parity[p + i], len),
+                  "streaming parity differs from the cached path");
+        for (int i = 0; i < k; i++)
+            check(!memcmp(result[k + i], data[i], len)
+                  && !memcmp(result[i], data[i], len),
+                  "streaming decode differs from the cached path");
+        check(!memcmp(ref_crc, stream_crc, (n + 2 * k) * sizeof(*crc)),
+              "streaming CRCs differ from the cached path");
+    }
+
+check_stream_threshold_err:
+    // the documented default
+    ec_set_stream_threshold(4 * 1024 * 1024);
+    free(crc);
+    shards_free(result, 2 * k);
+    shards_free(parity, 2 * p);
+    shards_free(data, k);
+}
+
+/*
+ * Region operations in blocks of 1 byte, of 3000 bytes and back at the
+ * default after ec_set_block_size(0) give the output of the default block
+ * size
+ */
+void check_block_size(uint32_t k, uint32_t p) {
+    const size_t sizes[] = {1, 3000, 0};
+    const size_t lens[] = {1, 2999, 3001, CHECK_LEN + 3};
+    const size_t max_len = CHECK_LEN + 3;
+    uint32_t n = k + p;
+    uint8_t ** data = shards_alloc(k, max_len);
+    uint8_t ** parity = shards_alloc(2 * p, max_len);
+    uint8_t ** result = shards_alloc(2 * k, max_len);
+    uint32_t * crc = calloc(2 * (n + 2 * k), sizeof(*crc));
+
+    if (!data || !parity || !result || !crc) {
+        printf("%s\n", mem_err);
+        check(0, "block size check setup");
+        goto check_block_size_err;
+    }
+
+    for (int l = 0; l < sizeof(lens) / sizeof(lens[0]); l++) {
+        size_t len = lens[l];
+        uint32_t * ref_crc = crc;
+        uint32_t * blk_crc = &crc[n + 2 * k];
+
+        ec_set_block_size(0);
+        check(!region_roundtrip(k, p, data, len, parity, result, ref_crc),
+              "region round-trip failed");
+
+        for (int b = 0; b < sizeof(sizes) / sizeof(sizes[0]); b++) {
+            ec_set_block_size(sizes[b]);
+            check(!region_roundtrip(k, p, data, len, &parity[p], &result[k], blk_crc),
+                  "region round-trip with a block size failed");
+
+            for (int i = 0; i < p; i++)
+                check(!memcmp(parity[i], parity[p + i], len),
+                      "parity differs with the block size");
+            for (int i = 0; i < k; i++)
+                check(!memcmp(result[k + i], data[i], len)
+                      && !memcmp(result[i], data[i], len),
+                      "decode differs with the block size");
+            check(!memcmp(ref_crc, blk_crc, (n + 2 * k) * sizeof(*crc)),
+                  "CRCs differ with the block size");
+        }
+    }
+
+check_block_size_err:
+    ec_set_block_size(0);
+    free(crc);
+    shards_free(result, 2 * k);
+    shards_free(parity, 2 * p);
+    shards_free(data, k);
+}
+
+/*
+ * ec_verify() passes clean parity and finds the first corrupted byte, on
+ * every parity shard and at the start, middle and end of the shard
+ */
+void check_verify(uint32_t k, uint32_t p) {
+    const size_t offsets[] = {0, CHECK_LEN / 2 + 1, CHECK_LEN - 1};
+    uint32_t n = k + p;
+    uint8_t ** shards = shards_alloc(n, CHECK_LEN);
+
+    if (!shards) {
+        printf("%s\n", mem_err);
+        check(0, "verify check setup");
+        return;
+    }
+
+    check(!ec_encode_region(shards, &shards[k], CHECK_LEN, NULL),
+          "ec_encode_region() failed");
+    check(!ec_verify(shards, &shards[k], CHECK_LEN, NULL, NULL),
+          "ec_verify() failed clean parity");
+
+    for (int r = 0; r < p; r++) {
+        for (int o = 0; o < sizeof(offsets) / sizeof(offsets[0]); o++) {
+            size_t bad_offset = 0;
+            int bad_row = -1;
+
+            shards[k + r][offsets[o]] ^= 0x5a;
+            check(ec_verify(shards, &shards[k], CHECK_LEN, &bad_offset, &bad_row) == 1
+                  && bad_offset == offsets[o] && bad_row == r,
+                  "ec_verify() missed corrupted parity");
+            shards[k + r][offsets[o]] ^= 0x5a;
+        }
+    }
+
+    // a corrupted data shard shows up as bad parity too, if there is any
+    if (p) {
+        shards[0][CHECK_LEN - 1] ^= 1;
+        check(ec_verify(shards, &shards[k], CHECK_LEN, NULL, NULL) == 1,
+              "ec_verify() missed corrupted data");
+    }
+
+    shards_free(shards, n);
+}
+
+/*
+ * The planner reads data shards when all cost the same, avoids expensive
+ * shards when there are enough cheap ones, and its plan decodes
+ */
+void check_planner(uint32_t k, uint32_t p) {
+    uint32_t n = k + p;
+    int slow = (p < k) ? p : k;
+    uint8_t ** shards = shards_alloc(n, CHECK_LEN);
+    uint8_t ** result = shards_alloc(k, CHECK_LEN);
+    uint8_t ** input = calloc(k, sizeof(*input));
+    int * available = calloc(n, sizeof(*available));
+    uint32_t * cost = calloc(n, sizeof(*cost));
+    struct ec_decode_plan * plan = 0;
+
+    if (!shards || !result || !input || !available || !cost) {
+        printf("%s\n", mem_err);
+        check(0, "planner check setup");
+        goto check_planner_err;
+    }
+
+    check(!ec_encode_region(shards, &shards[k], CHECK_LEN, NULL),
+          "ec_encode_region() failed");
+
+    // listed backwards, so the plan cannot just keep the given order
+    for (int i = 0; i < n; i++)
+        available[i] = n - 1 - i;
+
+    plan = ec_plan_decode(available, NULL, n);
+    if (!plan) {
+        check(0, "ec_plan_decode() failed");
+        goto check_planner_err;
+    }
+
+    for (int i = 0; i < k; i++)
+        check(plan->indices[i] == i, "plan does not read the data shards");
+    check(!plan->reconstruct && !plan->cost, "plan computes data shards");
+    ec_plan_free(plan);
+
+    // the first data shards are slow, all other shards are cheap
+    for (int i = 0; i < n; i++)
+        cost[i] = (available[i] < slow) ? 10 : 1;
+
+    plan = ec_plan_decode(available, cost, n);
+    if (!plan) {
+        check(0, "ec_plan_decode() with costs failed");
+        goto check_planner_err;
+    }
+
+    for (int i = 0; i < k; i++) {
+        check(plan->indices[i] >= slow, "plan reads a slow shard");
+        input[i] = shards[plan->indices[i]];
+    }
+    check(plan->cost == k && plan->reconstruct == slow,
+          "plan cost or reconstruct count is wrong");
+
+    check(!ec_decode_plan_region(plan, input, result, CHECK_LEN),
+          "ec_decode_plan_region() failed");
+    for (int i = 0; i < k; i++)
+        check(!memcmp(result[i], shards[i], CHECK_LEN),
+              "ec_decode_plan_region() decoded wrong data");
+
+check_planner_err:
+    ec_plan_free(plan);
+    free(cost);
+    free(available);
+    free(input);
+    shards_free(result, k);
+    shards_free(shards, n);
+}
+
+/*
+ * Batch decode of stripes that lost the same shards against decoding each
+ * stripe on its own
+ */
+void check_decode_batch(uint32_t k, uint32_t p) {
+    uint32_t n = k + p;
+    uint8_t ** shards[CHECK_STRIPES] = {0};
+    uint8_t ** batch[CHECK_STRIPES] = {0};
+    uint8_t ** input[CHECK_STRIPES] = {0};
+    uint8_t ** single = shards_alloc(k, CHECK_LEN);
+    int * indices = calloc(k, sizeof(*indices));
+
+    if (!single || !indices) {
+        printf("%s\n", mem_err);
+        check(0, "batch decode check setup");
+        goto check_decode_batch_err;
+    }
+
+    // every stripe lost its first p shards
+    for (int i = 0; i < k; i++)
+        indices[i] = p + i;
+
+    for (int s = 0; s < CHECK_STRIPES; s++) {
+        shards[s] = shards_alloc(n, CHECK_LEN);
+        batch[s] = shards_alloc(k, CHECK_LEN);
+        input[s] = calloc(k, sizeof(*input[s]));
+        if (!shards[s] || !batch[s] || !input[s]) {
+            printf("%s\n", mem_err);
+            check(0, "batch decode check setup");
+            goto check_decode_batch_err;
+        }
+
+        check(!ec_encode_region(shards[s], &shards[s][k], CHECK_LEN, NULL),
+              "ec_encode_region() failed");
+        for (int i = 0; i < k; i++)
+            input[s][i] = shards[s][indices[i]];
+    }
+
+    check(!ec_decode_region_batch(input, indices, batch, CHECK_STRIPES, CHECK_LEN),
+          "ec_decode_region_batch() failed");
+
+    for (int s = 0; s < CHECK_STRIPES; s++) {
+        check(!ec_decode_region(input[s], indices, single, CHECK_LEN, NULL),
+              "ec_decode_region() failed");
+        for (int i = 0; i < k; i++)
+            check(!memcmp(batch[s][i], single[i], CHECK_LEN)
+                  && !memcmp(batch[s][i], shards[s][i], CHECK_LEN),
+                  "batch decode differs from single-stripe decode");
+    }
+
+check_decode_batch_err:
+    for (int s = 0; s < CHECK_STRIPES; s++) {
+        free(input[s]);
+        shards_free(batch[s], k);
+        shards_free(shards[s], n);
+    }
+    free(indices);
+    shards_free(single, k);
+}
+
+/*
+ * Batch encode of small stripes against encoding each stripe on its own,
+ * at a few shard lengths, and the empty batch
+ */
+void check_encode_batch(uint32_t k, uint32_t p) {
+    const size_t lens[] = {1, 17, 512, CHECK_LEN};
+    uint8_t ** data[CHECK_STRIPES] = {0};
+    uint8_t ** batch[CHECK_STRIPES] = {0};
+    uint8_t ** single = shards_alloc(p, CHECK_LEN);
+
+    if (!single) {
+        printf("%s\n", mem_err);
+        check(0, "batch encode check setup");
+        goto check_encode_batch_err;
+    }
+
+    for (int s = 0; s < CHECK_STRIPES; s++) {
+        data[s] = shards_alloc(k, CHECK_LEN);
+        batch[s] = shards_alloc(p, CHECK_LEN);
+        if (!data[s] || !batch[s]) {
+            printf("%s\n", mem_err);
+            check(0, "batch encode check setup");
+            goto check_encode_batch_err;
+        }
+    }
+
+    check(!ec_encode_region_batch(data, batch, 0, CHECK_LEN)
+          && !ec_encode_region_batch(data, batch, CHECK_STRIPES, 0),
+          "ec_encode_region_batch() of nothing failed");
+
+    for (int l = 0; l < sizeof(lens) / sizeof(lens[0]); l++) {
+        check(!ec_encode_region_batch(data, batch, CHECK_STRIPES, lens[l]),
+              "ec_encode_region_batch() failed");
+
+        for (int s = 0; s < CHECK_STRIPES; s++) {
+            check(!ec_encode_region(data[s], single, lens[l], NULL),
+                  "ec_encode_region() failed");
+            for (int i = 0; i < p; i++)
+                check(!memcmp(batch[s][i], single[i], lens[l]),
+                      "batch encode differs from single-stripe encode");
+        }
+    }
+
+check_encode_batch_err:
+    for (int s = 0; s < CHECK_STRIPES; s++) {
+        shards_free(batch[s], p);
+        shards_free(data[s], k);
+    }
+    shards_free(single, p);
+}
+
+/*
+ * Parity accumulated shard by shard in a shuffled order, and merged in a
+ * tree from one accumulator per shard, against ec_encode_region()
+ */
+void check_accumulate(uint32_t k, uint32_t p) {
+    uint32_t n = k + p;
+    uint8_t ** shards = shards_alloc(n, CHECK_LEN);
+    uint8_t ** parity = shards_alloc(p, CHECK_LEN);
+    int * order = calloc(k, sizeof(*order));
+    struct ec_parity_acc ** accs = calloc(k, sizeof(*accs));
+    struct ec_parity_acc * acc = 0;
+
+    if (!shards || !parity || !order || !accs) {
+        printf("%s\n", mem_err);
+        check(0, "accumulate check setup");
+        goto check_accumulate_err;
+    }
+
+    check(!ec_encode_region(shards, &shards[k], CHECK_LEN, NULL),
+          "ec_encode_region() failed");
+
+    for (int i = 0; i < k; i++)
+        order[i] = i;
+    for (int i = k - 1; i > 0; i--) {
+        int j = rand() % (i + 1);
+        int t = order[i];
+
+        order[i] = order[j];
+        order[j] = t;
+    }
+
+    acc = ec_parity_acc_create(CHECK_LEN);
+    if (!acc) {
+        check(0, "ec_parity_acc_create() failed");
+        goto check_accumulate_err;
+    }
+
+    for (int i = 0; i < k; i++) {
+        check(ec_parity_finalize(acc, NULL) != 0,
+              "ec_parity_finalize() passed with shards missing");
+        check(!ec_parity_accumulate(acc, order[i], shards[order[i]], CHECK_LEN),
+              "ec_parity_accumulate() failed");
+    }
+    check(ec_parity_accumulate(acc, order[0], shards[order[0]], CHECK_LEN) != 0,
+          "ec_parity_accumulate() took a shard twice");
+
+    check(!ec_parity_finalize(acc, parity), "ec_parity_finalize() failed");
+    for (int i = 0; i < p; i++)
+        check(!memcmp(parity[i], shards[k + i], CHECK_LEN),
+              "accumulated parity differs from ec_encode_region()");
+
+    // one accumulator per shard, as if each arrived on its own node
+    for (int i = 0; i < k; i++) {
+        accs[i] = ec_parity_acc_create(CHECK_LEN);
+        if (!accs[i]) {
+            check(0, "ec_parity_acc_create() failed");
+            goto check_accumulate_err;
+        }
+        check(!ec_parity_accumulate(accs[i], order[i], shards[order[i]], CHECK_LEN),
+              "ec_parity_accumulate() failed");
+    }
+
+    check(!ec_parity_acc_merge_tree(accs, k), "ec_parity_acc_merge_tree() failed");
+
+    for (int i = 0; i < p; i++)
+        memset(parity[i], 0, CHECK_LEN);
+    check(!ec_parity_finalize(accs[0], parity), "ec_parity_finalize() failed");
+    for (int i = 0; i < p; i++)
+        check(!memcmp(parity[i], shards[k + i], CHECK_LEN),
+              "tree-merged parity differs from ec_encode_region()");
+
+check_accumulate_err:
+    for (int i = 0; accs && i < k; i++)
+        ec_parity_acc_free(accs[i]);
+    ec_parity_acc_free(acc);
+    free(accs);
+    free(order);
+    shards_free(parity, p);
+    shards_free(shards, n);
+}
+
+/*
+ * What the streaming encoder emitted and the decoder output
+ */
+struct stream_check {
+    uint32_t k;
+    uint32_t n;
+    size_t shard_len;
+    uint64_t stripes;   // stripes emitted so far
+    uint64_t max_stripes;
+    uint8_t * emitted;  // n shards of every stripe
+    uint8_t * out;      // decoded object
+    uint64_t out_len;
+};
+
+void stream_emit(uint64_t stripe,
+                 uint8_t ** shards,
+                 size_t len,
+                 size_t data_len,
+                 void * arg) {
+    struct stream_check * sc = arg;
+
+    check(stripe == sc->stripes && stripe < sc->max_stripes && len == sc->shard_len,
+          "stream emitted an unexpected stripe");
+    if (stripe != sc->stripes || stripe >= sc->max_stripes || len != sc->shard_len)
+        return;
+
+    check(!ec_verify(shards, &shards[sc->k], len, NULL, NULL),
+          "stream emitted wrong parity");
+
+    for (int i = 0; i < sc->n; i++)
+        memcpy(&sc->emitted[(stripe * sc->n + i) * len], shards[i], len);
+    sc->stripes++;
+}
+
+void stream_output(const uint8_t * data, size_t len, void * arg) {
+    struct stream_check * sc = arg;
+
+    memcpy(&sc->out[sc->out_len], data, len);
+    sc->out_len += len;
+}
+
+/*
+ * An object written to the streaming encoder in uneven pieces comes back
+ * from the streaming decoder fed the last k shards of every stripe
+ */
+void check_stream(uint32_t k, uint32_t p) {
+    const size_t shard_len = 1000;
+    uint64_t obj_len = 3 * k * shard_len + k * shard_len / 2 + 7;
+    uint8_t ** obj = shards_alloc(1, obj_len);
+    uint8_t ** input = calloc(k, sizeof(*input));
+    int * indices = calloc(k, sizeof(*indices));
+    struct ec_stream * st = 0;
+    struct stream_check sc = {
+        .k = k,
+        .n = k + p,
+        .shard_len = shard_len,
+        .max_stripes = 4,
+    };
+
+    sc.emitted = malloc(sc.max_stripes * sc.n * shard_len);
+    sc.out = malloc(obj_len);
+    if (!obj || !input || !indices || !sc.emitted || !sc.out) {
+        printf("%s\n", mem_err);
+        check(0, "stream check setup");
+        goto check_stream_err;
+    }
+
+    st = ec_stream_encoder_create(shard_len, 2, stream_emit, &sc);
+    if (!st) {
+        check(0, "ec_stream_encoder_create() failed");
+        goto check_stream_err;
+    }
+
+    for (uint64_t off = 0; off < obj_len; ) {
+        size_t chunk = 1 + rand() % (2 * shard_len);
+
+        if (chunk > obj_len - off)
+            chunk = obj_len - off;
+        check(!ec_stream_write(st, &obj[0][off], chunk), "ec_stream_write() failed");
+        off += chunk;
+    }
+    check(!ec_stream_finish(st), "ec_stream_finish() failed");
+    check(ec_stream_length(st) == obj_len && sc.stripes == sc.max_stripes,
+          "stream encoded the wrong length");
+    ec_stream_free(st);
+
+    st = ec_stream_decoder_create(shard_len, obj_len, stream_output, &sc);
+    if (!st) {
+        check(0, "ec_stream_decoder_create() failed");
+        goto check_stream_err;
+    }
+
+    for (uint64_t s = 0; s < sc.stripes; s++) {
+        for (int i = 0; i < k; i++) {
+            indices[i] = p + i;
+            input[i] = &sc.emitted[(s * sc.n + p + i) * shard_len];
+        }
+        check(!ec_stream_read(st, input, indices), "ec_stream_read() failed");
+    }
+
+    check(sc.out_len == obj_len && ec_stream_length(st) == obj_len
+          && !memcmp(sc.out, obj[0], obj_len),
+          "stream decoded wrong data");
+
+check_stream_err:
+    ec_stream_free(st);
+    free(sc.out);
+    free(sc.emitted);
+    free(indices);
+    free(input);
+    shards_free(obj, 1);
+}
+
+/*
+ * Interleave and deinterleave round-trips, and the interleaved encode
+ * against ec_encode() row by row, at lengths that are not multiples of the
+ * transpose block
+ */
+void check_interleave(uint32_t k, uint32_t p) {
+    const size_t lens[] = {1, 15, 17, 100, 1000, CHECK_LEN - 1};
+    uint32_t n = k + p;
+    uint8_t ** shards = shards_alloc(n, CHECK_LEN);
+    uint8_t * src = malloc(n * CHECK_LEN);
+    uint8_t * dst = malloc(n * CHECK_LEN);
+    uint8_t * parity = malloc(p * CHECK_LEN);
+    uint8_t * row = malloc(p);
+
+    if (!shards || !src || !dst || !parity || !row) {
+        printf("%s\n", mem_err);
+        check(0, "interleave check setup");
+        goto check_interleave_err;
+    }
+
+    for (size_t b = 0; b < n * CHECK_LEN; b++)
+        src[b] = (uint8_t) rand();
+
+    for (int l = 0; l < sizeof(lens) / sizeof(lens[0]); l++) {
+        size_t len = lens[l];
+        int counts[] = {k, n};
+
+        for (int c = 0; c < 2; c++) {
+            int count = counts[c];
+            int ok = 1;
+
+            ec_deinterleave(src, count, shards, len);
+            for (size_t r = 0; r < len && ok; r++)
+                for (int i = 0; i < count; i++)
+                    ok &= shards[i][r] == src[r * count + i];
+            check(ok, "ec_deinterleave() put bytes in the wrong shards");
+
+            memset(dst, 0, count * len);
+            ec_interleave(shards, count, dst, len);
+            check(!memcmp(dst, src, count * len),
+                  "ec_interleave() did not undo ec_deinterleave()");
+        }
+
+        check(!ec_encode_interleaved(src, parity, len),
+              "ec_encode_interleaved() failed");
+
+        int ok = 1;
+        for (size_t r = 0; r < len && ok; r++) {
+            ec_encode(&src[r * k], row);
+            ok = !memcmp(row, &parity[r * p], p);
+        }
+        check(ok, "ec_encode_interleaved() differs from ec_encode()");
+    }
+
+check_interleave_err:
+    free(row);
+    free(parity);
+    free(dst);
+    free(src);
+    shards_free(shards, n);
+}
+
+/*
+ * ec_encode_object() at every object length up to k * CHECK_OBJ_SHARD_MAX,
+ * so every tail length is covered, against encoding a zero padded copy.  The
+ * object is decoded back from the last k shards, reading only the stored
+ * part of the data shards.
+ */
+void check_encode_object(uint32_t k, uint32_t p) {
+    uint32_t n = k + p;
+    uint64_t max_len = (uint64_t) k * CHECK_OBJ_SHARD_MAX;
+    uint8_t ** padded = shards_alloc(n, CHECK_OBJ_SHARD_MAX);
+    uint8_t ** parity = shards_alloc(p, CHECK_OBJ_SHARD_MAX);
+    uint8_t ** input = calloc(k, sizeof(*input));
+    int * indices = calloc(k, sizeof(*indices));
+    uint8_t * obj = 0;
+    uint8_t * out = malloc(max_len);
+    uint64_t failed = checks.failed;
+
+    if (!padded || !parity || !input || !indices || !out) {
+        printf("%s\n", mem_err);
+        check(0, "object check setup");
+        goto check_encode_object_err;
+    }
+
+    for (uint64_t len = 0; len <= max_len; len++) {
+        struct ec_object_meta meta;
+
+        // exactly len bytes, so reading past the object is caught by tools
+        free(obj);
+        obj = malloc(len ? len : 1);
+        if (!obj) {
+            printf("%s\n", mem_err);
+            check(0, "object check setup");
+            goto check_encode_object_err;
+        }
+        for (uint64_t b = 0; b < len; b++)
+            obj[b] = (uint8_t) rand();
+
+        check(!ec_encode_object(obj, len, parity, &meta), "ec_encode_object() failed");
+        check(meta.length == len && meta.shard_len == (len + k - 1) / k,
+              "ec_encode_object() layout is wrong");
+
+        for (int i = 0; i < k; i++) {
+            size_t valid = ec_shard_valid_len(&meta, i);
+
+            memset(padded[i], 0, meta.shard_len);
+            memcpy(padded[i], &obj[i * meta.shard_len], valid);
+        }
+        check(!ec_encode_region(padded, &padded[k], meta.shard_len, NULL),
+              "ec_encode_region() failed");
+        for (int i = 0; i < p; i++)
+            check(!memcmp(parity[i], padded[k + i], meta.shard_len),
+                  "ec_encode_object() differs from the padded encode");
+
+        for (int i = 0; i < k; i++) {
+            int idx = p + i;
+
+            indices[i] = idx;
+            if (idx >= k)
+                input[i] = parity[idx - k];
+            else
+                input[i] = ec_shard_valid_len(&meta, idx) ? &obj[idx * meta.shard_len]
+                                                          : NULL;
+        }
+
+        memset(out, 0xa5, max_len);
+        check(!ec_decode_object(input, indices, &meta, out)
+              && !memcmp(out, obj, len),
+              "ec_decode_object() decoded wrong data");
+    }
+
+    printf("Object tails up to %lu bytes: %s.\n", max_len,
+           (checks.failed == failed) ? "passed" : "FAILED");
+
+check_encode_object_err:
+    free(out);
+    free(obj);
+    free(indices);
+    free(input);
+    shards_free(parity, p);
+    shards_free(padded, n);
+}
+
+void async_done(struct ec_job * job) {
+    __atomic_store_n((int *) job->arg, 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Encode, decode and reconstruct jobs submitted to the async pool and
+ * taken back with ec_poll() once its eventfd fires, plus a job completed by
+ * callback
+ */
+void check_async(uint32_t k, uint32_t p) {
+    uint32_t n = k + p;
+    uint8_t ** shards = shards_alloc(n, CHECK_LEN);
+    uint8_t ** parity = shards_alloc(p, CHECK_LEN);
+    uint8_t ** cb_parity = shards_alloc(p, CHECK_LEN);
+    uint8_t ** decoded = shards_alloc(k, CHECK_LEN);
+    uint8_t ** rebuilt = shards_alloc(n, CHECK_LEN);
+    uint8_t ** input = calloc(k, sizeof(*input));
+    int * indices = calloc(k, sizeof(*indices));
+    uint8_t * erased = calloc(n, sizeof(*erased));
+    struct ec_async * async = 0;
+    struct ec_job jobs[3];
+    struct ec_job cb_job;
+    struct ec_job * done[4];
+    int cb_called = 0;
+    int got = 0;
+
+    if (!shards || !parity || !cb_parity || !decoded || !rebuilt || !input
+        || !indices || !erased) {
+        printf("%s\n", mem_err);
+        check(0, "async check setup");
+        goto check_async_err;
+    }
+
+    check(!ec_encode_region(shards, &shards[k], CHECK_LEN, NULL),
+          "ec_encode_region() failed");
+
+    for (int i = 0; i < k; i++) {
+        indices[i] = p + i;
+        input[i] = shards[p + i];
+    }
+    for (int i = 0; i < n; i++) {
+        erased[i] = i < p;
+        if (!erased[i])
+            memcpy(rebuilt[i], shards[i], CHECK_LEN);
+    }
+
+    async = ec_async_init(2);
+    if (!async) {
+        check(0, "ec_async_init() failed");
+        goto check_async_err;
+    }
+
+    check(ec_wait(async, done, 4) == 0, "ec_wait() with nothing queued did not return 0");
+
+    jobs[0] = (struct ec_job) {
+        .op = EC_JOB_ENCODE, .priority = EC_JOB_PRIO_LOW,
+        .in = shards, .out = parity, .len = CHECK_LEN, .rc = -1,
+    };
+    jobs[1] = (struct ec_job) {
+        .op = EC_JOB_DECODE, .priority = EC_JOB_PRIO_NORMAL,
+        .in = input, .out = decoded, .indices = indices, .len = CHECK_LEN, .rc = -1,
+    };
+    jobs[2] = (struct ec_job) {
+        .op = EC_JOB_RECONSTRUCT, .priority = EC_JOB_PRIO_HIGH,
+        .in = rebuilt, .erased = erased, .len = CHECK_LEN, .rc = -1,
+    };
+    cb_job = (struct ec_job) {
+        .op = EC_JOB_ENCODE, .priority = EC_JOB_PRIO_NORMAL,
+        .in = shards, .out = cb_parity, .len = CHECK_LEN, .rc = -1,
+        .done = async_done, .arg = &cb_called,
+    };
+
+    for (int i = 0; i < 3; i++)
+        check(!ec_submit(async, &jobs[i]), "ec_submit() failed");
+    check(!ec_submit(async, &cb_job), "ec_submit() failed");
+
+    // only the three jobs without a callback are handed back
+    while (got < 3) {
+        struct pollfd pfd = {
+            .fd = ec_async_fd(async),
+            .events = POLLIN,
+        };
+
+        if (poll(&pfd, 1, 10000) <= 0) {
+            check(0, "async eventfd did not fire");
+            break;
+        }
+
+        got += ec_poll(async, &done[got], 4 - got);
+    }
+    check(got == 3, "ec_poll() did not hand back every job");
+
+    for (int i = 0; i < got; i++)
+        check(done[i] >= jobs && done[i] < &jobs[3] && !done[i]->rc,
+              "ec_poll() handed back a bad job");
+
+    if (got == 3) {
+        for (int i = 0; i < p; i++)
+            check(!memcmp(parity[i], shards[k + i], CHECK_LEN),
+                  "async encode produced wrong parity");
+        for (int i = 0; i < k; i++)
+            check(!memcmp(decoded[i], shards[i], CHECK_LEN),
+                  "async decode produced wrong data");
+        for (int i = 0; i < n; i++)
+            check(!memcmp(rebuilt[i], shards[i], CHECK_LEN),
+                  "async reconstruct produced wrong shards");
+    }
+
+    // cleanup waits for the callback job
+    ec_async_cleanup(async);
+    async = 0;
+
+    check(__atomic_load_n(&cb_called, __ATOMIC_ACQUIRE) && !cb_job.rc,
+          "async callback was not called");
+    for (int i = 0; i < p; i++)
+        check(!memcmp(cb_parity[i], shards[k + i], CHECK_LEN),
+              "async encode with callback produced wrong parity");
+
+check_async_err:
+    ec_async_cleanup(async);
+    free(erased);
+    free(indices);
+    free(input);
+    shards_free(rebuilt, n);
+    shards_free(decoded, k);
+    shards_free(cb_parity, p);
+    shards_free(parity, p);
+    shards_free(shards, n);
+}
+
+/*
+ * Start the ecd daemon built next to this program on a socket of its own
+ *
+ * returns: pid of the daemon, or -1 if failed
+ */
+pid_t ecd_start(const char * sock, uint32_t k, uint32_t p) {
+    char k_arg[16];
+    char p_arg[16];
+
+    snprintf(k_arg, sizeof(k_arg), "%u", k);
+    snprintf(p_arg, sizeof(p_arg), "%u", p);
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        int fd = open("/dev/null", O_WRONLY);
+
+        if (fd >= 0) {
+            dup2(fd, STDOUT_FILENO);
+            close(fd);
+        }
+        execl(CHECK_ECD_PATH, CHECK_ECD_PATH, sock, k_arg, p_arg, "1", (char *) NULL);
+        _exit(127);
+    }
+
+    return pid;
+}
+
+/*
+ * Connect to ecd and send requests without ever reading the responses
+ *
+ * returns: 1 if the daemon hung up on the client, 0 if not within the wait
+ */
+int ecd_flood(const char * sock) {
+    struct sockaddr_un addr = {
+        .sun_family = AF_UNIX,
+    };
+    uint8_t junk = 0;
+    int dropped = 0;
+
+    strncpy(addr.sun_path, sock, sizeof(addr.sun_path) - 1);
+
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK, 0);
+    if (fd < 0)
+        return 0;
+
+    if (connect(fd, (struct sockaddr *) &addr, sizeof(addr))) {
+        close(fd);
+        return 0;
+    }
+
+    // every short request is answered with an error
+    for (int ms = 0; ms < CHECK_ECD_WAIT_MS && !dropped; ) {
+        if (send(fd, &junk, sizeof(junk), MSG_NOSIGNAL) == sizeof(junk))
+            continue;
+
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            usleep(1000);
+            ms++;
+        } else {
+            dropped = 1;
+        }
+    }
+
+    close(fd);
+
+    return dropped;
+}
+
+/*
+ * Shards encoded, decoded and rebuilt by ecd in the client's shared memory.
+ * The daemon has its own context, so its results are checked against each
+ * other and the original data rather than the local parity.
+ */
+void check_ecd(uint32_t k, uint32_t p) {
+    uint32_t n = k + p;
+    char sock[64];
+    struct ecd_client * c = 0;
+    uint32_t ecd_k = 0;
+    uint32_t ecd_p = 0;
+    uint8_t * shm = 0;
+    uint8_t * shards[n];
+    uint8_t * decoded[k];
+    uint8_t * rebuilt[n];
+    uint8_t * orig = malloc(n * CHECK_LEN);
+    uint8_t erased[n];
+    int indices[k];
+    pid_t pid = -1;
+
+    if (!orig) {
+        printf("%s\n", mem_err);
+        check(0, "ecd check setup");
+        return;
+    }
+
+    snprintf(sock, sizeof(sock), "/tmp/" PROG_NAME ".%d.sock", (int) getpid());
+
+    pid = ecd_start(sock, k, p);
+    if (pid < 0) {
+        printf("Error starting ecd. (errno=%d)\n", errno);
+        check(0, "ecd check setup");
+        goto check_ecd_err;
+    }
+
+    // wait for the socket, giving up if the daemon exits
+    for (int ms = 0; ms < CHECK_ECD_WAIT_MS && !c; ms += 10) {
+        struct stat st;
+
+        if (waitpid(pid, NULL, WNOHANG) == pid) {
+            pid = -1;
+            break;
+        }
+        if (!stat(sock, &st))
+            c = ecd_connect(sock, (2 * n + k) * CHECK_LEN);
+        if (!c)
+            usleep(10 * 1000);
+    }
+
+    if (!c) {
+        printf("Could not connect to %s started on %s.\n", CHECK_ECD_PATH, sock);
+        check(0, "ecd did not start");
+        goto check_ecd_err;
+    }
+
+    ecd_params(c, &ecd_k, &ecd_p);
+    check(ecd_k == k && ecd_p == p, "ecd reports the wrong k and p");
+
+    shm = ecd_shm(c);
+    for (int i = 0; i < n; i++) {
+        shards[i] = &shm[i * CHECK_LEN];
+        rebuilt[i] = &shm[(n + i) * CHECK_LEN];
+    }
+    for (int i = 0; i < k; i++)
+        decoded[i] = &shm[(2 * n + i) * CHECK_LEN];
+
+    for (size_t b = 0; b < k * CHECK_LEN; b++)
+        shm[b] = (uint8_t) rand();
+
+    check(!ecd_encode(c, shards, &shards[k], CHECK_LEN), "ecd_encode() failed");
+    memcpy(orig, shm, n * CHECK_LEN);
+
+    // a client that does not read its responses must not stall the others
+    check(ecd_flood(sock), "ecd did not drop a client that does not read");
+    check(!ecd_encode(c, shards, &shards[k], CHECK_LEN),
+          "ecd_encode() failed after another client stopped reading");
+    check(!memcmp(shm, orig, n * CHECK_LEN), "ecd_encode() changed the parity");
+
+    for (int i = 0; i < k; i++)
+        indices[i] = p + i;
+    check(!ecd_decode(c, &shards[p], indices, decoded, CHECK_LEN),
+          "ecd_decode() failed");
+    check(!memcmp(decoded[0], orig, k * CHECK_LEN), "ecd_decode() decoded wrong data");
+
+    for (int i = 0; i < n; i++) {
+        erased[i] = (i % 2 == 0 && i / 2 < p);
+        memcpy(rebuilt[i], erased[i] ? &orig[((i + 1) % n) * CHECK_LEN]
+                                     : &orig[i * CHECK_LEN], CHECK_LEN);
+    }
+    check(!ecd_reconstruct(c, rebuilt, erased, CHECK_LEN), "ecd_reconstruct() failed");
+    check(!memcmp(rebuilt[0], orig, n * CHECK_LEN),
+          "ecd_reconstruct() rebuilt wrong shards");
+
+check_ecd_err:
+    ecd_disconnect(c);
+    if (pid > 0) {
+        kill(pid, SIGTERM);
+        waitpid(pid, NULL, 0);
+    }
+    unlink(sock);
+    free(orig);
+}
+
+/*
+ * Path of a shard file, as laid out by ec_store
+ */
+void store_shard_path(const char * root,
+                      int shard,
+                      const char * name,
+                      uint64_t stripe,
+                      char * path,
+                      size_t len) {
+    snprintf(path, len, "%s/shard%03d/%s.%llu",
+             root, shard, name, (unsigned long long) stripe);
+}
+
+/*
+ * Flip one byte of a shard file in place
+ */
+void store_corrupt(const char * path, off_t off) {
+    uint8_t b = 0;
+    int fd = open(path, O_RDWR);
+
+    if (fd < 0 || pread(fd, &b, 1, off) != 1) {
+        check(0, "could not read a shard to corrupt");
+    } else {
+        b ^= 0x5a;
+        check(pwrite(fd, &b, 1, off) == 1, "could not corrupt a shard");
+    }
+
+    if (fd >= 0)
+        close(fd);
+}
+
+/*
+ * Remove the directories of an emptied store
+ */
+void store_rmdir(const char * root, uint32_t n) {
+    char path[512];
+
+    for (int i = 0; i < n; i++) {
+        snprintf(path, sizeof(path), "%s/shard%03d", root, i);
+        rmdir(path);
+    }
+    snprintf(path, sizeof(path), "%s/index", root);
+    rmdir(path);
+    rmdir(root);
+}
+
+/*
+ * Read count random ranges of the object and the whole object
+ */
+void store_read_check(struct ec_store * store,
+                      const char * name,
+                      const uint8_t * obj,
+                      uint64_t len,
+                      uint8_t * buf,
+                      int count) {
+    int ok = 1;
+
+    for (int r = 0; r < count && ok; r++) {
+        uint64_t off = rand() % len;
+        size_t chunk = rand() % (len - off + 1);
+
+        ok = !ec_store_read(store, name, off, buf, chunk) && !memcmp(buf, &obj[off], chunk);
+    }
+    check(ok, "ec_store_read() of a range returned wrong data");
+
+    check(!ec_store_read(store, name, 0, buf, len) && !memcmp(buf, obj, len),
+          "ec_store_read() of the whole object returned wrong data");
+}
+
+/*
+ * Store an object of two and a half stripes, then read ranges back with
+ * shards removed and corrupted, down to one stripe having lost too many
+ */
+void check_store(uint32_t k, uint32_t p) {
+    char root[] = "/tmp/" PROG_NAME ".XXXXXX";
+    char path[512];
+    const char * name = "obj";
+    uint64_t len = (uint64_t) k * CHECK_STORE_SHARD * 5 / 2 + 3;
+    uint8_t ** obj = shards_alloc(1, len);
+    uint8_t * buf = malloc(len);
+    uint8_t * shard = malloc(CHECK_STORE_SHARD);
+    struct ec_store * store = 0;
+    struct ec_object_meta meta;
+    uint64_t stored_len = 0;
+    uint64_t stripes = 0;
+
+    if (!obj || !buf || !shard) {
+        printf("%s\n", mem_err);
+        check(0, "store check setup");
+        goto check_store_err;
+    }
+
+    if (!mkdtemp(root)) {
+        printf("Error creating %s. (errno=%d)\n", root, errno);
+        check(0, "store check setup");
+        goto check_store_err;
+    }
+
+    store = ec_store_open(root, CHECK_STORE_SHARD);
+    if (!store) {
+        check(0, "ec_store_open() failed");
+        goto check_store_err;
+    }
+
+    check(!ec_store_put(store, name, obj[0], len), "ec_store_put() failed");
+    check(!ec_store_length(store, name, &stored_len) && stored_len == len,
+          "ec_store_length() is wrong");
+    check(!ec_store_stripe_count(store, name, &stripes) && stripes == 3,
+          "ec_store_stripe_count() is wrong");
+
+    store_read_check(store, name, obj[0], len, buf, CHECK_STORE_READS);
+
+    // with parity to spare, stripe 0 loses a data shard and, if it can afford
+    // it, has a block of the next one corrupted; the short last stripe loses
+    // a data shard
+    if (p) {
+        store_shard_path(root, 0, name, 0, path, sizeof(path));
+        unlink(path);
+        if (p > 1) {
+            store_shard_path(root, 1, name, 0, path, sizeof(path));
+            store_corrupt(path, CHECK_STORE_SHARD - 1);
+        }
+        store_shard_path(root, 0, name, 2, path, sizeof(path));
+        unlink(path);
+
+        store_read_check(store, name, obj[0], len, buf, CHECK_STORE_READS);
+    }
+
+    check(!ec_store_stripe_layout(store, name, 0, &meta), "ec_store_stripe_layout() failed");
+    if (p)
+        check(ec_store_shard_read(store, name, 0, 0, &meta, shard) == EC_SHARD_MISSING,
+              "removed shard is not reported missing");
+    if (p > 1)
+        check(ec_store_shard_read(store, name, 0, 1, &meta, shard) == EC_SHARD_CORRUPT,
+              "corrupted shard is not reported corrupt");
+    check(ec_store_shard_read(store, name, 0, k + p - 1, &meta, shard) == EC_SHARD_OK,
+          "intact shard is not reported ok");
+
+    // stripe 1 loses more shards than it has parity
+    for (int i = 0; i <= p; i++) {
+        store_shard_path(root, i, name, 1, path, sizeof(path));
+        unlink(path);
+    }
+    check(ec_store_read(store, name, (uint64_t) k * CHECK_STORE_SHARD, buf, 1) != 0,
+          "read of a stripe with too many lost shards did not fail");
+
+    check(!ec_store_remove(store, name) && ec_store_length(store, name, &stored_len),
+          "ec_store_remove() left the object behind");
+
+check_store_err:
+    // a no-op unless a check above failed before the object was removed
+    if (store)
+        ec_store_remove(store, name);
+    ec_store_close(store);
+    if (root[strlen(root) - 1] != 'X')
+        store_rmdir(root, k + p);
+    free(shard);
+    free(buf);
+    shards_free(obj, 1);
+}
+
+/*
+ * A rebuild pass repairs every stripe with at most p missing or corrupt
+ * shards, counts the one that lost more, and a following scrub finds only
+ * that one damaged
+ */
+void check_rebuild(uint32_t k, uint32_t p) {
+    char root[] = "/tmp/" PROG_NAME ".XXXXXX";
+    char path[512];
+    const char * names[] = {"a", "b"};
+    uint64_t len = (uint64_t) k * CHECK_STORE_SHARD * 3 / 2 + 1;
+    uint8_t ** objs = shards_alloc(2, len);
+    uint8_t * buf = malloc(len);
+    struct ec_store * store = 0;
+    struct ec_rebuild * r = 0;
+    struct ec_rebuild_stats stats;
+    struct ec_rebuild_config config = {
+        .repair = 1,
+    };
+    uint64_t removed = 0;
+
+    if (!objs || !buf) {
+        printf("%s\n", mem_err);
+        check(0, "rebuild check setup");
+        goto check_rebuild_err;
+    }
+
+    if (!mkdtemp(root)) {
+        printf("Error creating %s. (errno=%d)\n", root, errno);
+        check(0, "rebuild check setup");
+        goto check_rebuild_err;
+    }
+
+    store = ec_store_open(root, CHECK_STORE_SHARD);
+    if (!store) {
+        check(0, "ec_store_open() failed");
+        goto check_rebuild_err;
+    }
+
+    for (int o = 0; o < 2; o++)
+        check(!ec_store_put(store, names[o], objs[o], len), "ec_store_put() failed");
+
+    // a: p shards of stripe 0 gone, the last one corrupted instead, and one
+    // shard of stripe 1 gone; b: stripe 1 lost p + 1 shards
+    for (int i = 0; i < p; i++) {
+        store_shard_path(root, i * (k + p) / p, "a", 0, path, sizeof(path));
+        if (i == p - 1) {
+            store_corrupt(path, 0);
+        } else {
+            unlink(path);
+            removed++;
+        }
+    }
+    store_shard_path(root, k + p - 1, "a", 1, path, sizeof(path));
+    unlink(path);
+    removed++;
+
+    for (int i = 0; i <= p; i++) {
+        store_shard_path(root, i, "b", 1, path, sizeof(path));
+        unlink(path);
+        removed++;
+    }
+
+    r = ec_rebuild_create(store, &config);
+    if (!r) {
+        check(0, "ec_rebuild_create() failed");
+        goto check_rebuild_err;
+    }
+
+    check(ec_rebuild_run(r) != 0, "rebuild did not report the lost stripe");
+    ec_rebuild_progress(r, &stats);
+    check(stats.stripes_scanned == 4 && stats.stripes_damaged == 3
+          && stats.stripes_repaired == 2 && stats.stripes_lost == 1,
+          "rebuild stripe counters are wrong");
+    check(stats.shards_missing == removed && stats.shards_corrupt == 1
+          && stats.shards_rebuilt == p + 1,
+          "rebuild shard counters are wrong");
+    ec_rebuild_free(r);
+
+    // scrub only: just the lost stripe is still damaged
+    config.repair = 0;
+    r = ec_rebuild_create(store, &config);
+    if (!r) {
+        check(0, "ec_rebuild_create() failed");
+        goto check_rebuild_err;
+    }
+
+    ec_rebuild_run(r);
+    ec_rebuild_progress(r, &stats);
+    check(stats.stripes_damaged == 1 && stats.shards_missing == p + 1
+          && !stats.shards_corrupt && !stats.bytes_written,
+          "scrub after rebuild found the wrong damage");
+
+    // the rebuilt shards must be good enough to read from: lose up to p of
+    // the shards that survived in the repaired stripe instead
+    for (int i = 0, lost = 0; i < k + p && lost < p; i++) {
+        int rebuilt = 0;
+
+        for (int j = 0; j < p; j++)
+            rebuilt |= i == j * (k + p) / p;
+
+        if (!rebuilt) {
+            store_shard_path(root, i, "a", 0, path, sizeof(path));
+            unlink(path);
+            lost++;
+        }
+    }
+    check(!ec_store_read(store, "a", 0, buf, len) && !memcmp(buf, objs[0], len),
+          "rebuilt object reads back wrong");
+
+check_rebuild_err:
+    ec_rebuild_free(r);
+    if (store)
+        for (int o = 0; o < 2; o++)
+            ec_store_remove(store, names[o]);
+    ec_store_close(store);
+    if (root[strlen(root) - 1] != 'X')
+        store_rmdir(root, k + p);
+    free(buf);
+    shards_free(objs, 2);
+}
+
+/*
+ * ec_matrix_cost() against counts worked out by hand, and EC_MATRIX_AUTO
+ * against the cheapest MDS type for a few code sizes.  The context is set
+ * up again as main() had it.
+ */
+void check_matrix_cost(uint32_t k, uint32_t p, enum ec_matrix_type type) {
+    const uint32_t sizes[][2] = {{2, 2}, {4, 1}, {4, 2}, {6, 3}, {10, 4}, {12, 4}};
+    struct ec_matrix_cost cost;
+    uint8_t ** shards = shards_alloc(16, CHECK_LEN);
+    uint8_t ** parity = shards_alloc(4, CHECK_LEN);
+
+    if (!shards || !parity) {
+        printf("%s\n", mem_err);
+        check(0, "matrix cost check setup");
+        goto check_matrix_cost_err;
+    }
+
+    // RS, k = 2, p = 2: parity rows [1 1] and [1 2].  [1 1] is one XOR per
+    // output bit.  Times 2 is a shift with x^8 = 0x1b folded back in, so
+    // [1 2] selects 2 3 2 3 3 2 2 2 input bits for output bits 0..7.
+    check(!ec_matrix_cost(EC_MATRIX_RS, 2, 2, &cost), "ec_matrix_cost() failed");
+    check(cost.ones == 3 && cost.nontrivial == 1 && cost.xors == 8 + 11 && !cost.mds,
+          "ec_matrix_cost() of RS k = 2, p = 2 is wrong");
+
+    // optimized Cauchy, k = 4, p = 1: the only parity row is all 1s
+    check(!ec_matrix_cost(EC_MATRIX_CAUCHY_OPT, 4, 1, &cost), "ec_matrix_cost() failed");
+    check(cost.ones == 4 && cost.nontrivial == 0 && cost.xors == 8 * 3 && cost.mds,
+          "ec_matrix_cost() of optimized Cauchy k = 4, p = 1 is wrong");
+
+    for (int s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        uint32_t sk = sizes[s][0];
+        uint32_t sp = sizes[s][1];
+        enum ec_matrix_type best_type = EC_MATRIX_VANDERMONDE;
+        int best = -1;
+
+        for (enum ec_matrix_type t = 0; t < EC_MATRIX_AUTO; t++) {
+            if (ec_matrix_cost(t, sk, sp, &cost)) {
+                check(0, "ec_matrix_cost() failed");
+                continue;
+            }
+
+            // Cauchy matrices have no zero coefficients
+            check(cost.ones + cost.nontrivial <= sk * sp
+                  && (cost.ones + cost.nontrivial == sk * sp
+                      || (t != EC_MATRIX_CAUCHY && t != EC_MATRIX_CAUCHY_OPT)),
+                  "ec_matrix_cost() coefficient counts are wrong");
+            check(cost.mds == (t != EC_MATRIX_RS), "ec_matrix_cost() MDS flag is wrong");
+
+            if (cost.mds && (best < 0 || cost.xors < best)) {
+                best = cost.xors;
+                best_type = t;
+            }
+        }
+
+        // the automatic pick encodes exactly as the cheapest MDS type
+        ec_cleanup();
+        if (ec_init_matrix(sk, sp, best_type)) {
+            check(0, "ec_init_matrix() failed");
+            continue;
+        }
+        check(!ec_encode_region(shards, &shards[sk], CHECK_LEN, NULL),
+              "ec_encode_region() failed");
+
+        ec_cleanup();
+        if (ec_init_matrix(sk, sp, EC_MATRIX_AUTO)) {
+            check(0, "ec_init_matrix() failed");
+            continue;
+        }
+        check(!ec_encode_region(shards, parity, CHECK_LEN, NULL),
+              "ec_encode_region() failed");
+
+        for (int i = 0; i < sp; i++)
+            check(!memcmp(parity[i], shards[sk + i], CHECK_LEN),
+                  "EC_MATRIX_AUTO did not pick the cheapest MDS type");
+    }
+
+check_matrix_cost_err:
+    ec_cleanup();
+    if (ec_init_matrix(k, p, type))
+        check(0, "ec_init_matrix() failed");
+    shards_free(parity, 4);
+    shards_free(shards, 16);
+}
+
+/*
+ * Decode every single and double failure of the shards from the first k
+ * survivors and compare with the data shards
+ */
+void check_failures(uint32_t k, uint32_t p, uint8_t ** shards, const char * what) {
+    uint32_t n = k + p;
+    uint8_t ** result = shards_alloc(k, CHECK_LEN);
+    uint8_t * input[k];
+    int indices[k];
+
+    if (!result) {
+        printf("%s\n", mem_err);
+        check(0, what);
+        return;
+    }
+
+    for (int a = 0; a < n && p >= 1; a++) {
+        for (int b = a; b < n; b++) {
+            int count = 0;
+
+            // b == a is the single failure
+            if (b != a && p < 2)
+                break;
+
+            for (int i = 0; i < n && count < k; i++) {
+                if (i == a || i == b)
+                    continue;
+                indices[count] = i;
+                input[count++] = shards[i];
+            }
+
+            int ok = !ec_decode_region(input, indices, result, CHECK_LEN, NULL);
+            for (int i = 0; i < k && ok; i++)
+                ok = !memcmp(result[i], shards[i], CHECK_LEN);
+            check(ok, what);
+        }
+    }
+
+    shards_free(result, k);
+}
+
+/*
+ * A context saved by ec_save() and loaded by ec_init_from_file() encodes and
+ * decodes single and double failures as a fresh ec_init_matrix() does.  The
+ * context is set up again as main() had it.
+ */
+void check_save(uint32_t k, uint32_t p, enum ec_matrix_type type) {
+    uint32_t n = k + p;
+    char path[64];
+    uint32_t file_k = 0;
+    uint32_t file_p = 0;
+    uint8_t ** shards = shards_alloc(n, CHECK_LEN);
+    uint8_t ** parity = shards_alloc(p, CHECK_LEN);
+
+    snprintf(path, sizeof(path), "/tmp/" PROG_NAME ".%d.ctx", (int) getpid());
+
+    if (!shards || !parity) {
+        printf("%s\n", mem_err);
+        check(0, "context file check setup");
+        goto check_save_err;
+    }
+
+    check(!ec_encode_region(shards, &shards[k], CHECK_LEN, NULL),
+          "ec_encode_region() failed");
+    check_failures(k, p, shards, "fresh context decoded a failure wrong");
+
+    check(!ec_save(path), "ec_save() failed");
+    ec_cleanup();
+
+    if (ec_init_from_file(path)) {
+        check(0, "ec_init_from_file() failed");
+        goto check_save_err;
+    }
+
+    ec_get_params(&file_k, &file_p);
+    check(file_k == k && file_p == p, "context file has the wrong k and p");
+
+    check(!ec_encode_region(shards, parity, CHECK_LEN, NULL),
+          "ec_encode_region() from a context file failed");
+    for (int i = 0; i < p; i++)
+        check(!memcmp(parity[i], shards[k + i], CHECK_LEN),
+              "parity from a context file differs from ec_init_matrix()");
+    check_failures(k, p, shards, "context file decoded a failure wrong");
+
+check_save_err:
+    ec_cleanup();
+    if (ec_init_matrix(k, p, type))
+        check(0, "ec_init_matrix() failed");
+    unlink(path);
+    shards_free(parity, p);
+    shards_free(shards, n);
+}
+
+/*
+ * Kernel name a tuning file selects, or an empty string if it has none
+ */
+void tune_file_kernel(const char * path, char * kernel, size_t len) {
+    char key[32];
+    char value[32];
+    FILE * f = fopen(path, "r");
+
+    kernel[0] = '\0';
+    if (!f)
+        return;
+
+    while (fscanf(f, "%31s %31s", key, value) == 2)
+        if (!strcmp(key, "kernel"))
+            snprintf(kernel, len, "%s", value);
+
+    fclose(f);
+}
+
+/*
+ * Settings tuned and saved by ec_tune() are loaded by an ec_init_matrix()
+ * pointed at them through EC_TUNING_FILE, and encode and decode give the
+ * same results as before.  The context is set up again as main() had it.
+ */
+void check_tune(uint32_t k, uint32_t p, enum ec_matrix_type type) {
+    uint32_t n = k + p;
+    char path[64];
+    char kernel[32];
+    enum gf_kernel saved = gf_kernel_get();
+    uint8_t ** shards = shards_alloc(n, CHECK_LEN);
+    uint8_t ** parity = shards_alloc(p, CHECK_LEN);
+    uint8_t ** result = shards_alloc(k, CHECK_LEN);
+    uint8_t * input[k];
+    int indices[k];
+
+    snprintf(path, sizeof(path), "/tmp/" PROG_NAME ".%d.tune", (int) getpid());
+
+    if (!shards || !parity || !result) {
+        printf("%s\n", mem_err);
+        check(0, "tuning check setup");
+        goto check_tune_err;
+    }
+
+    check(!ec_encode_region(shards, &shards[k], CHECK_LEN, NULL),
+          "ec_encode_region() failed");
+
+    check(!ec_tune(path), "ec_tune() failed");
+    tune_file_kernel(path, kernel, sizeof(kernel));
+    check(kernel[0] != '\0', "ec_tune() saved no kernel");
+
+    // the file is loaded, not tuned again, when it exists
+    ec_cleanup();
+    gf_kernel_set(GF_KERNEL_TABLE);
+    setenv("EC_TUNING_FILE", path, 1);
+    check(!ec_init_matrix(k, p, type), "ec_init_matrix() with a tuning file failed");
+    unsetenv("EC_TUNING_FILE");
+    check(!strcmp(gf_kernel_name(gf_kernel_get()), kernel),
+          "ec_init_matrix() did not load the tuned kernel");
+
+    check(!ec_encode_region(shards, parity, CHECK_LEN, NULL),
+          "ec_encode_region() after loading the tuning failed");
+    for (int i = 0; i < p; i++)
+        check(!memcmp(parity[i], shards[k + i], CHECK_LEN),
+              "parity differs after loading the tuning");
+
+    for (int i = 0; i < k; i++) {
+        indices[i] = p + i;
+        input[i] = shards[p + i];
+    }
+    check(!ec_decode_region(input, indices, result, CHECK_LEN, NULL),
+          "ec_decode_region() after loading the tuning failed");
+    for (int i = 0; i < k; i++)
+        check(!memcmp(result[i], shards[i], CHECK_LEN),
+              "decoded data differs after loading the tuning");
+
+    // a file tuned for another code is refused
+    ec_cleanup();
+    check(!ec_init_matrix(k + 1, p, type), "ec_init_matrix() failed");
+    check(ec_tune_load(path) != 0, "ec_tune_load() took a file for another k");
+
+check_tune_err:
+    ec_cleanup();
+    if (ec_init_matrix(k, p, type))
+        check(0, "ec_init_matrix() failed");
+    gf_kernel_set(saved);
+    ec_set_block_size(0);
+    ec_set_threads(1);
+    unlink(path);
+    shards_free(result, k);
+    shards_free(parity, p);
+    shards_free(shards, n);
+}
+
 int main(int argc, char* argv[]) {
     uint32_t k = 0;
     uint32_t p = 0;
@@ -246,9 +2031,10 @@ int main(int argc, char* argv[]) {
     int num_threads = 0;
     int rc = 0;
     pthread_t * threads = 0;
+    enum ec_matrix_type type = EC_MATRIX_VANDERMONDE;
 
-    if (argc != 3) {
-        printf("Requires 2 parameters.\n\n");
+    if (argc != 3 && argc != 4) {
+        printf("Requires 2 or 3 parameters.\n\n");
         printf("%s\n\n", usage);
         exit(1);
     }
@@ -256,13 +2042,47 @@ int main(int argc, char* argv[]) {
     k = atoi(argv[1]);
     p = atoi(argv[2]);
 
+    if (argc == 4) {
+        for (type = 0; type <= EC_MATRIX_AUTO; type++)
+            if (!strcmp(argv[3], matrix_names[type]))
+                break;
+
+        if (type > EC_MATRIX_AUTO) {
+            printf("Unknown matrix type %s.\n\n", argv[3]);
+            printf("%s\n\n", usage);
+            exit(1);
+        }
+    }
+
     // init erasure code module
-    rc = ec_init(k, p);
+    rc = ec_init_matrix(k, p, type);
     if (rc) {
         printf("Error initializing Erasure Code.\n");
         exit(1);
     }
 
+    check_kernels();
+    check_crc(k, p);
+    check_stream_threshold(k, p);
+    check_block_size(k, p);
+    check_verify(k, p);
+    check_planner(k, p);
+    check_decode_batch(k, p);
+    check_encode_batch(k, p);
+    check_accumulate(k, p);
+    check_stream(k, p);
+    check_interleave(k, p);
+    check_encode_object(k, p);
+    check_async(k, p);
+    check_ecd(k, p);
+    check_store(k, p);
+    // without parity there is nothing to rebuild from
+    if (p)
+        check_rebuild(k, p);
+    check_tune(k, p, type);
+    check_save(k, p, type);
+    check_matrix_cost(k, p, type);
+
     // Generate random data and calculate parity
     ec_code = malloc(sizeof(*ec_code) * (k + p));
     if (!ec_code) {
@@ -361,6 +2181,11 @@ int main(int argc, char* argv[]) {
         pthread_join(threads[i], NULL);
     }
 
+    printf("Checks: %lu of %lu passed.\n",
+           checks.passed, checks.passed + checks.failed);
+    if (checks.failed || res.failed)
+        rc = 1;
+
 err:
     // clean up
     free(recv_idx);
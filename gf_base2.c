@@ -4,25 +4,49 @@
 
 #include "gf_base2.h"
 
+#if defined(__x86_64__) || defined(__i386__)
+#define GF_HAVE_X86 1
+#include <tmmintrin.h>
+#endif
+
 struct gf_base2 {
     uint32_t m;     // degree of GF (limited to 8 due to choice of uint8_t)
     uint32_t g;     // coefficients of irreducible polynomial g(x)
     uint32_t order; // number of elements in this Galois Field
 
-    uint8_t * mult_tbl;     //multiplcation table
-    uint8_t * mult_inv_tbl; //multiplicative inverse table
+    const uint8_t * mult_tbl;     //multiplcation table
+    const uint8_t * mult_inv_tbl; //multiplicative inverse table
+    int static_tbl;               //tables are not ours to free
 };
 
 /* static struct for functions in this file only */
 struct gf_base2 gf;
 
+/* region kernel selected by gf_init() or gf_kernel_set() */
+static void (*region_mult_add_fn)(uint8_t *, const uint8_t *, uint8_t, size_t);
+static enum gf_kernel kernel;
+
+static void gf_region_mult_add_table(uint8_t * dst,
+                                     const uint8_t * src,
+                                     uint8_t c,
+                                     size_t len);
+#ifdef GF_HAVE_X86
+static void gf_region_mult_add_ssse3(uint8_t * dst,
+                                     const uint8_t * src,
+                                     uint8_t c,
+                                     size_t len);
+#endif
+
 void
 gf_cleanup() {
-    if (gf.mult_tbl) 
-        free(gf.mult_tbl);
+    if (!gf.static_tbl) {
+        free((void *) gf.mult_tbl);
+        free((void *) gf.mult_inv_tbl);
+    }
 
-    if (gf.mult_inv_tbl)
-        free(gf.mult_inv_tbl);
+    gf.mult_tbl = NULL;
+    gf.mult_inv_tbl = NULL;
+    gf.static_tbl = 0;
 }
 
 uint8_t
@@ -47,11 +71,11 @@ gf_long_mult(uint8_t x, uint8_t y) {
     return (uint8_t) prod;
 }
 
-int
-gf_init(const uint32_t m, const uint32_t g) {
-    const char * mem_err =
-        "Error allocating memory. GF initialization failed.\n";
-
+/*
+ * Validate the field parameters and set up everything except the tables
+ */
+static int
+gf_params_set(const uint32_t m, const uint32_t g) {
     /* Supports only up to degree 8 due to choice of uint8_t */
     if (m > 8) {
         printf(
@@ -73,49 +97,160 @@ gf_init(const uint32_t m, const uint32_t g) {
         return -1;
     }
 
-    printf("Initializing GF(2^%d)...\n", m);
-
+    gf_cleanup();
     memset(&gf, 0, sizeof(gf));
     
     gf.m = m;
     gf.g = g;
     gf.order = 1 << m;
 
+    return 0;
+}
+
+int
+gf_kernel_supported(enum gf_kernel k) {
+    switch (k) {
+        case GF_KERNEL_TABLE:
+            return 1;
+
+#ifdef GF_HAVE_X86
+        case GF_KERNEL_SSSE3:
+            // the nibble-split shuffle kernel needs full 8-bit elements
+            return gf.m == 8 && __builtin_cpu_supports("ssse3");
+#endif
+
+        default:
+            return 0;
+    }
+}
+
+int
+gf_kernel_set(enum gf_kernel k) {
+    if (!gf_kernel_supported(k)) {
+        printf("GF kernel %s is not supported on this host.\n",
+               gf_kernel_name(k));
+        return -1;
+    }
+
+    switch (k) {
+#ifdef GF_HAVE_X86
+        case GF_KERNEL_SSSE3:
+            region_mult_add_fn = gf_region_mult_add_ssse3;
+            break;
+#endif
+
+        default:
+            region_mult_add_fn = gf_region_mult_add_table;
+    }
+
+    kernel = k;
+
+    return 0;
+}
+
+enum gf_kernel
+gf_kernel_get() {
+    return kernel;
+}
+
+const char *
+gf_kernel_name(enum gf_kernel k) {
+    switch (k) {
+        case GF_KERNEL_TABLE:
+            return "table";
+        case GF_KERNEL_SSSE3:
+            return "ssse3";
+        default:
+            return "unknown";
+    }
+}
+
+/*
+ * Pick the fastest supported region kernel once the tables are in place
+ */
+static void
+gf_kernel_select() {
+    for (int k = GF_KERNEL_NUM - 1; k >= 0; k--) {
+        if (gf_kernel_supported(k)) {
+            gf_kernel_set(k);
+            break;
+        }
+    }
+}
+
+int
+gf_init(const uint32_t m, const uint32_t g) {
+    const char * mem_err =
+        "Error allocating memory. GF initialization failed.\n";
+    uint8_t * mult_tbl = 0;
+    uint8_t * mult_inv_tbl = 0;
+
+    if (gf_params_set(m, g))
+        return -1;
+
+    printf("Initializing GF(2^%d)...\n", m);
+
     /* table is 2^m x 2^m entries */
-    gf.mult_tbl = malloc(sizeof(*gf.mult_tbl) * gf.order * gf.order);
-    if (!gf.mult_tbl) {
+    mult_tbl = malloc(sizeof(*mult_tbl) * gf.order * gf.order);
+    if (!mult_tbl) {
         printf("%s", mem_err);
-        gf_cleanup();
         return -1;
     }
 
     for (int row = 0; row < gf.order; row++)
         for (int col = 0; col < gf.order; col++)
-            gf.mult_tbl[row * gf.order + col] = gf_long_mult(row, col);
+            mult_tbl[row * gf.order + col] = gf_long_mult(row, col);
 
     /* table is 2^m x 1 entries */
-    gf.mult_inv_tbl = malloc(sizeof(*gf.mult_inv_tbl) * gf.order);
-    if (!gf.mult_inv_tbl) {
+    mult_inv_tbl = calloc(gf.order, sizeof(*mult_inv_tbl));
+    if (!mult_inv_tbl) {
         printf("%s", mem_err);
-        gf_cleanup();
+        free(mult_tbl);
         return -1;
     }
 
     /* Loop starts at 1; mult. inverse for 0 is undefined. */
     for (int i = 1; i < gf.order; i++) {
         for (int j = 0; j < gf.order; j++) {
-            if (gf.mult_tbl[i * gf.order + j] == 1) {
-                gf.mult_inv_tbl[i] = j;
+            if (mult_tbl[i * gf.order + j] == 1) {
+                mult_inv_tbl[i] = j;
                 break;
             }
         }
     }
 
+    gf.mult_tbl = mult_tbl;
+    gf.mult_inv_tbl = mult_inv_tbl;
+
+    gf_kernel_select();
+
     printf("GF(2^%d) initialization completed.\n\n", m);
     
     return 0;
 }
 
+int
+gf_init_static(const uint32_t m,
+               const uint32_t g,
+               const uint8_t * mult_tbl,
+               const uint8_t * mult_inv_tbl) {
+    // already set up with these tables, e.g. by another module
+    if (gf.static_tbl && gf.m == m && gf.g == g
+        && gf.mult_tbl == mult_tbl && gf.mult_inv_tbl == mult_inv_tbl)
+        return 0;
+
+    if (gf_params_set(m, g))
+        return -1;
+
+    gf.mult_tbl = mult_tbl;
+    gf.mult_inv_tbl = mult_inv_tbl;
+    gf.static_tbl = 1;
+
+    gf_kernel_select();
+
+    return 0;
+}
+
 uint8_t
 gf_add(uint8_t x, uint8_t y) {
     return x ^ y;
@@ -145,6 +280,92 @@ gf_pow(uint8_t x, uint8_t y) {
     return res;
 }
 
+static void
+gf_region_mult_add_table(uint8_t * dst,
+                         const uint8_t * src,
+                         uint8_t c,
+                         size_t len) {
+    // look up the row of the multiplication table once for the whole region
+    const uint8_t * row = &gf.mult_tbl[c * gf.order];
+
+    for (size_t i = 0; i < len; i++)
+        dst[i] ^= row[src[i]];
+}
+
+#ifdef GF_HAVE_X86
+/*
+ * c * x = c * (x & 0x0f) ^ c * (x & 0xf0), so each 16-byte vector is
+ * multiplied with two 16-entry shuffle lookups, one per nibble.
+ */
+__attribute__((target("ssse3")))
+static void
+gf_region_mult_add_ssse3(uint8_t * dst,
+                         const uint8_t * src,
+                         uint8_t c,
+                         size_t len) {
+    uint8_t lo[16];
+    uint8_t hi[16];
+    size_t i = 0;
+
+    for (int j = 0; j < 16; j++) {
+        lo[j] = gf_mult(c, j);
+        hi[j] = gf_mult(c, j << 4);
+    }
+
+    __m128i tbl_lo = _mm_loadu_si128((__m128i *) lo);
+    __m128i tbl_hi = _mm_loadu_si128((__m128i *) hi);
+    __m128i mask = _mm_set1_epi8(0x0f);
+
+    for (; i + 16 <= len; i += 16) {
+        __m128i x = _mm_loadu_si128((__m128i *) &src[i]);
+        __m128i d = _mm_loadu_si128((__m128i *) &dst[i]);
+        __m128i l = _mm_shuffle_epi8(tbl_lo, _mm_and_si128(x, mask));
+        __m128i h = _mm_shuffle_epi8(tbl_hi,
+                                     _mm_and_si128(_mm_srli_epi64(x, 4), mask));
+        d = _mm_xor_si128(d, _mm_xor_si128(l, h));
+        _mm_storeu_si128((__m128i *) &dst[i], d);
+    }
+
+    // tail
+    if (i < len)
+        gf_region_mult_add_table(&dst[i], &src[i], c, len - i);
+}
+#endif
+
+void
+gf_region_mult_add(uint8_t * dst, const uint8_t * src, uint8_t c, size_t len) {
+    switch (c) {
+        case 0:
+            return;
+
+        case 1:
+            for (size_t i = 0; i < len; i++)
+                dst[i] ^= src[i];
+            return;
+
+        default:
+            // setting up the shuffle tables is not worth it for short rows
+            if (len < 32)
+                gf_region_mult_add_table(dst, src, c, len);
+            else
+                region_mult_add_fn(dst, src, c, len);
+    }
+}
+
+void
+gf_region_mult(uint8_t * dst, const uint8_t * src, uint8_t c, size_t len) {
+    if (c == 1) {
+        if (dst != src)
+            memmove(dst, src, len);
+        return;
+    }
+
+    // dst may alias src, so multiply through a row lookup in place
+    const uint8_t * row = &gf.mult_tbl[c * gf.order];
+    for (size_t i = 0; i < len; i++)
+        dst[i] = row[src[i]];
+}
+
 void
 gf_matrix_print(struct gf_matrix * x) {
     for (int i = 0; i < x->rows; i++) {
@@ -205,6 +426,33 @@ gf_print_mult_inv_tbl() {
     printf("\n");
 }
 
+static void
+gf_write_c_array(FILE * f, const char * name, const uint8_t * a, int len) {
+    fprintf(f, "const uint8_t %s[%d] = {", name, len);
+    for (int i = 0; i < len; i++)
+        fprintf(f, "%s0x%02x,", (i % 12) ? " " : "\n    ", a[i]);
+    fprintf(f, "\n};\n\n");
+}
+
+void
+gf_write_c_tables(FILE * f) {
+    fprintf(f,
+        "/*\n"
+        " * Multiplication tables for GF(2^%d) with g(x) = %d.\n"
+        " * Generated by gf_tables -c. Do not edit.\n"
+        " */\n\n"
+        "#include \"gf_static_tables.h\"\n\n",
+        gf.m, gf.g
+    );
+
+    fprintf(f, "const uint32_t gf_static_m = %d;\n\n", gf.m);
+    fprintf(f, "const uint32_t gf_static_g = %d;\n\n", gf.g);
+
+    gf_write_c_array(f, "gf_static_mult_tbl", gf.mult_tbl,
+                     gf.order * gf.order);
+    gf_write_c_array(f, "gf_static_mult_inv_tbl", gf.mult_inv_tbl, gf.order);
+}
+
 struct gf_matrix *
 gf_matrix_create(int rows, int cols) {
     const char * mem_err =
@@ -327,10 +575,10 @@ gf_matrix_swap_cols(struct gf_matrix * x, int col1, int col2) {
 int
 gf_matrix_inv(struct gf_matrix * x, struct gf_matrix * inv) {
     int rc = 0;
-    uint8_t mult_inv = 0;
-    uint8_t scale = 0;
-    int idx = 0;
-    int col = 0;
+    int n = x->rows;
+    int w = 2 * n;  // width of the augmented matrix [x | I]
+    uint8_t * aug = 0;
+    uint8_t * pivot_row = 0;
     int row = 0;
     int row2 = 0;
 
@@ -339,66 +587,122 @@ gf_matrix_inv(struct gf_matrix * x, struct gf_matrix * inv) {
         return -1;
     }
 
-    // make a copy of x so we don't modify the original
-    struct gf_matrix * m = gf_matrix_create_from(x);
+    // work on an augmented copy so we don't modify the original, and so
+    // every elimination step is one row-wide scale-and-add
+    aug = malloc(sizeof(*aug) * n * w);
+    if (!aug) {
+        printf("Error allocating memory. Matrix inversion failed.\n");
+        return -1;
+    }
 
-    gf_matrix_identity_set(inv);
+    memset(aug, 0, sizeof(*aug) * n * w);
+    for (row = 0; row < n; row++) {
+        memcpy(&aug[row * w], &x->v[row * n], n);
+        aug[row * w + n + row] = 1;
+    }
 
-    for (row = 0; row < m->rows; row++) {
-        // index of the pivot
-        int pivot = row * m->cols + row;
+    for (row = 0; row < n; row++) {
+        pivot_row = &aug[row * w];
 
         // if the pivot is zero, find another row to swap
-        if (!m->v[pivot]) {
-            for (row2 = row + 1; row2 < m->rows; row2++) {
-                if (m->v[row2 * m->cols + row]) {
-                    gf_matrix_swap_rows(m, row, row2);
-                    gf_matrix_swap_rows(inv, row, row2);
+        if (!pivot_row[row]) {
+            for (row2 = row + 1; row2 < n; row2++) {
+                if (aug[row2 * w + row]) {
+                    for (int col = 0; col < w; col++) {
+                        uint8_t temp = pivot_row[col];
+                        pivot_row[col] = aug[row2 * w + col];
+                        aug[row2 * w + col] = temp;
+                    }
                     break;
                 }
             }
         }
-        
-        switch (m->v[pivot]) {
-            case 0:
-                printf("Cannot find inverse for the following matrix:\n");
-                gf_matrix_print(x);
-                printf("Got up to here:\n");
-                gf_matrix_print(m);
-                rc = -1;
-                goto inv_err;
-
-            case 1:
-                // no-op
-                break;
 
-            default:
-                // scale row i so pivot is 1
-                mult_inv = gf_mult_inv(m->v[pivot]);
-                for (col = 0; col < m->cols; col++) {
-                    idx = row * m->cols + col;
-                    m->v[idx] = gf_mult(mult_inv, m->v[idx]);
-                    inv->v[idx] = gf_mult(mult_inv, inv->v[idx]);
-                }
-        } // switch pivot value
+        if (!pivot_row[row]) {
+            printf("Cannot find inverse for the following matrix:\n");
+            gf_matrix_print(x);
+            rc = -1;
+            goto inv_err;
+        }
+
+        // scale the row so pivot is 1; columns left of the pivot are zero
+        if (pivot_row[row] != 1)
+            gf_region_mult(&pivot_row[row], &pivot_row[row],
+                           gf_mult_inv(pivot_row[row]), w - row);
 
-        // zero out the ith column in other rows
-        for (row2 = 0; row2 < m->rows; row2++) {
-            // skip the current row
+        // zero out the pivot column in other rows
+        for (row2 = 0; row2 < n; row2++) {
             if (row2 == row)
                 continue;
 
-            scale = m->v[row2 * m->cols + row];
-            for (col = 0; col < m->cols; col++) {
-                m->v[row2 * m->cols + col]
-                    = gf_add(m->v[row2 * m->cols + col], gf_mult(scale, m->v[row * m->cols + col]));
-                inv->v[row2 * inv->cols + col]
-                    = gf_add(inv->v[row2 * inv->cols + col], gf_mult(scale, inv->v[row * inv->cols + col]));
-            }
+            gf_region_mult_add(&aug[row2 * w + row], &pivot_row[row],
+                               aug[row2 * w + row], w - row);
         }
     } // for each row in the original matrix
 
+    for (row = 0; row < n; row++)
+        memcpy(&inv->v[row * inv->cols], &aug[row * w + n], n);
+
 inv_err:
-    gf_matrix_delete(m);
+    free(aug);
+    return rc;
+}
+
+int
+gf_cauchy_matrix_inv(const uint8_t * x,
+                     const uint8_t * y,
+                     int n,
+                     struct gf_matrix * inv) {
+    int rc = -1;
+    uint8_t * num_x = 0;    // prod_k (x_j + y_k)
+    uint8_t * num_y = 0;    // prod_k (x_k + y_i)
+    uint8_t * den_x = 0;    // prod_{k != j} (x_j + x_k)
+    uint8_t * den_y = 0;    // prod_{k != i} (y_i + y_k)
+
+    if (inv->rows != n || inv->cols != n) {
+        printf("Incorrect matrix dimensions to hold inverse.\n");
+        return -1;
+    }
+
+    num_x = malloc(sizeof(uint8_t) * n * 4);
+    if (!num_x) {
+        printf("Error allocating memory. Matrix inversion failed.\n");
+        return -1;
+    }
+    num_y = num_x + n;
+    den_x = num_y + n;
+    den_y = den_x + n;
+
+    for (int i = 0; i < n; i++) {
+        num_x[i] = num_y[i] = den_x[i] = den_y[i] = 1;
+        for (int j = 0; j < n; j++) {
+            num_x[i] = gf_mult(num_x[i], gf_add(x[i], y[j]));
+            num_y[i] = gf_mult(num_y[i], gf_add(x[j], y[i]));
+            if (j != i) {
+                den_x[i] = gf_mult(den_x[i], gf_add(x[i], x[j]));
+                den_y[i] = gf_mult(den_y[i], gf_add(y[i], y[j]));
+            }
+        }
+
+        // x and y must be distinct and disjoint for a Cauchy matrix
+        if (!num_x[i] || !den_x[i] || !den_y[i]) {
+            printf("Not a Cauchy matrix; cannot use closed-form inverse.\n");
+            goto cauchy_err;
+        }
+    }
+
+    for (int i = 0; i < n; i++) {
+        for (int j = 0; j < n; j++) {
+            uint8_t num = gf_mult(num_x[j], num_y[i]);
+            uint8_t den = gf_mult(gf_add(x[j], y[i]),
+                                  gf_mult(den_x[j], den_y[i]));
+            inv->v[i * n + j] = gf_mult(num, gf_mult_inv(den));
+        }
+    }
+
+    rc = 0;
+
+cauchy_err:
+    free(num_x);
     return rc;
 }
@@ -1,7 +1,9 @@
 #ifndef GF_BASE2_H
 #define GF_BASE2_H
 
+#include <stddef.h>
 #include <stdint.h>
+#include <stdio.h>
 
 // structure representing a Matrix
 struct gf_matrix {
@@ -10,8 +12,30 @@ struct gf_matrix {
     uint8_t * v;    // values as a one-dimensional array
 };
 
+// implementations of the region functions, slowest to fastest
+enum gf_kernel {
+    GF_KERNEL_TABLE,    // multiplication table lookups
+    GF_KERNEL_SSSE3,    // 16 bytes at a time with nibble shuffles
+    GF_KERNEL_NUM,
+};
+
 int gf_init(const uint32_t m, const uint32_t g);
 
+/*
+ * Initialize the Galois Field from pregenerated tables (see gf_tables -c)
+ * instead of computing them.  The tables are used in place and must outlive
+ * the field.
+ *
+ * m (IN):            degree of the field
+ * g (IN):            irreducible polynomial the tables were generated with
+ * mult_tbl (IN):     2^m x 2^m multiplication table
+ * mult_inv_tbl (IN): 2^m multiplicative inverse table
+ */
+int gf_init_static(const uint32_t m,
+                   const uint32_t g,
+                   const uint8_t * mult_tbl,
+                   const uint8_t * mult_inv_tbl);
+
 void gf_cleanup();
 
 uint8_t gf_add(uint8_t x, uint8_t y);
@@ -24,10 +48,43 @@ uint8_t gf_mult_inv(uint8_t x);
 
 uint8_t gf_pow(uint8_t x, uint8_t y);
 
+/*
+ * Multiply each byte of src by the constant c and store it in dst.  dst may be
+ * the same buffer as src.
+ */
+void gf_region_mult(uint8_t * dst, const uint8_t * src, uint8_t c, size_t len);
+
+/*
+ * Multiply each byte of src by the constant c and add (XOR) it into dst.
+ * Uses SIMD when available.
+ */
+void gf_region_mult_add(uint8_t * dst,
+                        const uint8_t * src,
+                        uint8_t c,
+                        size_t len);
+
+/*
+ * Region kernel selection.  gf_init() picks the fastest kernel the host
+ * supports; gf_kernel_set() overrides it, e.g. with a tuned choice.
+ */
+int gf_kernel_supported(enum gf_kernel k);
+
+int gf_kernel_set(enum gf_kernel k);
+
+enum gf_kernel gf_kernel_get();
+
+const char * gf_kernel_name(enum gf_kernel k);
+
 void gf_print_mult_tbl();
 
 void gf_print_mult_inv_tbl();
 
+/*
+ * Write the multiplication and inverse tables as compilable C source, in the
+ * form declared by gf_static_tables.h
+ */
+void gf_write_c_tables(FILE * f);
+
 struct gf_matrix * gf_matrix_create(int rows, int cols);
 
 struct gf_matrix * gf_matrix_create_from(struct gf_matrix * x);
@@ -67,4 +124,17 @@ int gf_matrix_mult(struct gf_matrix * x,
                    struct gf_matrix * prod);
 
 int gf_matrix_inv(struct gf_matrix * x, struct gf_matrix * inv);
+
+/*
+ * Closed-form O(n^2) inverse of the n x n Cauchy matrix a[i][j] = 1/(x_i + y_j).
+ * All of x and y must be distinct.
+ *
+ * x (IN):    n row values
+ * y (IN):    n column values
+ * inv (OUT): pre-allocated n x n matrix to hold the inverse
+ */
+int gf_cauchy_matrix_inv(const uint8_t * x,
+                         const uint8_t * y,
+                         int n,
+                         struct gf_matrix * inv);
 #endif
@@ -0,0 +1,18 @@
+#ifndef GF_STATIC_TABLES_H
+#define GF_STATIC_TABLES_H
+
+#include <stdint.h>
+
+/*
+ * Pregenerated tables for the default field, GF(2^8) with g(x) = 283.
+ * gf_static_tables.c is generated at build time by 'gf_tables -c 8 283'.
+ */
+extern const uint32_t gf_static_m;
+
+extern const uint32_t gf_static_g;
+
+extern const uint8_t gf_static_mult_tbl[256 * 256];
+
+extern const uint8_t gf_static_mult_inv_tbl[256];
+
+#endif /* GF_STATIC_TABLES_H */
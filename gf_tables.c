@@ -1,21 +1,37 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "gf_base2.h"
 
-const char * usage = "usage: gf_tables degree g(x)\n"
+const char * usage = "usage: gf_tables [-c file] degree g(x)\n"
+"   -c file: write the tables as compilable C source to file instead of\n"
+"            printing them; degree must be 8\n"
 "   degree: degree of the base 2 Galois Field\n"
 "   g(x):   the coefficients of the irreducible polynomial used for multiplication\n"
-"Example: 'gf_tables 3 11', or 'gf_tables 8 283'";
+"Example: 'gf_tables 3 11', or 'gf_tables -c gf_static_tables.c 8 283'";
 
 int main(int argc, char* argv[]) {
-    if (argc != 3) {
+    const char * c_file = 0;
+    int arg = 1;
+
+    if (argc == 5 && !strcmp(argv[1], "-c")) {
+        c_file = argv[2];
+        arg = 3;
+    } else if (argc != 3) {
         printf("Requires 2 parameters.\n\n");
         printf("%s\n\n", usage);
         exit(1);
     }
 
-    uint32_t m = atoi(argv[1]);
-    uint32_t g = atoi(argv[2]);
+    uint32_t m = atoi(argv[arg]);
+    uint32_t g = atoi(argv[arg + 1]);
+
+    // gf_static_tables.h declares 256 x 256 tables
+    if (c_file && m != 8) {
+        printf("C tables can only be written for degree 8, not %u.\n\n", m);
+        printf("%s\n\n", usage);
+        exit(1);
+    }
 
     int rc = gf_init(m, g);
 
@@ -24,8 +40,20 @@ int main(int argc, char* argv[]) {
         exit(1);
     }
 
-    gf_print_mult_tbl();
-    gf_print_mult_inv_tbl();
+    if (c_file) {
+        FILE * f = fopen(c_file, "w");
+        if (!f) {
+            printf("Error opening %s.\n", c_file);
+            gf_cleanup();
+            exit(1);
+        }
+
+        gf_write_c_tables(f);
+        fclose(f);
+    } else {
+        gf_print_mult_tbl();
+        gf_print_mult_inv_tbl();
+    }
 
     gf_cleanup();
 
@@ -0,0 +1,261 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gf_base2.h"
+#include "gf_static_tables.h"
+#include "lrc.h"
+
+struct lrc {
+    uint32_t k;     // number of data shards
+    uint32_t l;     // number of local groups
+    uint32_t r;     // number of global parities
+    uint32_t n;     // total number of shards
+    uint32_t group_size;        // data shards per group, at least
+    uint32_t group_extra;       // groups that have one more data shard
+    struct gf_matrix * matrix;  // n x k generator matrix
+};
+
+/*
+ * The first k % l groups take one data shard more than the rest, so group
+ * sizes differ by at most one and no group is empty
+ */
+static int
+lrc_group_first(struct lrc * lrc, int group) {
+    int extra = (group < lrc->group_extra) ? group : lrc->group_extra;
+
+    return group * lrc->group_size + extra;
+}
+
+static int
+lrc_group_end(struct lrc * lrc, int group) {
+    return lrc_group_first(lrc, group + 1);
+}
+
+void
+lrc_cleanup(struct lrc * lrc) {
+    if (!lrc)
+        return;
+
+    gf_matrix_delete(lrc->matrix);
+    free(lrc);
+}
+
+struct lrc *
+lrc_init(uint32_t k, uint32_t l, uint32_t r) {
+    if (!k || !l || l > k || k + r > 256) {
+        printf("Unsupported LRC size k = %d, l = %d, r = %d.\n", k, l, r);
+        return NULL;
+    }
+
+    // Need to initialize GF before doing any math
+    int rc = gf_init_static(gf_static_m, gf_static_g,
+                            gf_static_mult_tbl, gf_static_mult_inv_tbl);
+    if (rc) {
+        printf("Error initializing Galois Field.\n");
+        return NULL;
+    }
+
+    struct lrc * lrc = malloc(sizeof(*lrc));
+    if (!lrc) {
+        printf("Error allocating memory for LRC.\n");
+        return NULL;
+    }
+
+    lrc->k = k;
+    lrc->l = l;
+    lrc->r = r;
+    lrc->n = k + l + r;
+    lrc->group_size = k / l;
+    lrc->group_extra = k % l;
+
+    lrc->matrix = gf_matrix_create(lrc->n, k);
+    if (!lrc->matrix) {
+        printf("Failed to create matrix.\n");
+        free(lrc);
+        return NULL;
+    }
+
+    // top rows form the identity matrix
+    gf_matrix_identity_set(lrc->matrix);
+
+    // local rows XOR their group
+    for (int g = 0; g < l; g++)
+        for (int c = lrc_group_first(lrc, g); c < lrc_group_end(lrc, g); c++)
+            lrc->matrix->v[(k + g) * k + c] = 1;
+
+    // global rows are Cauchy rows 1/(x + c), with x = k..k+r-1
+    for (int i = 0; i < r; i++)
+        for (int c = 0; c < k; c++)
+            lrc->matrix->v[(k + l + i) * k + c] = gf_mult_inv(gf_add(k + i, c));
+
+    return lrc;
+}
+
+/*
+ * shards[row] = generator row applied to the data shards
+ */
+static void
+lrc_row_encode(struct lrc * lrc, int row, uint8_t ** data, uint8_t * out, size_t len) {
+    memset(out, 0, len);
+    for (int c = 0; c < lrc->k; c++)
+        gf_region_mult_add(out, data[c], lrc->matrix->v[row * lrc->k + c], len);
+}
+
+int
+lrc_encode_region(struct lrc * lrc, uint8_t ** data, uint8_t ** parity, size_t len) {
+    for (int i = 0; i < lrc->l + lrc->r; i++)
+        lrc_row_encode(lrc, lrc->k + i, data, parity[i], len);
+
+    return 0;
+}
+
+/*
+ * Repair the single lost shard of a group by XORing the rest of the group
+ * and its local parity
+ */
+static void
+lrc_local_repair(struct lrc * lrc, int group, int lost, uint8_t ** shards, size_t len) {
+    int local = lrc->k + group;
+
+    memset(shards[lost], 0, len);
+
+    for (int c = lrc_group_first(lrc, group); c < lrc_group_end(lrc, group); c++)
+        if (c != lost)
+            gf_region_mult_add(shards[lost], shards[c], 1, len);
+
+    if (local != lost)
+        gf_region_mult_add(shards[lost], shards[local], 1, len);
+}
+
+/*
+ * Pick k surviving shards whose generator rows are linearly independent,
+ * preferring data, then local, then global shards.  LRCs are not MDS, so not
+ * every k survivors will do.
+ *
+ * returns: 0 if k independent rows were found
+ */
+static int
+lrc_rows_select(struct lrc * lrc, const uint8_t * lost, int * rows) {
+    int k = lrc->k;
+    uint8_t basis[k][k];    // reduced rows, basis[i][pivot[i]] == 1
+    int pivot[k];
+    uint8_t v[k];
+    int rank = 0;
+
+    for (int row = 0; row < lrc->n && rank < k; row++) {
+        if (lost[row])
+            continue;
+
+        memcpy(v, &lrc->matrix->v[row * k], k);
+        for (int i = 0; i < rank; i++)
+            gf_region_mult_add(v, basis[i], v[pivot[i]], k);
+
+        int c = 0;
+        while (c < k && !v[c])
+            c++;
+
+        // dependent on rows already picked
+        if (c == k)
+            continue;
+
+        gf_region_mult(basis[rank], v, gf_mult_inv(v[c]), k);
+        pivot[rank] = c;
+        rows[rank++] = row;
+    }
+
+    return (rank == k) ? 0 : -1;
+}
+
+/*
+ * Rebuild lost data shards from k independent survivors
+ */
+static int
+lrc_global_repair(struct lrc * lrc, uint8_t ** shards, const uint8_t * lost, size_t len) {
+    int rc = 0;
+    int k = lrc->k;
+    int rows[k];
+
+    rc = lrc_rows_select(lrc, lost, rows);
+    if (rc) {
+        printf("Too many lost shards to decode LRC.\n");
+        return rc;
+    }
+
+    struct gf_matrix * decode_m = gf_matrix_create(k, k);
+    struct gf_matrix * decode_inv_m = gf_matrix_create(k, k);
+    if (!decode_m || !decode_inv_m) {
+        rc = -1;
+        goto global_err;
+    }
+
+    for (int i = 0; i < k; i++)
+        memcpy(&decode_m->v[i * k], &lrc->matrix->v[rows[i] * k], k);
+
+    rc = gf_matrix_inv(decode_m, decode_inv_m);
+    if (rc)
+        goto global_err;
+
+    for (int d = 0; d < k; d++) {
+        if (!lost[d])
+            continue;
+
+        memset(shards[d], 0, len);
+        for (int j = 0; j < k; j++)
+            gf_region_mult_add(shards[d], shards[rows[j]],
+                               decode_inv_m->v[d * k + j], len);
+    }
+
+global_err:
+    gf_matrix_delete(decode_inv_m);
+    gf_matrix_delete(decode_m);
+    return rc;
+}
+
+int
+lrc_decode_region(struct lrc * lrc, uint8_t ** shards, const uint8_t * lost, size_t len) {
+    int rc = 0;
+    int data_lost = 0;
+    uint8_t still_lost[lrc->n];
+
+    memcpy(still_lost, lost, lrc->n);
+
+    // repair every group with exactly one lost shard from the group alone
+    for (int g = 0; g < lrc->l; g++) {
+        int count = 0;
+        int victim = -1;
+
+        for (int c = lrc_group_first(lrc, g); c < lrc_group_end(lrc, g); c++) {
+            if (still_lost[c]) {
+                count++;
+                victim = c;
+            }
+        }
+
+        if (still_lost[lrc->k + g]) {
+            count++;
+            victim = lrc->k + g;
+        }
+
+        if (count == 1) {
+            lrc_local_repair(lrc, g, victim, shards, len);
+            still_lost[victim] = 0;
+        }
+    }
+
+    for (int d = 0; d < lrc->k; d++)
+        data_lost |= still_lost[d];
+
+    if (data_lost) {
+        rc = lrc_global_repair(lrc, shards, still_lost, len);
+        if (rc)
+            return rc;
+    }
+
+    // all data is back; recompute whatever parity is still missing
+    for (int i = lrc->k; i < lrc->n; i++)
+        if (still_lost[i])
+            lrc_row_encode(lrc, i, shards, shards[i], len);
+
+    return 0;
+}
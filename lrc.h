@@ -0,0 +1,61 @@
+#ifndef LRC_H
+#define LRC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Local Reconstruction Code.  The k data shards are split into l local
+ * groups, each protected by an XOR local parity, and r global parities are
+ * computed over all k data shards.
+ *
+ * Shards are numbered 0..k-1 for data, k..k+l-1 for local parities (one per
+ * group, in group order) and k+l..k+l+r-1 for global parities.  Groups
+ * hold consecutive data shards; the first k % l groups have one more shard
+ * than the others.
+ */
+struct lrc;
+
+/*
+ * Create an LRC encoder/decoder
+ *
+ * k (IN): number of data shards
+ * l (IN): number of local groups, 1..k
+ * r (IN): number of global parities
+ *
+ * returns: the LRC, or NULL if failed
+ */
+struct lrc * lrc_init(uint32_t k, uint32_t l, uint32_t r);
+
+void lrc_cleanup(struct lrc * lrc);
+
+/*
+ * Generate the local and global parity shards
+ *
+ * data (IN):    array of k pointers to data shards
+ * parity (OUT): array of l + r pointers to parity shards, local first
+ * len (IN):     length of each shard in bytes
+ */
+int lrc_encode_region(struct lrc * lrc,
+                      uint8_t ** data,
+                      uint8_t ** parity,
+                      size_t len);
+
+/*
+ * Rebuild lost shards in place.  A group with a single lost shard is
+ * repaired from the rest of its group only; anything else falls back to
+ * decoding from the global parities.
+ *
+ * shards (IN/OUT): array of k + l + r pointers to shards.  Buffers of lost
+ *                  shards are overwritten with the rebuilt shards.
+ * lost (IN):       array of k + l + r flags, non-zero for lost shards
+ * len (IN):        length of each shard in bytes
+ *
+ * returns: 0 if success, non-zero if the lost shards cannot be rebuilt
+ */
+int lrc_decode_region(struct lrc * lrc,
+                      uint8_t ** shards,
+                      const uint8_t * lost,
+                      size_t len);
+
+#endif /* LRC_H */
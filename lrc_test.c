@@ -0,0 +1,278 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "lrc.h"
+
+#define PROG_NAME "lrc_test"
+
+#define SHARD_LEN (256)
+
+const char * usage =
+"This program tests LRC local repair and global decoding for all\n"
+"combinations of up to r + 1 lost shards.\n\n"
+"usage: " PROG_NAME " [k l r]\n"
+"k: number of data shards\n"
+"l: number of local groups\n"
+"r: number of global parities\n"
+"Without parameters a set of sizes where l does not divide k is tested.\n"
+"Example: " PROG_NAME " 6 4 2\n\n";
+
+const char * mem_err = "Error allocating memory.";
+
+struct results {
+    uint64_t passed;
+    uint64_t failed;
+};
+
+struct lrc_case {
+    uint32_t k;
+    uint32_t l;
+    uint32_t r;
+    struct lrc * lrc;
+    uint8_t ** orig;    // k + l + r encoded shards
+    uint8_t ** shards;  // working copy handed to lrc_decode_region()
+    uint8_t * lost;
+    struct results * res;
+};
+
+/*
+ * Group of data shard d, with the first k % l groups one shard larger
+ */
+static int
+group_of(struct lrc_case * t, int d) {
+    int small = t->k / t->l;
+    int extra = t->k % t->l;
+
+    if (d < extra * (small + 1))
+        return d / (small + 1);
+
+    return extra + (d - extra * (small + 1)) / small;
+}
+
+static void
+record(struct lrc_case * t, int ok, const char * what) {
+    if (ok) {
+        t->res->passed++;
+    } else {
+        t->res->failed++;
+        printf("Error: %s (k=%u l=%u r=%u)\n", what, t->k, t->l, t->r);
+    }
+}
+
+/*
+ * Restore the working shards, clobber the lost ones and decode
+ *
+ * returns: the result of lrc_decode_region(), or 1 if it reported success
+ *          but the shards differ
+ */
+static int
+decode_check(struct lrc_case * t) {
+    uint32_t n = t->k + t->l + t->r;
+    int rc = 0;
+
+    for (int i = 0; i < n; i++) {
+        if (t->lost[i])
+            memset(t->shards[i], 0xa5, SHARD_LEN);
+        else
+            memcpy(t->shards[i], t->orig[i], SHARD_LEN);
+    }
+
+    rc = lrc_decode_region(t->lrc, t->shards, t->lost, SHARD_LEN);
+    if (rc)
+        return rc;
+
+    for (int i = 0; i < n; i++)
+        if (memcmp(t->shards[i], t->orig[i], SHARD_LEN))
+            return 1;
+
+    return 0;
+}
+
+/*
+ * Every local parity is the XOR of its own, non-empty group
+ */
+static void
+check_groups(struct lrc_case * t) {
+    uint8_t x[SHARD_LEN];
+
+    for (int g = 0; g < t->l; g++) {
+        int members = 0;
+
+        memset(x, 0, sizeof(x));
+        for (int d = 0; d < t->k; d++) {
+            if (group_of(t, d) != g)
+                continue;
+            members++;
+            for (int b = 0; b < SHARD_LEN; b++)
+                x[b] ^= t->orig[d][b];
+        }
+
+        record(t, members > 0 && !memcmp(x, t->orig[t->k + g], SHARD_LEN),
+               "local parity is not the XOR of its group");
+    }
+}
+
+/*
+ * Lose one shard and garble, without reporting them lost, all shards outside
+ * its group.  The shard comes back right only if it is repaired from its
+ * group alone.
+ */
+static void
+check_local_repair(struct lrc_case * t) {
+    uint32_t n = t->k + t->l + t->r;
+
+    for (int v = 0; v < t->k + t->l; v++) {
+        int g = (v < t->k) ? group_of(t, v) : v - t->k;
+        int rc = 0;
+
+        for (int i = 0; i < n; i++) {
+            int member = (i < t->k) ? group_of(t, i) == g : i == t->k + g;
+
+            if (member)
+                memcpy(t->shards[i], t->orig[i], SHARD_LEN);
+            else
+                memset(t->shards[i], 0x5a, SHARD_LEN);
+            t->lost[i] = (i == v);
+        }
+        memset(t->shards[v], 0xa5, SHARD_LEN);
+
+        rc = lrc_decode_region(t->lrc, t->shards, t->lost, SHARD_LEN);
+        record(t, !rc && !memcmp(t->shards[v], t->orig[v], SHARD_LEN),
+               "local repair used shards outside the group");
+        t->lost[v] = 0;
+    }
+}
+
+/*
+ * All combinations of lost shards of the given size, starting at start.
+ * Up to r losses always decode; r + 1 may not, since an LRC is not MDS, but
+ * whatever decodes must be correct.
+ */
+static void
+check_global(struct lrc_case * t, int count, int start, int * undecodable) {
+    uint32_t n = t->k + t->l + t->r;
+
+    if (!count) {
+        int lost = 0;
+        int rc = 0;
+
+        for (int i = 0; i < n; i++)
+            lost += t->lost[i];
+
+        rc = decode_check(t);
+        if (rc == 1 || (rc && lost <= t->r))
+            record(t, 0, "global decode failed");
+        else if (rc)
+            (*undecodable)++;
+        else
+            record(t, 1, NULL);
+        return;
+    }
+
+    for (int i = start; i <= n - count; i++) {
+        t->lost[i] = 1;
+        check_global(t, count - 1, i + 1, undecodable);
+        t->lost[i] = 0;
+    }
+}
+
+static int
+run_case(uint32_t k, uint32_t l, uint32_t r, struct results * res) {
+    uint32_t n = k + l + r;
+    int undecodable = 0;
+    int rc = 0;
+    struct lrc_case t = {
+        .k = k,
+        .l = l,
+        .r = r,
+        .res = res,
+    };
+
+    t.lrc = lrc_init(k, l, r);
+    if (!t.lrc) {
+        printf("Error initializing LRC.\n");
+        return -1;
+    }
+
+    t.orig = calloc(n, sizeof(*t.orig));
+    t.shards = calloc(n, sizeof(*t.shards));
+    t.lost = calloc(n, sizeof(*t.lost));
+    if (!t.orig || !t.shards || !t.lost) {
+        printf("%s\n", mem_err);
+        rc = -1;
+        goto run_case_err;
+    }
+
+    for (int i = 0; i < n; i++) {
+        t.orig[i] = malloc(SHARD_LEN);
+        t.shards[i] = malloc(SHARD_LEN);
+        if (!t.orig[i] || !t.shards[i]) {
+            printf("%s\n", mem_err);
+            rc = -1;
+            goto run_case_err;
+        }
+    }
+
+    for (int i = 0; i < k; i++)
+        for (int b = 0; b < SHARD_LEN; b++)
+            t.orig[i][b] = (uint8_t) (rand() % (UINT8_MAX + 1));
+
+    rc = lrc_encode_region(t.lrc, t.orig, &t.orig[k], SHARD_LEN);
+    if (rc) {
+        printf("Error encoding LRC.\n");
+        goto run_case_err;
+    }
+
+    check_groups(&t);
+    check_local_repair(&t);
+
+    for (int count = 1; count <= r + 1 && count <= n; count++)
+        check_global(&t, count, 0, &undecodable);
+
+    printf("k=%u l=%u r=%u: %d patterns of %u lost shards are not decodable.\n",
+           k, l, r, undecodable, r + 1);
+
+run_case_err:
+    for (int i = 0; t.orig && i < n; i++)
+        free(t.orig[i]);
+    for (int i = 0; t.shards && i < n; i++)
+        free(t.shards[i]);
+    free(t.lost);
+    free(t.shards);
+    free(t.orig);
+    lrc_cleanup(t.lrc);
+    return rc;
+}
+
+int main(int argc, char* argv[]) {
+    // l does not divide k in all but the last
+    uint32_t sizes[][3] = {
+        {6, 4, 2},
+        {7, 3, 2},
+        {10, 4, 2},
+        {5, 2, 1},
+        {12, 2, 2},
+    };
+    struct results res = {0};
+    int rc = 0;
+
+    if (argc != 1 && argc != 4) {
+        printf("Requires 0 or 3 parameters.\n\n");
+        printf("%s\n\n", usage);
+        exit(1);
+    }
+
+    srand(time(NULL));
+
+    if (argc == 4) {
+        rc = run_case(atoi(argv[1]), atoi(argv[2]), atoi(argv[3]), &res);
+    } else {
+        for (int i = 0; i < sizeof(sizes) / sizeof(sizes[0]) && !rc; i++)
+            rc = run_case(sizes[i][0], sizes[i][1], sizes[i][2], &res);
+    }
+
+    printf("Results: %lu of %lu passed.\n", res.passed, res.passed + res.failed);
+
+    return (rc || res.failed) ? 1 : 0;
+}
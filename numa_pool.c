@@ -0,0 +1,373 @@
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "erasure_code.h"
+#include "numa_pool.h"
+#include "queue.h"
+
+#define NUMA_SYSFS "/sys/devices/system/node"
+#define NUMA_MAX_NODES (64)
+#define NUMA_QUEUE_DEPTH (64)
+
+// from linux/mempolicy.h
+#define NUMA_MPOL_BIND (2)
+#define NUMA_MPOL_F_NODE (1 << 0)
+#define NUMA_MPOL_F_ADDR (1 << 1)
+
+struct numa_job {
+    void (*fn)(void *);     // NULL tells the worker to exit
+    void * arg;
+};
+
+struct numa_encode_job {
+    uint8_t ** data;
+    uint8_t ** parity;
+    size_t len;
+    void (*done)(void *, int);
+    void * arg;
+};
+
+struct numa_node {
+    int id;
+    cpu_set_t cpus;
+    int num_threads;
+    pthread_t * threads;
+    struct queue * queue;
+};
+
+struct numa_pool {
+    int num_nodes;
+    struct numa_node nodes[NUMA_MAX_NODES];
+    int pending;            // submitted jobs not finished yet
+    pthread_mutex_t lock;
+    pthread_cond_t idle;
+};
+
+/*
+ * Parse a sysfs CPU list such as "0-3,8-11" into a CPU set
+ */
+static int
+numa_cpulist_parse(const char * list, cpu_set_t * cpus) {
+    CPU_ZERO(cpus);
+
+    while (*list && *list != '\n') {
+        char * end = 0;
+        long first = strtol(list, &end, 10);
+        long last = first;
+
+        if (end == list)
+            return -1;
+
+        if (*end == '-')
+            last = strtol(end + 1, &end, 10);
+
+        for (long c = first; c <= last && c < CPU_SETSIZE; c++)
+            CPU_SET(c, cpus);
+
+        list = (*end == ',') ? end + 1 : end;
+    }
+
+    return CPU_COUNT(cpus) ? 0 : -1;
+}
+
+/*
+ * Fill pool->nodes from sysfs; nodes without CPUs are skipped
+ */
+static void
+numa_topology_discover(struct numa_pool * pool) {
+    DIR * dir = opendir(NUMA_SYSFS);
+    struct dirent * ent = 0;
+
+    while (dir && (ent = readdir(dir)) && pool->num_nodes < NUMA_MAX_NODES) {
+        char path[300];
+        char list[4096];
+        int id = 0;
+
+        if (sscanf(ent->d_name, "node%d", &id) != 1)
+            continue;
+
+        snprintf(path, sizeof(path), NUMA_SYSFS "/%s/cpulist", ent->d_name);
+        FILE * f = fopen(path, "r");
+        if (!f)
+            continue;
+
+        struct numa_node * node = &pool->nodes[pool->num_nodes];
+        if (fgets(list, sizeof(list), f)
+            && !numa_cpulist_parse(list, &node->cpus)) {
+            node->id = id;
+            pool->num_nodes++;
+        }
+
+        fclose(f);
+    }
+
+    if (dir)
+        closedir(dir);
+
+    // no NUMA information: one node with every CPU we may run on
+    if (!pool->num_nodes) {
+        pool->nodes[0].id = 0;
+        sched_getaffinity(0, sizeof(pool->nodes[0].cpus), &pool->nodes[0].cpus);
+        pool->num_nodes = 1;
+    }
+}
+
+static struct numa_node *
+numa_node_find(struct numa_pool * pool, int id) {
+    for (int i = 0; i < pool->num_nodes; i++)
+        if (pool->nodes[i].id == id)
+            return &pool->nodes[i];
+
+    return &pool->nodes[0];
+}
+
+static void *
+numa_worker(void * arg) {
+    struct numa_node * node = arg;
+    struct numa_job job;
+
+    while (1) {
+        queue_get(node->queue, &job);
+        if (!job.fn)
+            break;
+
+        job.fn(job.arg);
+    }
+
+    return NULL;
+}
+
+/*
+ * Submitted work, wrapped so the worker can count it as finished
+ */
+struct numa_submit {
+    struct numa_pool * pool;
+    void (*fn)(void *);
+    void * arg;
+};
+
+static void
+numa_submit_run(void * arg) {
+    struct numa_submit * sub = arg;
+    struct numa_pool * pool = sub->pool;
+
+    sub->fn(sub->arg);
+    free(sub);
+
+    pthread_mutex_lock(&pool->lock);
+    if (--pool->pending == 0)
+        pthread_cond_broadcast(&pool->idle);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void
+numa_pool_submit(struct numa_pool * pool, int node, void (*fn)(void *), void * arg) {
+    struct numa_submit * sub = malloc(sizeof(*sub));
+
+    // no memory to queue it: run it here rather than lose it
+    if (!sub) {
+        fn(arg);
+        return;
+    }
+
+    sub->pool = pool;
+    sub->fn = fn;
+    sub->arg = arg;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->pending++;
+    pthread_mutex_unlock(&pool->lock);
+
+    struct numa_job job = {
+        .fn = numa_submit_run,
+        .arg = sub,
+    };
+
+    queue_put(numa_node_find(pool, node)->queue, &job);
+}
+
+void
+numa_pool_wait(struct numa_pool * pool) {
+    pthread_mutex_lock(&pool->lock);
+    while (pool->pending)
+        pthread_cond_wait(&pool->idle, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+struct numa_pool *
+numa_pool_init(int threads_per_node) {
+    int rc = 0;
+
+    struct numa_pool * pool = calloc(1, sizeof(*pool));
+    if (!pool) {
+        printf("Error allocating memory for NUMA pool.\n");
+        return NULL;
+    }
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->idle, NULL);
+
+    numa_topology_discover(pool);
+
+    for (int i = 0; i < pool->num_nodes; i++) {
+        struct numa_node * node = &pool->nodes[i];
+        int count = threads_per_node ? threads_per_node : CPU_COUNT(&node->cpus);
+
+        node->queue = queue_init(sizeof(struct numa_job), NUMA_QUEUE_DEPTH);
+        node->threads = calloc(count, sizeof(*node->threads));
+        if (!node->queue || !node->threads) {
+            printf("Error allocating memory for NUMA pool.\n");
+            numa_pool_cleanup(pool);
+            return NULL;
+        }
+
+        for (int t = 0; t < count; t++) {
+            pthread_attr_t attr;
+
+            // pin to the node's CPUs from the start so the thread's stack
+            // and first allocations land on the node too
+            pthread_attr_init(&attr);
+            pthread_attr_setaffinity_np(&attr, sizeof(node->cpus), &node->cpus);
+            rc = pthread_create(&node->threads[t], &attr, numa_worker, node);
+            pthread_attr_destroy(&attr);
+
+            if (rc) {
+                printf("Error creating thread. (error=%d)\n", rc);
+                numa_pool_cleanup(pool);
+                return NULL;
+            }
+
+            node->num_threads++;
+        }
+
+        printf("NUMA node %d: %d workers on %d CPUs.\n",
+               node->id, node->num_threads, CPU_COUNT(&node->cpus));
+    }
+
+    return pool;
+}
+
+void
+numa_pool_cleanup(struct numa_pool * pool) {
+    struct numa_job stop = {
+        .fn = NULL,
+        .arg = NULL,
+    };
+
+    if (!pool)
+        return;
+
+    numa_pool_wait(pool);
+
+    for (int i = 0; i < pool->num_nodes; i++) {
+        struct numa_node * node = &pool->nodes[i];
+
+        for (int t = 0; t < node->num_threads; t++)
+            queue_put(node->queue, &stop);
+        for (int t = 0; t < node->num_threads; t++)
+            pthread_join(node->threads[t], NULL);
+
+        free(node->threads);
+        queue_cleanup(node->queue);
+    }
+
+    pthread_cond_destroy(&pool->idle);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool);
+}
+
+int
+numa_pool_nodes(struct numa_pool * pool) {
+    return pool->num_nodes;
+}
+
+void *
+numa_pool_alloc(struct numa_pool * pool, int node, size_t size) {
+    unsigned long mask[NUMA_MAX_NODES / (8 * sizeof(unsigned long))];
+
+    // same node the pool would run work on, so buffer and worker stay local
+    node = numa_node_find(pool, node)->id;
+
+    void * buf = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buf == MAP_FAILED) {
+        printf("Error allocating memory on node %d.\n", node);
+        return NULL;
+    }
+
+    if (node < 0 || node >= NUMA_MAX_NODES)
+        return buf;
+
+    memset(mask, 0, sizeof(mask));
+    mask[node / (8 * sizeof(unsigned long))] |= 1UL << (node % (8 * sizeof(unsigned long)));
+
+    // without kernel NUMA support the pages land wherever they are touched
+    syscall(SYS_mbind, buf, size, NUMA_MPOL_BIND, mask, NUMA_MAX_NODES + 1, 0);
+
+    return buf;
+}
+
+void
+numa_pool_free(void * buf, size_t size) {
+    if (buf)
+        munmap(buf, size);
+}
+
+int
+numa_pool_node_of(struct numa_pool * pool, const void * addr) {
+    int node = 0;
+
+    if (pool->num_nodes == 1)
+        return pool->nodes[0].id;
+
+    if (syscall(SYS_get_mempolicy, &node, NULL, 0, addr,
+                NUMA_MPOL_F_NODE | NUMA_MPOL_F_ADDR))
+        return 0;
+
+    return node;
+}
+
+static void
+numa_encode_run(void * arg) {
+    struct numa_encode_job * job = arg;
+    int rc = ec_encode_region(job->data, job->parity, job->len, NULL);
+
+    if (job->done)
+        job->done(job->arg, rc);
+
+    free(job);
+}
+
+void
+numa_pool_encode(struct numa_pool * pool,
+                 uint8_t ** data,
+                 uint8_t ** parity,
+                 size_t len,
+                 void (*done)(void *, int),
+                 void * arg) {
+    struct numa_encode_job * job = malloc(sizeof(*job));
+    if (!job) {
+        printf("Error allocating memory for encode job.\n");
+        if (done)
+            done(arg, -1);
+        return;
+    }
+
+    job->data = data;
+    job->parity = parity;
+    job->len = len;
+    job->done = done;
+    job->arg = arg;
+
+    numa_pool_submit(pool, numa_pool_node_of(pool, data[0]),
+                     numa_encode_run, job);
+}
@@ -0,0 +1,70 @@
+#ifndef NUMA_POOL_H
+#define NUMA_POOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Worker threads grouped by NUMA node and pinned to that node's CPUs, so
+ * stripes are encoded by a CPU next to the memory they live in.  Hosts
+ * without NUMA information are treated as a single node.
+ */
+struct numa_pool;
+
+/*
+ * Discover the NUMA topology and start the workers
+ *
+ * threads_per_node (IN): workers per node, 0 for one per CPU of the node
+ *
+ * returns: the pool, or NULL if failed
+ */
+struct numa_pool * numa_pool_init(int threads_per_node);
+
+/*
+ * Wait for submitted work to finish and stop the workers
+ */
+void numa_pool_cleanup(struct numa_pool * pool);
+
+int numa_pool_nodes(struct numa_pool * pool);
+
+/*
+ * Allocate a buffer whose pages are placed on the given node.  A node the
+ * pool does not know falls back to its first node, as numa_pool_submit().
+ *
+ * returns: the buffer, or NULL if failed.  Free with numa_pool_free().
+ */
+void * numa_pool_alloc(struct numa_pool * pool, int node, size_t size);
+
+void numa_pool_free(void * buf, size_t size);
+
+/*
+ * Node the memory at addr is placed on, or 0 if unknown
+ */
+int numa_pool_node_of(struct numa_pool * pool, const void * addr);
+
+/*
+ * Run fn(arg) on a worker of the given node
+ */
+void numa_pool_submit(struct numa_pool * pool,
+                      int node,
+                      void (*fn)(void *),
+                      void * arg);
+
+/*
+ * Encode a stripe with ec_encode_region() on the node that holds its first
+ * data shard.  The shard arrays must stay valid until done(arg, rc) is
+ * called from the worker.
+ */
+void numa_pool_encode(struct numa_pool * pool,
+                      uint8_t ** data,
+                      uint8_t ** parity,
+                      size_t len,
+                      void (*done)(void *, int),
+                      void * arg);
+
+/*
+ * Wait until all submitted work has finished
+ */
+void numa_pool_wait(struct numa_pool * pool);
+
+#endif /* NUMA_POOL_H */
@@ -0,0 +1,211 @@
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#include "erasure_code.h"
+#include "numa_pool.h"
+
+#define PROG_NAME "numa_pool_test"
+
+#define STRIPES_PER_NODE (8)
+// not a multiple of any kernel's stride, so the tails run too
+#define SHARD_LEN (65536 + 1000)
+
+const char * usage =
+"This program allocates shards on every NUMA node of a numa_pool, encodes\n"
+"stripes through numa_pool_encode() and checks that the parity matches\n"
+"ec_encode_region(), that each stripe was encoded on the node holding its\n"
+"first data shard and that done() was called once per stripe.\n\n"
+"usage: " PROG_NAME " [k p]\n"
+"Example: " PROG_NAME " 6 3\n\n";
+
+struct stripe {
+    int node;               // node the shards were allocated on
+    uint8_t ** data;
+    uint8_t ** parity;
+    int done_calls;
+    int rc;
+    int ran_on;             // node of the worker that encoded it
+};
+
+static pthread_mutex_t done_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Node of the CPU the calling thread runs on
+ */
+static int
+current_node() {
+    unsigned cpu = 0;
+    unsigned node = 0;
+
+    if (syscall(SYS_getcpu, &cpu, &node, NULL))
+        return -1;
+
+    return node;
+}
+
+static void
+stripe_done(void * arg, int rc) {
+    struct stripe * s = arg;
+
+    pthread_mutex_lock(&done_lock);
+    s->done_calls++;
+    s->rc = rc;
+    s->ran_on = current_node();
+    pthread_mutex_unlock(&done_lock);
+}
+
+int main(int argc, char* argv[]) {
+    uint32_t k = 6;
+    uint32_t p = 3;
+    uint64_t passed = 0;
+    uint64_t failed = 0;
+    int num_stripes = 0;
+    struct numa_pool * pool = 0;
+    struct stripe * stripes = 0;
+    uint8_t * want = 0;
+    int rc = 0;
+
+    if (argc != 1 && argc != 3) {
+        printf("Requires 0 or 2 parameters.\n\n");
+        printf("%s\n\n", usage);
+        exit(1);
+    }
+
+    if (argc == 3) {
+        k = atoi(argv[1]);
+        p = atoi(argv[2]);
+    }
+
+    srand(time(NULL));
+
+    if (ec_init(k, p)) {
+        printf("Error initializing erasure code.\n");
+        exit(1);
+    }
+
+    pool = numa_pool_init(1);
+    if (!pool) {
+        ec_cleanup();
+        exit(1);
+    }
+
+    num_stripes = numa_pool_nodes(pool) * STRIPES_PER_NODE;
+    stripes = calloc(num_stripes, sizeof(*stripes));
+    want = malloc((size_t) p * SHARD_LEN);
+    if (!stripes || !want) {
+        printf("Error allocating memory.\n");
+        rc = -1;
+        goto err;
+    }
+
+    // node ids are taken to be 0..nodes-1, as sysfs numbers them on
+    // machines with CPUs on every node
+    for (int s = 0; s < num_stripes; s++) {
+        struct stripe * st = &stripes[s];
+
+        st->node = s % numa_pool_nodes(pool);
+        st->ran_on = -1;
+        st->data = calloc(k, sizeof(*st->data));
+        st->parity = calloc(p, sizeof(*st->parity));
+        if (!st->data || !st->parity) {
+            printf("Error allocating memory.\n");
+            rc = -1;
+            goto err;
+        }
+
+        for (uint32_t i = 0; i < k + p; i++) {
+            uint8_t * shard = numa_pool_alloc(pool, st->node, SHARD_LEN);
+
+            if (!shard) {
+                rc = -1;
+                goto err;
+            }
+
+            if (i < k) {
+                st->data[i] = shard;
+                for (size_t b = 0; b < SHARD_LEN; b++)
+                    shard[b] = rand();
+            } else {
+                st->parity[i - k] = shard;
+            }
+
+            if (numa_pool_node_of(pool, shard) == st->node) {
+                passed++;
+            } else {
+                printf("Error: shard %u of stripe %d is on node %d, not %d\n",
+                       i, s, numa_pool_node_of(pool, shard), st->node);
+                failed++;
+            }
+        }
+    }
+
+    for (int s = 0; s < num_stripes; s++)
+        numa_pool_encode(pool, stripes[s].data, stripes[s].parity, SHARD_LEN,
+                         stripe_done, &stripes[s]);
+
+    numa_pool_wait(pool);
+
+    for (int s = 0; s < num_stripes; s++) {
+        struct stripe * st = &stripes[s];
+        uint8_t * out[p];
+        int ok = 1;
+
+        for (uint32_t i = 0; i < p; i++)
+            out[i] = &want[i * SHARD_LEN];
+
+        if (ec_encode_region(st->data, out, SHARD_LEN, NULL)) {
+            printf("Error: ec_encode_region() failed for stripe %d\n", s);
+            ok = 0;
+        }
+
+        for (uint32_t i = 0; i < p && ok; i++) {
+            if (memcmp(st->parity[i], out[i], SHARD_LEN)) {
+                printf("Error: parity %u of stripe %d differs from ec_encode_region()\n",
+                       i, s);
+                ok = 0;
+            }
+        }
+
+        if (st->done_calls != 1 || st->rc) {
+            printf("Error: done() called %d times with rc=%d for stripe %d\n",
+                   st->done_calls, st->rc, s);
+            ok = 0;
+        }
+
+        if (st->ran_on != numa_pool_node_of(pool, st->data[0])) {
+            printf("Error: stripe %d was encoded on node %d, its data is on node %d\n",
+                   s, st->ran_on, numa_pool_node_of(pool, st->data[0]));
+            ok = 0;
+        }
+
+        if (ok)
+            passed++;
+        else
+            failed++;
+    }
+
+    printf("Results: %lu of %lu passed.\n", passed, passed + failed);
+    rc = failed ? 1 : 0;
+
+err:
+    for (int s = 0; stripes && s < num_stripes; s++) {
+        for (uint32_t i = 0; stripes[s].data && i < k; i++)
+            numa_pool_free(stripes[s].data[i], SHARD_LEN);
+        for (uint32_t i = 0; stripes[s].parity && i < p; i++)
+            numa_pool_free(stripes[s].parity[i], SHARD_LEN);
+        free(stripes[s].data);
+        free(stripes[s].parity);
+    }
+    free(stripes);
+    free(want);
+    numa_pool_cleanup(pool);
+    ec_cleanup();
+
+    return rc ? 1 : 0;
+}
@@ -121,4 +121,6 @@ queue_timed_get(struct queue * q, void * entry, const struct timespec * timeout)
 
     pthread_mutex_unlock(&q->lock);
     sem_post(&q->sem_space);
+
+    return 0;
 }